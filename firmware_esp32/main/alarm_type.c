@@ -8,17 +8,20 @@
 
 #include "alarm_type.h"
 #include <stdlib.h>
-#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "slab_pool.h"
 
 static const char *TAG = "ALARM_TYPE";
 
+SLAB_POOL_DEFINE(alarm_pool, Alarm_data_t, ALARM_TYPE_POOL_SIZE);
+
 static const char* info_sentences[AC_MAX_CLASSES] = {
-    "La temperatura es demasiado elevada. Recomendamos activar la climatizacion.",
-    "La temperatura es demasiado baja. Recomendamos activar la climatizacion.",
-    "La humedad es demasiado elevada. Recomendamos deshumidificar el ambiente.",
-    "La humedad es demasiado baja. Recomendamos humidificar el ambiente.",
-    "La calidad del aire es mala. Recomendamos ventilar o purificar el aire."
+    AC_INFO_TEMP_H,
+    AC_INFO_TEMP_L,
+    AC_INFO_HUM_H,
+    AC_INFO_HUM_L,
+    AC_INFO_VOC_LIMIT
 };
 
 
@@ -43,6 +46,16 @@ const char* alarm_class_to_string(Alarm_class aclass)
 	}
 }
 
+const char* alarm_class_info(Alarm_class aclass)
+{
+	if ((aclass < 0) || (aclass >= AC_MAX_CLASSES))
+	{
+		return "";
+	}
+
+	return info_sentences[aclass];
+}
+
 
 bool alarm_type_create(Alarm_data_ptr* out_alarm_data, bool disable,
                        Alarm_class alarm_class)
@@ -52,15 +65,9 @@ bool alarm_type_create(Alarm_data_ptr* out_alarm_data, bool disable,
         return false;
     }
 
-    heap_caps_check_integrity_all(true);
-    ESP_LOGI(TAG, "Heap libre antes de malloc: %d", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
-
-    (*out_alarm_data) = (Alarm_data_ptr)malloc(sizeof(Alarm_data_t));
-
-    heap_caps_check_integrity_all(true);
-    ESP_LOGI(TAG, "Heap libre despues de malloc: %d", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    (*out_alarm_data) = (Alarm_data_ptr)slab_pool_alloc(&alarm_pool);
 
-    // fallo de malloc
+    // pool agotado
     if ((*out_alarm_data) == NULL)
     {
         return false;
@@ -69,6 +76,8 @@ bool alarm_type_create(Alarm_data_ptr* out_alarm_data, bool disable,
     (*out_alarm_data)->disable = disable;
     (*out_alarm_data)->alarm_class = alarm_class;
     (*out_alarm_data)->info = info_sentences[alarm_class];
+    (*out_alarm_data)->created_us = esp_timer_get_time();
+    atomic_init(&(*out_alarm_data)->refcount, 1);
 
     return true;
 }
@@ -80,7 +89,7 @@ esp_err_t alarm_type_clone(Alarm_data_ptr src_alarm_data, Alarm_data_ptr* dst_al
         return ESP_ERR_INVALID_ARG;
     }
 
-    *dst_alarm_data = (Alarm_data_ptr)malloc(sizeof(Alarm_data_t));
+    *dst_alarm_data = (Alarm_data_ptr)slab_pool_alloc(&alarm_pool);
     if (*dst_alarm_data == NULL)
     {
         return ESP_FAIL;
@@ -89,6 +98,8 @@ esp_err_t alarm_type_clone(Alarm_data_ptr src_alarm_data, Alarm_data_ptr* dst_al
     (*dst_alarm_data)->disable = src_alarm_data->disable;
     (*dst_alarm_data)->alarm_class = src_alarm_data->alarm_class;
     (*dst_alarm_data)->info = src_alarm_data->info;
+    (*dst_alarm_data)->created_us = src_alarm_data->created_us;
+    atomic_init(&(*dst_alarm_data)->refcount, 1);
 
     return ESP_OK;
 }
@@ -126,7 +137,31 @@ esp_err_t alarm_type_to_JSON(struct json_out * json_buffer, int buffer_size, Ala
     return ret;
 }
 
+Alarm_data_ptr alarm_type_retain(Alarm_data_ptr alarm_data)
+{
+	if (alarm_data != NULL)
+	{
+		atomic_fetch_add_explicit(&alarm_data->refcount, 1, memory_order_relaxed);
+	}
+
+	return alarm_data;
+}
+
 void alarm_data_release(Alarm_data_t* alarm_data)
 {
-	if (alarm_data != NULL) free(alarm_data);
+	if (alarm_data == NULL)
+	{
+		return;
+	}
+
+	// el ultimo propietario libera la memoria
+	if (atomic_fetch_sub_explicit(&alarm_data->refcount, 1, memory_order_acq_rel) == 1)
+	{
+		slab_pool_free(&alarm_pool, alarm_data);
+	}
+}
+
+void alarm_type_get_pool_stats(slab_pool_stats_t *out)
+{
+	slab_pool_get_stats(&alarm_pool, out);
 }
@@ -9,8 +9,22 @@
 #ifndef MAIN_ALARM_TYPE_H_
 #define MAIN_ALARM_TYPE_H_
 
+#include <stdatomic.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 #include "frozen.h"
+#include "slab_pool.h"
+
+/* Objects of the static pool of alarms. An alarm is shared by reference
+ * between channels, the worst case is every channel subscribed to
+ * GSS_ALARM_READY (mqtt, gui) with a different alarm in each alarm slot of
+ * its priority lane (an activation and a deactivation per class, see
+ * GSS_PRIORITY_LANE_LENGTH) and one more being handled, plus the labels
+ * shown in the UI (one per class) and the one the alarm manager is sending */
+#define ALARM_TYPE_POOL_CHANNELS	2
+#define ALARM_TYPE_POOL_SIZE	(ALARM_TYPE_POOL_CHANNELS * ((2 * AC_MAX_CLASSES) + 1) \
+								+ AC_MAX_CLASSES + 1)
 
 typedef enum
 {
@@ -22,11 +36,26 @@ typedef enum
     AC_MAX_CLASSES
 } Alarm_class;
 
+/* Info text of every class. They are also embedded already escaped in the
+ * JSON fragments of aqi_json_schema.c, so they must not need JSON escaping */
+#define AC_INFO_TEMP_H		"La temperatura es demasiado elevada. Recomendamos activar la climatizacion."
+#define AC_INFO_TEMP_L		"La temperatura es demasiado baja. Recomendamos activar la climatizacion."
+#define AC_INFO_HUM_H		"La humedad es demasiado elevada. Recomendamos deshumidificar el ambiente."
+#define AC_INFO_HUM_L		"La humedad es demasiado baja. Recomendamos humidificar el ambiente."
+#define AC_INFO_VOC_LIMIT	"La calidad del aire es mala. Recomendamos ventilar o purificar el aire."
+
+/**
+ * Alarm payload. It is immutable once created and shared by every consumer
+ * that receives it, each one owns a reference that must be given back with
+ * alarm_data_release.
+ */
 typedef struct Alarm_data_t
 {
     bool disable;
     Alarm_class alarm_class;
     const char* info;
+    int64_t created_us;     // esp_timer_get_time() when the alarm was evaluated
+    atomic_uint_fast32_t refcount;
 } Alarm_data_t;
 
 typedef Alarm_data_t* Alarm_data_ptr;
@@ -36,10 +65,16 @@ typedef Alarm_data_t* Alarm_data_ptr;
  */
 const char* alarm_class_to_string(Alarm_class aclass);
 
+/**
+ * Texto informativo de una clase de alarma, "" si no es valida
+ */
+const char* alarm_class_info(Alarm_class aclass);
+
 /**
  * @brief Creates a new instance of an Alarm_data_t.
- * If alarm_data is NULL, creates a new structure in the heap
+ * If alarm_data is NULL, takes a new structure from the static pool
  * and initializes it with the data passed as arguments.
+ * The caller owns the only reference of the new alarm.
  *
  * @param[out] alarm_data pointer to an Alarm_data_ptr which
  *        pointed structure must be created and initialized
@@ -47,8 +82,7 @@ const char* alarm_class_to_string(Alarm_class aclass);
  * @param[in] alarm_class
  *
  * @return Returns ESP_OK if a new structure has been allocated.
- *         Returns ESP_FAIL if the new structure cannot be allocated in the heap
- *         and the creation fails.
+ *         Returns ESP_FAIL if the pool is exhausted and the creation fails.
  *
  * @warning If the contents of out_alarm_data is not null (It is currently pointing to
  *          a previously allocated structure) you may lose the pointer to some allocated memory
@@ -57,7 +91,8 @@ bool alarm_type_create(Alarm_data_ptr* out_alarm_data, bool disable,
                        Alarm_class alarm_class);
 
 /**
- * @brief Function to clone an Alarm_data_t structure
+ * @brief Function to clone an Alarm_data_t structure. The clone is
+ * 		  an independent alarm with its own reference count.
  *
  * @param src_alarm_data    Pointer to the source Alarm_data_t structure
  * @param out_alarm_data    Pointer to the pointer to the destination Alarm_data_t structure
@@ -83,10 +118,24 @@ esp_err_t alarm_type_clone(Alarm_data_ptr src_alarm_data, Alarm_data_ptr* dst_al
 esp_err_t alarm_type_to_JSON(struct json_out * json_buffer, int buffer_size, Alarm_data_ptr alarm_data);
 
 /**
- * @brief Release an 'Alarm_data_t'
+ * @brief Takes a new reference to a shared 'Alarm_data_t'
+ *
+ * @param alarm_data
+ * @return alarm_data
+ */
+Alarm_data_ptr alarm_type_retain(Alarm_data_ptr alarm_data);
+
+/**
+ * @brief Release a reference to an 'Alarm_data_t', the object goes back
+ * 		  to the pool when the last reference is released
  *
  * @param alarm_data
  */
 void alarm_data_release(Alarm_data_t* alarm_data);
 
+/**
+ * @brief Occupancy of the Alarm_data_t pool
+ */
+void alarm_type_get_pool_stats(slab_pool_stats_t *out);
+
 #endif /* MAIN_ALARM_TYPE_H_ */
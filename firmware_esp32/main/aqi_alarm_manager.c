@@ -6,15 +6,23 @@
  */
 
 #include "aqi_alarm_manager.h"
+
+#include <string.h>
+
 #include "aqi_alarm_triggers.h"
 #include "global_system_signaler.h"
 #include "aqi_config_manager.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 static const char *TAG = "AQI_ALARM_MGR";
 
 static bool alarms_activation_state[AC_MAX_CLASSES];
 
+// latencias de entrega, las actualizan las tareas consumidoras
+static aqi_alarm_latency_t delivery_latency[AQI_ALARM_SINK_MAX];
+static portMUX_TYPE latency_lock = portMUX_INITIALIZER_UNLOCKED;
+
 static evaluate_alarm_trigger_condition*
 		alarms_triggers_by_class[AC_MAX_CLASSES] = {
 			aqi_is_temperature_above_max,
@@ -30,13 +38,77 @@ void aqi_alarm_manager_init()
 	{
 		alarms_activation_state[c] = false;
 	}
+
+	portENTER_CRITICAL(&latency_lock);
+	memset(delivery_latency, 0, sizeof(delivery_latency));
+	portEXIT_CRITICAL(&latency_lock);
+}
+
+void aqi_alarm_manager_record_delivery(AQI_ALARM_SINK sink, const Alarm_data_t *alarm)
+{
+	if ((alarm == NULL) || (sink >= AQI_ALARM_SINK_MAX))
+	{
+		return;
+	}
+
+	int64_t elapsed = esp_timer_get_time() - alarm->created_us;
+	uint32_t elapsed_us = (elapsed < 0) ? 0 : ((elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed);
+
+	portENTER_CRITICAL(&latency_lock);
+	aqi_alarm_latency_t *lat = &delivery_latency[sink];
+	lat->count++;
+	lat->last_us = elapsed_us;
+	lat->sum_us += elapsed_us;
+	if (elapsed_us > lat->max_us)
+	{
+		lat->max_us = elapsed_us;
+	}
+	if (elapsed_us > AQI_ALARM_LATENCY_BUDGET_US)
+	{
+		lat->over_budget++;
+	}
+	portEXIT_CRITICAL(&latency_lock);
+
+	if (elapsed_us > AQI_ALARM_LATENCY_BUDGET_US)
+	{
+		ESP_LOGW(TAG, "Alarma %s entregada en %s con %lu us de latencia",
+				alarm_class_to_string(alarm->alarm_class), aqi_alarm_sink_to_string(sink),
+				(unsigned long)elapsed_us);
+	}
+}
+
+esp_err_t aqi_alarm_manager_get_latency(AQI_ALARM_SINK sink, aqi_alarm_latency_t *out)
+{
+	if ((out == NULL) || (sink >= AQI_ALARM_SINK_MAX))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	portENTER_CRITICAL(&latency_lock);
+	*out = delivery_latency[sink];
+	portEXIT_CRITICAL(&latency_lock);
+
+	return ESP_OK;
+}
+
+const char* aqi_alarm_sink_to_string(AQI_ALARM_SINK sink)
+{
+	switch (sink)
+	{
+		case AQI_ALARM_SINK_MQTT:
+			return "mqtt";
+		case AQI_ALARM_SINK_UI:
+			return "ui";
+		default:
+			return "UNKNOWN_SINK";
+	}
 }
 
 /**
- * @brief Envía una alarma a los canales MQTT y GUI, y actualiza su estado de activación o desactivación.
+ * @brief Envía una alarma a todos los canales del GSS, y actualiza su estado de activación o desactivación.
  *
  * Esta función crea una alarma basada en la clase especificada y el estado deseado (activación o desactivación).
- * Intenta enviar la alarma tanto al sistema MQTT como a la interfaz gráfica de usuario (GUI).
+ * La misma instancia se difunde a todos los canales (MQTT, GUI...), cada uno con su propia referencia.
  * Si al menos uno de los envíos es exitoso, se actualiza el estado de activación de la clase de alarma
  * en el vector global 'alarms_activation_state'.
  *
@@ -48,64 +120,39 @@ void aqi_alarm_manager_init()
  * - ESP_FAIL si no se pudo enviar la alarma por ningún canal.
  *
  * @note Esta función genera mensajes de log para depuración en caso de errores
- *       al crear, clonar o enviar la alarma. El estado de activación de la alarma
+ *       al crear o enviar la alarma. El estado de activación de la alarma
  *       solo se actualiza si el mensaje fue enviado correctamente.
  */
 static esp_err_t send_alarm(Alarm_class alarm_class, bool deactivate)
 {
-	Alarm_data_ptr alarm_to_mqtt = NULL;
-	Alarm_data_ptr alarm_to_gui = NULL;
-	bool alarm_mqtt_created = false;
-	esp_err_t err_mqtt = ESP_FAIL;
-	esp_err_t err_ui = ESP_FAIL;
+	Alarm_data_ptr alarm = NULL;
+	esp_err_t err_broadcast = ESP_FAIL;
 	esp_err_t something_sent = ESP_FAIL;
+	uint8_t delivered = 0;
 
-	// Crear alarmas
-	alarm_mqtt_created = alarm_type_create(&alarm_to_mqtt, deactivate, alarm_class);
-	err_ui = alarm_type_clone(alarm_to_mqtt, &alarm_to_gui);
-
-	// debug
-	if (!alarm_mqtt_created)
-		ESP_LOGE(TAG, "Alarma clase %s no se puede crear en heap", alarm_class_to_string(alarm_class));
-	if (err_ui == ESP_FAIL)
-		ESP_LOGE(TAG, "Alarma clase %s no se puede clonar en heap", alarm_class_to_string(alarm_class));
-
-	// enviar alarmas
-	if (alarm_mqtt_created)
+	// Crear una unica alarma, los canales comparten la misma instancia
+	if (!alarm_type_create(&alarm, deactivate, alarm_class))
 	{
-		err_mqtt = gss_send_alarm_data(alarm_to_mqtt, GSS_ID_MQTT_SENDER);
-		if (err_mqtt == ESP_OK)	// debug
-		{
-			ESP_LOGI(TAG, "alarm %s enviada a cola mqtt", alarm_class_to_string(alarm_class));
-		}
-		else
-		{
-			ESP_LOGE(TAG, "alarm %s imposible enviar a cola mqtt", alarm_class_to_string(alarm_class));
-		}
+		ESP_LOGE(TAG, "Alarma clase %s no se puede crear, pool de alarmas agotado", alarm_class_to_string(alarm_class));
+		return ESP_FAIL;
 	}
 
-	if (err_ui == ESP_OK)
-	{
-		err_ui = gss_send_alarm_data(alarm_to_gui, GSS_ID_GUI);
-		if (err_ui == ESP_OK)	// debug
-		{
-			ESP_LOGI(TAG, "alarm %s enviada a cola UI", alarm_class_to_string(alarm_class));
-		}
-		else
-		{
-			ESP_LOGE(TAG, "alarm %s imposible enviar a cola UI", alarm_class_to_string(alarm_class));
-		}
-	}
+	// enviar alarma a todos los canales
+	err_broadcast = gss_broadcast_alarm_data(alarm, &delivered);
+	ESP_LOGI(TAG, "alarm %s entregada a %u canales", alarm_class_to_string(alarm_class), delivered);
+
+	// cada canal tiene su propia referencia, se libera la de creacion
+	alarm_data_release(alarm);
 
 	// Marcar alarma como activada si se ha podido enviar
 	// una activacion de alarma al menos por un canal
-	if ((err_mqtt == ESP_OK || err_ui == ESP_OK) && !deactivate)
+	if ((err_broadcast == ESP_OK) && !deactivate)
 	{
 		// Dar por valida la activacion de la clase de alarma tratada
 		alarms_activation_state[alarm_class] = true;
 		something_sent = ESP_OK;
 	}
-	else if ((err_mqtt == ESP_OK || err_ui == ESP_OK) && deactivate)
+	else if ((err_broadcast == ESP_OK) && deactivate)
 	{
 		// En el caso en el que se habia enviado una desactivacion de alarma,
 		// marcar alarma como desactivadao si se ha podido enviar el mensaje
@@ -154,18 +201,10 @@ static void evaluate_procedure(Sensors_data_ptr sensor_data, AQI_device_config_d
 
 void aqi_alarm_manager_evaluate(Sensors_data_ptr incoming_sensor_data)
 {
-	// Leer limites actuales
+	// Leer limites actuales, todos de la misma version de la config y sin
+	// esperar al mutex del config manager
 	AQI_device_config_data_t current_limits;
-	aqi_config_manager_get(AQI_CV_ALARM_TEMP_H, &(current_limits.alarm_temp_h),
-			sizeof(current_limits.alarm_temp_h));
-	aqi_config_manager_get(AQI_CV_ALARM_TEMP_L, &(current_limits.alarm_temp_l),
-			sizeof(current_limits.alarm_temp_l));
-	aqi_config_manager_get(AQI_CV_ALARM_HUMIDITY_H, &(current_limits.alarm_humidity_h),
-			sizeof(current_limits.alarm_humidity_h));
-	aqi_config_manager_get(AQI_CV_ALARM_HUMIDITY_L, &(current_limits.alarm_humidity_l),
-			sizeof(current_limits.alarm_humidity_l));
-	aqi_config_manager_get(AQI_CV_ALARM_VOC_INDEX_LIMIT, &(current_limits.alarm_voc_index),
-			sizeof(current_limits.alarm_voc_index));
+	aqi_config_manager_get_snapshot(&current_limits, NULL);
 
 	// Debug
 	ESP_LOGI(TAG, "Evaluacion. Config actual: TEMP_H=%hu;\nTEMP_L=%hu; "
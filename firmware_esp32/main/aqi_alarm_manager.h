@@ -14,6 +14,31 @@
 
 typedef bool evaluate_alarm_trigger_condition(const Sensors_data_ptr, const AQI_device_config_data_t_ptr);
 
+/* Latencia maxima esperada entre la evaluacion y la entrega de una alarma */
+#define AQI_ALARM_LATENCY_BUDGET_US		(200 * 1000)
+
+/**
+ * Destinos finales de una alarma cuya latencia se mide
+ */
+typedef enum
+{
+	AQI_ALARM_SINK_MQTT,	// esp_mqtt_client_publish aceptado
+	AQI_ALARM_SINK_UI,		// label de la alarma insertado/eliminado
+	AQI_ALARM_SINK_MAX
+} AQI_ALARM_SINK;
+
+/**
+ * Latencia evaluacion -> entrega de las alarmas en un destino
+ */
+typedef struct
+{
+	uint32_t count;
+	uint32_t last_us;
+	uint32_t max_us;
+	uint64_t sum_us;
+	uint32_t over_budget;	// entregas por encima de AQI_ALARM_LATENCY_BUDGET_US
+} aqi_alarm_latency_t;
+
 /**
  * @brief Inicializa los estados de activación de alarmas
  * 		  como desactivadas
@@ -23,5 +48,27 @@ void aqi_alarm_manager_init();
 
 void aqi_alarm_manager_evaluate(Sensors_data_ptr incoming_sensor_data);
 
+/**
+ * @brief Registra que una alarma ha llegado a su destino final. La llaman
+ * 		  los consumidores del GSS tras publicar o mostrar la alarma.
+ * 		  Es thread-safe.
+ *
+ * @param sink	destino que ha entregado la alarma
+ * @param alarm	alarma entregada
+ */
+void aqi_alarm_manager_record_delivery(AQI_ALARM_SINK sink, const Alarm_data_t *alarm);
+
+/**
+ * @brief Copia las latencias de entrega de alarmas de un destino
+ *
+ * @return ESP_OK o ESP_ERR_INVALID_ARG
+ */
+esp_err_t aqi_alarm_manager_get_latency(AQI_ALARM_SINK sink, aqi_alarm_latency_t *out);
+
+/**
+ * For debug only
+ */
+const char* aqi_alarm_sink_to_string(AQI_ALARM_SINK sink);
+
 
 #endif /* MAIN_AQI_ALARM_MANAGER_H_ */
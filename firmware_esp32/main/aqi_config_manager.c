@@ -14,11 +14,16 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_system.h"
+#include "esp_crc.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "blufi_manager.h"
+#include "global_system_signaler.h"
 
 static const char *TAG = "AQI_CONFIG_MANAGER";
 
@@ -27,17 +32,401 @@ static nvs_handle_t aqi_nvs_handle;
 // Configuracion por defecto
 static AQI_device_config_data_t aqi_default_config;
 
-// Cache global
-static AQI_device_config_data_t aqi_config_cache;
+typedef struct
+{
+	AQI_device_config_data_t config;
+	uint32_t revision;		// version de la config guardada
+} aqi_config_cache_entry_t;
+
+// Cache global: dos copias y un contador de secuencia. Los escritores,
+// serializados por el mutex, modifican una copia mientras los lectores usan
+// la otra, asi que un lector nunca espera a un commit en la NVS: solo repite
+// la lectura si ha cambiado la secuencia mientras copiaba
+static aqi_config_cache_entry_t aqi_config_cache[2];
+static atomic_uint aqi_config_seq = 0;
 
 // Para exclusion mutua
 static SemaphoreHandle_t aqi_config_manager_mutex = NULL;
 
+// Bytes de AQI_device_config_data_t que se guardan: hasta el final del
+// ultimo campo, sin el relleno. Al anadir un campo al final del struct hay
+// que cambiar aqui el ultimo campo
+#define AQI_CONFIG_BLOB_DATA_LEN	(offsetof(AQI_device_config_data_t, reset_wifi_provisioning) \
+									+ sizeof(bool))
+
+#define AQI_CONFIG_BLOB_MAGIC		0x43495141u		// "AQIC"
+
+// Cabecera de la version 1 del blob, sin revision: magic, version, length y crc
+#define AQI_CONFIG_BLOB_V1_HEADER_LEN	12u
+
+// Revision de la primera config guardada y de la migrada de un blob sin revision
+#define AQI_CONFIG_FIRST_REVISION	1u
+
+// Config persistida en una sola entrada de la NVS
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;		// AQI_CONFIG_BLOB_VERSION
+	uint16_t length;		// bytes de config guardados
+	uint32_t crc;			// CRC32 de revision y de los bytes de config
+	uint32_t revision;		// sube con cada cambio de config, no se reinicia
+	AQI_device_config_data_t config;
+} aqi_config_blob_t;
+
+// el CRC cubre revision y config de una vez
+_Static_assert(offsetof(aqi_config_blob_t, config) == (offsetof(aqi_config_blob_t, revision) + sizeof(uint32_t)),
+		"Hueco entre revision y config en el blob");
+
+// las variables cambiadas se marcan en una mascara de bits
+_Static_assert(AQI_NUM_CFG_VARS <= 32, "Demasiadas variables de config");
+
+
+/**
+ * Copia estable de la cache. Solo para escritores con el mutex tomado
+ */
+static const aqi_config_cache_entry_t* aqi_config_cache_current(void)
+{
+	return &aqi_config_cache[atomic_load_explicit(&aqi_config_seq, memory_order_relaxed) & 1u];
+}
+
+/**
+ * Publica una nueva version de la config. Con el mutex tomado
+ */
+static void aqi_config_cache_publish(const AQI_device_config_data_t *config, uint32_t revision)
+{
+	// secuencia impar: los lectores pasan a la copia 1 mientras se escribe la 0
+	atomic_fetch_add_explicit(&aqi_config_seq, 1, memory_order_seq_cst);
+	aqi_config_cache[0].config = *config;
+	aqi_config_cache[0].revision = revision;
+	// secuencia par: vuelven a la 0 mientras se escribe la 1
+	atomic_fetch_add_explicit(&aqi_config_seq, 1, memory_order_seq_cst);
+	aqi_config_cache[1].config = *config;
+	aqi_config_cache[1].revision = revision;
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * Lee la config del blob de la NVS sobre 'config', que debe llevar los
+ * valores por defecto: un blob de un firmware anterior con menos campos
+ * solo sobreescribe los suyos.
+ *
+ * @param revision[out] opcional, revision guardada. 0 en un blob de la
+ * 		  version 1, que no la tenia
+ * @param migrated[out] opcional, true si el blob es de un firmware anterior
+ * 		  y hay que reescribirlo
+ */
+static esp_err_t aqi_config_blob_load(AQI_device_config_data_t *config, uint32_t *revision, bool *migrated)
+{
+	aqi_config_blob_t blob;
+	size_t size = sizeof(blob);
+	size_t header_len = offsetof(aqi_config_blob_t, config);
+	uint32_t crc;
+	esp_err_t err = nvs_get_blob(aqi_nvs_handle, AQI_KEY_CONFIG_BLOB, &blob, &size);
+
+	if (migrated != NULL)
+	{
+		*migrated = false;
+	}
+
+	if (err != ESP_OK)
+	{
+		// ESP_ERR_NVS_INVALID_LENGTH: blob mayor que el actual, de un firmware posterior
+		return err;
+	}
+
+	// la version 1 no tiene revision, la config empieza justo tras el CRC
+	if ((size >= AQI_CONFIG_BLOB_V1_HEADER_LEN) && (blob.version == 1u))
+	{
+		header_len = AQI_CONFIG_BLOB_V1_HEADER_LEN;
+	}
+
+	if ((size < header_len) || (blob.magic != AQI_CONFIG_BLOB_MAGIC)
+			|| (blob.length != (size - header_len)))
+	{
+		ESP_LOGE(TAG, "Blob de config con cabecera no valida (%u bytes)", (unsigned)size);
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	if (((blob.version != AQI_CONFIG_BLOB_VERSION) && (blob.version != 1u)) || (blob.length == 0)
+			|| (blob.length > AQI_CONFIG_BLOB_DATA_LEN))
+	{
+		ESP_LOGE(TAG, "Blob de config de la version %u (%u bytes), no se puede migrar",
+				blob.version, blob.length);
+		return ESP_ERR_INVALID_VERSION;
+	}
+
+	if (blob.version == 1u)
+	{
+		crc = esp_crc32_le(0, (const uint8_t *)&blob + header_len, blob.length);
+		// se lleva la config a su sitio en el blob actual
+		memmove(&blob.config, (const uint8_t *)&blob + header_len, blob.length);
+		blob.revision = 0;
+	}
+	else
+	{
+		crc = esp_crc32_le(0, (const uint8_t *)&blob.revision, sizeof(blob.revision) + blob.length);
+	}
+
+	if (blob.crc != crc)
+	{
+		ESP_LOGE(TAG, "CRC del blob de config incorrecto");
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	// los campos se anaden al final del struct, el blob anterior es un prefijo
+	memcpy(config, &blob.config, blob.length);
+	config->room_name[AQI_MAX_ROOM_NAME_SZ - 1] = '\0';
+
+	if (revision != NULL)
+	{
+		*revision = blob.revision;
+	}
+
+	if ((migrated != NULL) && ((blob.version != AQI_CONFIG_BLOB_VERSION) || (blob.length < AQI_CONFIG_BLOB_DATA_LEN)))
+	{
+		*migrated = true;
+	}
+
+	return ESP_OK;
+}
+
+/**
+ * Mascara AQI_CV_BIT de las variables que cambian de 'current' a 'next'
+ */
+static uint32_t aqi_config_diff(const AQI_device_config_data_t *current, const AQI_device_config_data_t *next)
+{
+	uint32_t changed = 0;
+
+	for (size_t i = 0; i < AQI_NUM_CFG_VARS; i++)
+	{
+		const aqi_config_field_t *field = &aqi_config_fields[i];
+
+		if (aqi_config_field_equal(current, next, field))
+		{
+			continue;
+		}
+
+		changed |= (1u << i);
+		if (field->type == AQI_CFG_TYPE_STR)
+		{
+			ESP_LOGI(TAG, "%s: %s -> %s", field->json_key, (const char *)current + field->offset,
+					(const char *)next + field->offset);
+		}
+		else
+		{
+			ESP_LOGI(TAG, "%s: %" PRIu32 " -> %" PRIu32, field->json_key,
+					aqi_config_field_get_uint(current, field), aqi_config_field_get_uint(next, field));
+		}
+	}
+
+	return changed;
+}
+
+/**
+ * Guarda toda la config en el blob con un solo commit y publica la nueva
+ * version en la cache. Con el mutex tomado, o desde init
+ */
+static esp_err_t aqi_config_store(const AQI_device_config_data_t *config, uint32_t revision)
+{
+	aqi_config_blob_t blob;
+	esp_err_t err;
+
+	// el relleno del struct tambien entra en el CRC, a 0
+	memset(&blob, 0, sizeof(blob));
+	blob.magic = AQI_CONFIG_BLOB_MAGIC;
+	blob.version = AQI_CONFIG_BLOB_VERSION;
+	blob.length = AQI_CONFIG_BLOB_DATA_LEN;
+	blob.revision = revision;
+	memcpy(&blob.config, config, AQI_CONFIG_BLOB_DATA_LEN);
+	blob.config.room_name[AQI_MAX_ROOM_NAME_SZ - 1] = '\0';
+	blob.crc = esp_crc32_le(0, (const uint8_t *)&blob.revision, sizeof(blob.revision) + blob.length);
+
+	err = nvs_set_blob(aqi_nvs_handle, AQI_KEY_CONFIG_BLOB, &blob,
+			offsetof(aqi_config_blob_t, config) + AQI_CONFIG_BLOB_DATA_LEN);
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Error escribiendo el blob de config: %s", esp_err_to_name(err));
+		return err;
+	}
+
+	err = nvs_commit(aqi_nvs_handle);
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Error en nvs_commit: %s", esp_err_to_name(err));
+		return err;
+	}
+
+	aqi_config_cache_publish(&blob.config, revision);
+
+	return ESP_OK;
+}
+
+/**
+ * Guarda la config si cambia alguna variable respecto a la cache, con la
+ * siguiente revision, y avisa a los canales del GSS interesados en las
+ * variables cambiadas. Si no cambia ninguna no se escribe nada. Con el
+ * mutex tomado
+ *
+ * @param changed[out] opcional, mascara AQI_CV_BIT de las variables cambiadas
+ */
+static esp_err_t aqi_config_update(const AQI_device_config_data_t *config, uint32_t *changed)
+{
+	const aqi_config_cache_entry_t *current = aqi_config_cache_current();
+	uint32_t diff = aqi_config_diff(&current->config, config);
+	uint32_t revision = current->revision + 1u;
+	esp_err_t err = ESP_OK;
+
+	if (diff != 0)
+	{
+		err = aqi_config_store(config, revision);
+		if (err == ESP_OK)
+		{
+			ESP_LOGI(TAG, "Config guardada, revision %" PRIu32, revision);
+			if (gss_broadcast_config_changed(diff, NULL) != ESP_OK)
+			{
+				ESP_LOGW(TAG, "Cambio de config pendiente de notificar");
+			}
+		}
+		else
+		{
+			diff = 0;
+		}
+	}
+
+	if (changed != NULL)
+	{
+		*changed = diff;
+	}
+
+	return err;
+}
+
+/**
+ * Lee las variables guardadas con el formato antiguo, una clave por
+ * variable. Las que no existan conservan su valor en 'config'
+ *
+ * @return numero de variables encontradas
+ */
+static unsigned aqi_config_legacy_read(AQI_device_config_data_t *config)
+{
+	unsigned found = 0;
+	esp_err_t err;
+	size_t len;
+	int8_t i8_value;
+
+	for (size_t i = 0; i < AQI_NUM_CFG_VARS; i++)
+	{
+		const aqi_config_field_t *field = &aqi_config_fields[i];
+		uint8_t *value = (uint8_t *)config + field->offset;
+
+		switch (field->type)
+		{
+		case AQI_CFG_TYPE_U8:
+			err = nvs_get_u8(aqi_nvs_handle, field->nvs_key, value);
+			break;
+		case AQI_CFG_TYPE_U16:
+			err = nvs_get_u16(aqi_nvs_handle, field->nvs_key, (uint16_t *)value);
+			break;
+		case AQI_CFG_TYPE_BOOL:
+			// se guardaba como int8
+			err = nvs_get_i8(aqi_nvs_handle, field->nvs_key, &i8_value);
+			if (err == ESP_OK)
+			{
+				*(bool *)value = (i8_value != 0);
+			}
+			break;
+		case AQI_CFG_TYPE_STR:
+			len = field->size;
+			err = nvs_get_str(aqi_nvs_handle, field->nvs_key, (char *)value, &len);
+			break;
+		default:
+			err = ESP_ERR_NOT_SUPPORTED;
+			break;
+		}
+
+		if (err == ESP_OK)
+		{
+			found++;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * Borra las claves del formato antiguo, una vez guardado el blob
+ */
+static void aqi_config_legacy_erase(void)
+{
+	esp_err_t err;
+
+	for (size_t i = 0; i < AQI_NUM_CFG_VARS; i++)
+	{
+		err = nvs_erase_key(aqi_nvs_handle, aqi_config_fields[i].nvs_key);
+		if ((err != ESP_OK) && (err != ESP_ERR_NVS_NOT_FOUND))
+		{
+			ESP_LOGW(TAG, "No se pudo borrar la clave %s: %s", aqi_config_fields[i].nvs_key,
+					esp_err_to_name(err));
+		}
+	}
+
+	err = nvs_commit(aqi_nvs_handle);
+	if (err != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Error en nvs_commit al borrar las claves antiguas: %s", esp_err_to_name(err));
+	}
+}
+
+/**
+ * Primera variable con un valor fuera de su rango, AQI_CV_NOT_VAR si todas
+ * son validas
+ */
+static aqi_config_var_t aqi_config_find_invalid(const AQI_device_config_data_t *config)
+{
+	for (size_t i = 0; i < AQI_NUM_CFG_VARS; i++)
+	{
+		if (!aqi_config_field_is_valid(config, &aqi_config_fields[i]))
+		{
+			return (aqi_config_var_t)i;
+		}
+	}
+
+	return AQI_CV_NOT_VAR;
+}
+
+/**
+ * Las variables fuera de rango, p.ej. guardadas por un firmware anterior
+ * sin validacion, vuelven a su valor por defecto
+ *
+ * @return numero de variables corregidas
+ */
+static unsigned aqi_config_sanitize(AQI_device_config_data_t *config)
+{
+	unsigned fixed = 0;
+
+	for (size_t i = 0; i < AQI_NUM_CFG_VARS; i++)
+	{
+		const aqi_config_field_t *field = &aqi_config_fields[i];
+
+		if (!aqi_config_field_is_valid(config, field))
+		{
+			ESP_LOGW(TAG, "%s fuera de rango (%" PRIu32 "), se usa el valor por defecto",
+					field->json_key, aqi_config_field_get_uint(config, field));
+			memcpy((uint8_t *)config + field->offset, (const uint8_t *)&aqi_default_config + field->offset,
+					field->size);
+			fixed++;
+		}
+	}
+
+	return fixed;
+}
 
 esp_err_t aqi_config_manager_init()
 {
 	AQI_device_config_data_t vars_from_flash;
-	aqi_config_var_t var_error;
+	uint32_t revision = 0;
+	bool migrated = false;
+	unsigned legacy_found;
     esp_err_t err = nvs_flash_init();
 
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
@@ -67,29 +456,59 @@ esp_err_t aqi_config_manager_init()
 
         if (err == ESP_OK)
         {
-        	// Inicializar variables de config en flash si no existen
-        	err = aqi_config_manager_get_all(&vars_from_flash, &var_error);
-        	if (var_error != AQI_CV_NOT_VAR)
+    		// Cargar config por defecto
+    		aqi_device_config_data_type_defaults(&aqi_default_config);
+
+        	// Una sola lectura de la NVS. Los campos que no trae el blob se
+        	// quedan con su valor por defecto, asi al anadir variables nuevas
+        	// no se pierde la config ya guardada
+        	aqi_device_config_data_clone(&aqi_default_config, &vars_from_flash);
+        	err = aqi_config_blob_load(&vars_from_flash, &revision, &migrated);
+        	if (err == ESP_OK)
         	{
-        		// Cargar config por defecto
-        		aqi_default_config.save_screen_seconds = 30;
-        		strncpy(aqi_default_config.room_name, "Room", AQI_MAX_ROOM_NAME_SZ);
-        		aqi_default_config.alarm_temp_h = 30;
-        		aqi_default_config.alarm_temp_l = 17;
-        		aqi_default_config.alarm_humidity_h = 70;
-        		aqi_default_config.alarm_humidity_l = 40;
-        		aqi_default_config.alarm_voc_index = 300;
-        		aqi_default_config.reset_wifi_provisioning = false;
-
-        		// Si no existen crear
-        		err = aqi_config_manager_set_all(&aqi_default_config);
-        		ESP_ERROR_CHECK(err);
+        		ESP_LOGI(TAG, "Config leida del blob de la NVS, revision %" PRIu32, revision);
+        		if (aqi_config_sanitize(&vars_from_flash) > 0)
+        		{
+        			migrated = true;
+        		}
+        		// el blob de la version 1 no tenia revision
+        		if (revision == 0)
+        		{
+        			revision = AQI_CONFIG_FIRST_REVISION;
+        		}
+        		if (migrated)
+        		{
+        			ESP_LOGW(TAG, "Blob de config de un firmware anterior, se completa con los valores por defecto");
+        			err = aqi_config_store(&vars_from_flash, revision);
+        			ESP_ERROR_CHECK(err);
+        		}
+        		else
+        		{
+        			aqi_config_cache_publish(&vars_from_flash, revision);
+        		}
         	}
         	else
         	{
-        		ESP_LOGI(TAG, "Variables de config en flash ya estaban creadas");
-        		// Inicializar cache si ya existian las variables en la flash
-        		aqi_device_config_data_clone(&vars_from_flash, &aqi_config_cache);
+        		// Primer arranque con el blob: se migran las claves del formato
+        		// antiguo, las que no existan se crean con su valor por defecto
+        		if (err != ESP_ERR_NVS_NOT_FOUND)
+        		{
+        			ESP_LOGE(TAG, "Blob de config no valido (%s), se reconstruye", esp_err_to_name(err));
+        			aqi_device_config_data_clone(&aqi_default_config, &vars_from_flash);
+        		}
+        		legacy_found = aqi_config_legacy_read(&vars_from_flash);
+        		ESP_LOGW(TAG, "Config migrada al blob: %u de %u variables del formato antiguo",
+        				legacy_found, AQI_NUM_CFG_VARS);
+        		aqi_config_sanitize(&vars_from_flash);
+
+        		err = aqi_config_store(&vars_from_flash, AQI_CONFIG_FIRST_REVISION);
+        		ESP_ERROR_CHECK(err);
+
+        		// solo con el blob ya guardado
+        		if (legacy_found > 0)
+        		{
+        			aqi_config_legacy_erase();
+        		}
         	}
         }
         else
@@ -108,84 +527,54 @@ esp_err_t aqi_config_manager_init()
 
 esp_err_t aqi_config_manager_get(aqi_config_var_t var, void * out_buffer, size_t len)
 {
-	esp_err_t ret = ESP_ERR_INVALID_ARG;
+	const aqi_config_field_t *field;
+	unsigned int seq;
 
-	if (out_buffer != NULL)
+	if ((out_buffer == NULL) || ((unsigned)var >= AQI_NUM_CFG_VARS)
+			|| (len != aqi_config_fields[var].size))
 	{
-		if (xSemaphoreTake(aqi_config_manager_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
-		{
-			switch (var)
-			{
-			case AQI_CV_SCREEN_TIME:
-				if (len == sizeof(uint8_t))
-				{
-					*((uint8_t *)out_buffer) = aqi_config_cache.save_screen_seconds;
-					ret =  ESP_OK;
-				}
-				break;
-			case AQI_CV_ROOM_NAME:
-				if (len == AQI_MAX_ROOM_NAME_SZ)
-				{
-					strncpy((char *)out_buffer, aqi_config_cache.room_name, AQI_MAX_ROOM_NAME_SZ);
-					ret =  ESP_OK;
-				}
-				break;
-			case AQI_CV_ALARM_TEMP_H:
-				if (len == sizeof(uint16_t))
-				{
-					*((uint16_t *)out_buffer) = aqi_config_cache.alarm_temp_h;
-					ret =  ESP_OK;
-				}
-				break;
-			case AQI_CV_ALARM_TEMP_L:
-				if (len == sizeof(uint16_t))
-				{
-					*((uint16_t *)out_buffer) = aqi_config_cache.alarm_temp_l;
-					ret =  ESP_OK;
-				}
-				break;
-			case AQI_CV_ALARM_HUMIDITY_H:
-				if (len == sizeof(uint16_t))
-				{
-					*((uint16_t *)out_buffer) = aqi_config_cache.alarm_humidity_h;
-					ret =  ESP_OK;
-				}
-				break;
-			case AQI_CV_ALARM_HUMIDITY_L:
-				if (len == sizeof(uint16_t))
-				{
-					*((uint16_t *)out_buffer) = aqi_config_cache.alarm_humidity_l;
-					ret =  ESP_OK;
-				}
-				break;
-			case AQI_CV_ALARM_VOC_INDEX_LIMIT:
-				if (len == sizeof(uint16_t))
-				{
-					*((uint16_t *)out_buffer) = aqi_config_cache.alarm_voc_index;
-					ret =  ESP_OK;
-				}
-				break;
-			case AQI_CV_WIFI_PROVISIONING_STATE:
-				if (len == sizeof(bool))
-				{
-					*((bool *)out_buffer) = aqi_config_cache.reset_wifi_provisioning;
-					ret =  ESP_OK;
-				}
-				break;
-			default:
-				break;
-			}
+		return ESP_ERR_INVALID_ARG;
+	}
 
-			xSemaphoreGive(aqi_config_manager_mutex);
-		}
-		else
-		{
-			ESP_LOGE(TAG, "No se pudo cerrar el mutex");
-			ret = ESP_ERR_TIMEOUT;
-		}
+	field = &aqi_config_fields[var];
+
+	// como aqi_config_manager_get_snapshot pero copiando solo la variable
+	do
+	{
+		seq = atomic_load_explicit(&aqi_config_seq, memory_order_acquire);
+		memcpy(out_buffer, (const uint8_t *)&aqi_config_cache[seq & 1u].config + field->offset, field->size);
+		atomic_thread_fence(memory_order_acquire);
+	} while (seq != atomic_load_explicit(&aqi_config_seq, memory_order_relaxed));
+
+	return ESP_OK;
+}
+
+esp_err_t aqi_config_manager_get_snapshot(AQI_device_config_data_t_ptr config, uint32_t *version)
+{
+	unsigned int seq;
+	uint32_t revision;
+
+	if (config == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
 	}
 
-	return ret;
+	// sin bloqueo: se copia la version estable y se repite solo si un
+	// escritor ha publicado otra mientras tanto
+	do
+	{
+		seq = atomic_load_explicit(&aqi_config_seq, memory_order_acquire);
+		*config = aqi_config_cache[seq & 1u].config;
+		revision = aqi_config_cache[seq & 1u].revision;
+		atomic_thread_fence(memory_order_acquire);
+	} while (seq != atomic_load_explicit(&aqi_config_seq, memory_order_relaxed));
+
+	if (version != NULL)
+	{
+		*version = revision;
+	}
+
+	return ESP_OK;
 }
 
 
@@ -297,73 +686,25 @@ esp_err_t aqi_config_manager_get(aqi_config_var_t var, void * out_buffer, size_t
 
 esp_err_t aqi_config_manager_get_all(AQI_device_config_data_t_ptr config, aqi_config_var_t* key_data_failed)
 {
-	// suponer que sera OK y acumular errores si hubiera
-	esp_err_t err = ESP_OK;
-	size_t len = AQI_MAX_ROOM_NAME_SZ;
-	// En principio marcar que no hay errores
+	esp_err_t err = ESP_ERR_INVALID_ARG;
+
+	if ((config == NULL) || (key_data_failed == NULL))
+	{
+		return err;
+	}
+
+	// con el blob no hay fallos por variable, o se lee todo o nada
 	*key_data_failed = AQI_CV_NOT_VAR;
 
-	if (config == NULL || key_data_failed == NULL)
+	if (xSemaphoreTake(aqi_config_manager_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
 	{
-		err = ESP_ERR_INVALID_ARG;
+		err = aqi_config_blob_load(config, NULL, NULL);
+		xSemaphoreGive(aqi_config_manager_mutex);
 	}
 	else
 	{
-		if (xSemaphoreTake(aqi_config_manager_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
-		{
-			if ((err = nvs_get_u8(aqi_nvs_handle, AQI_KEY_SCREEN_TIME, &(config->save_screen_seconds))) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_SCREEN_TIME;
-			}
-
-			if ((err = nvs_get_str(aqi_nvs_handle, AQI_KEY_ROOM_NAME, config->room_name, &len)) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_ROOM_NAME;
-			}
-
-			if ((err = nvs_get_u16(aqi_nvs_handle, AQI_KEY_ALARM_TEMP_H, &(config->alarm_temp_h))) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_ALARM_TEMP_H;
-			}
-
-			if ((err = nvs_get_u16(aqi_nvs_handle, AQI_KEY_ALARM_TEMP_L, &(config->alarm_temp_l))) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_ALARM_TEMP_L;
-			}
-
-			if ((err = nvs_get_u16(aqi_nvs_handle, AQI_KEY_ALARM_HUMIDITY_H, &(config->alarm_humidity_h))) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_ALARM_HUMIDITY_H;
-			}
-
-			if ((err = nvs_get_u16(aqi_nvs_handle, AQI_KEY_ALARM_HUMIDITY_L, &(config->alarm_humidity_l))) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_ALARM_HUMIDITY_L;
-			}
-
-			if ((err = nvs_get_u16(aqi_nvs_handle, AQI_KEY_ALARM_VOC_INDEX_LIMIT, &(config->alarm_voc_index))) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_ALARM_VOC_INDEX_LIMIT;
-			}
-
-			int8_t aqi_cv_wps_buff = 0;
-			if ((err = nvs_get_i8(aqi_nvs_handle, AQI_KEY_WIFI_PROVISIONING_STATE, &aqi_cv_wps_buff)) != ESP_OK)
-			{
-				*key_data_failed = AQI_CV_WIFI_PROVISIONING_STATE;
-			}
-			else
-			{
-				// inicializacion correcta con conversiones de tipos
-				config->reset_wifi_provisioning = ((bool) aqi_cv_wps_buff);
-			}
-
-			xSemaphoreGive(aqi_config_manager_mutex);
-		}
-		else
-		{
-			ESP_LOGE(TAG, "No se pudo tomar el mutex");
-			err = ESP_ERR_TIMEOUT;
-		}
+		ESP_LOGE(TAG, "No se pudo tomar el mutex");
+		err = ESP_ERR_TIMEOUT;
 	}
 
 	return err;
@@ -371,163 +712,48 @@ esp_err_t aqi_config_manager_get_all(AQI_device_config_data_t_ptr config, aqi_co
 
 esp_err_t aqi_config_manager_set(aqi_config_var_t var, void * to_write, size_t len)
 {
-	esp_err_t err = ESP_FAIL;
+	esp_err_t err = ESP_ERR_INVALID_ARG;
+	const aqi_config_field_t *field;
+
+	if ((unsigned)var >= AQI_NUM_CFG_VARS)
+	{
+		ESP_LOGE(TAG, "Variable no reconocida: %d", var);
+		return err;
+	}
+
+	field = &aqi_config_fields[var];
+	if (len != field->size)
+	{
+		ESP_LOGE(TAG, "%s: longitud %u, se esperaba %u", field->json_key, (unsigned)len, field->size);
+		return err;
+	}
 
 	if (to_write != NULL)
 	{
 		if (xSemaphoreTake(aqi_config_manager_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
 		{
-			switch (var)
-			{
-			case AQI_CV_SCREEN_TIME:
-			{
-				if (len == sizeof(uint8_t))
-				{
-					uint8_t val = *((uint8_t *)to_write);
-					err = nvs_set_u8(aqi_nvs_handle, AQI_KEY_SCREEN_TIME, val);
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
-			}
-			case AQI_CV_ROOM_NAME:
-			{
-				if (len == AQI_MAX_ROOM_NAME_SZ)
-				{
-					err = nvs_set_str(aqi_nvs_handle, AQI_KEY_ROOM_NAME, (char *)to_write);
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
-			}
-			case AQI_CV_ALARM_TEMP_H:
-			{
-				if (len == sizeof(uint16_t))
-				{
-					uint16_t val = *((uint16_t *)to_write);
-					err = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_TEMP_H, val);
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
-			}
-			case AQI_CV_ALARM_TEMP_L:
-			{
-				if (len == sizeof(uint16_t))
-				{
-					uint16_t val = *((uint16_t *)to_write);
-					err = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_TEMP_L, val);
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
-			}
-			case AQI_CV_ALARM_HUMIDITY_H:
-			{
-				if (len == sizeof(uint16_t))
-				{
-					uint16_t val = *((uint16_t *)to_write);
-					err = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_HUMIDITY_H, val);
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
-			}
-			case AQI_CV_ALARM_HUMIDITY_L:
+			AQI_device_config_data_t next = aqi_config_cache_current()->config;
+
+			memcpy((uint8_t *)&next + field->offset, to_write, field->size);
+			if (field->type == AQI_CFG_TYPE_STR)
 			{
-				if (len == sizeof(uint16_t))
-				{
-					uint16_t val = *((uint16_t *)to_write);
-					err = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_HUMIDITY_L, val);
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
+				next.room_name[AQI_MAX_ROOM_NAME_SZ - 1] = '\0';
 			}
-			case AQI_CV_ALARM_VOC_INDEX_LIMIT:
+
+			if (aqi_config_field_is_valid(&next, field))
 			{
-				if (len == sizeof(uint16_t))
-				{
-					uint16_t val = *((uint16_t *)to_write);
-					err = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_VOC_INDEX_LIMIT, val);
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
+				err = ESP_OK;
 			}
-			case AQI_CV_WIFI_PROVISIONING_STATE:
+			else
 			{
-				if (len == sizeof(bool))
-				{
-					err = nvs_set_i8(aqi_nvs_handle, AQI_KEY_WIFI_PROVISIONING_STATE, *((int8_t *)to_write));
-				}
-				else
-				{
-					err = ESP_ERR_INVALID_ARG;
-				}
-				break;
-			}
-			default:
-				err = ESP_ERR_INVALID_ARG;
-				ESP_LOGE(TAG, "Variable no reconocida: %d", var);
+				ESP_LOGE(TAG, "%s fuera de rango (%" PRIu32 ")", field->json_key,
+						aqi_config_field_get_uint(&next, field));
 			}
 
-			// solo si las escrituras son exitosas
+			// se reescribe el blob entero con un solo commit
 			if (err == ESP_OK)
 			{
-				err = nvs_commit(aqi_nvs_handle);
-
-				if (err == ESP_OK)
-				{
-					// Actualizar la cache despues del commit
-					switch (var)
-					{
-					case AQI_CV_SCREEN_TIME:
-						aqi_config_cache.save_screen_seconds = *((uint8_t *)to_write);
-						break;
-					case AQI_CV_ROOM_NAME:
-						strncpy(aqi_config_cache.room_name, (char *)to_write, AQI_MAX_ROOM_NAME_SZ);
-						break;
-					case AQI_CV_ALARM_TEMP_H:
-						aqi_config_cache.alarm_temp_h = *((uint16_t *)to_write);
-						break;
-					case AQI_CV_ALARM_TEMP_L:
-						aqi_config_cache.alarm_temp_l = *((uint16_t *)to_write);
-						break;
-					case AQI_CV_ALARM_HUMIDITY_H:
-						aqi_config_cache.alarm_humidity_h = *((uint16_t *)to_write);
-						break;
-					case AQI_CV_ALARM_HUMIDITY_L:
-						aqi_config_cache.alarm_humidity_l = *((uint16_t *)to_write);
-						break;
-					case AQI_CV_ALARM_VOC_INDEX_LIMIT:
-						aqi_config_cache.alarm_voc_index = *((uint16_t *)to_write);
-						break;
-					case AQI_CV_WIFI_PROVISIONING_STATE:
-						aqi_config_cache.reset_wifi_provisioning = *((bool *)to_write);
-						break;
-					default:
-						break;
-					}
-				}
-				else
-				{
-					ESP_LOGE(TAG, "Error en nvs commit: %s", esp_err_to_name(err));
-				}
+				err = aqi_config_update(&next, NULL);
 			}
 
 			xSemaphoreGive(aqi_config_manager_mutex);
@@ -540,7 +766,6 @@ esp_err_t aqi_config_manager_set(aqi_config_var_t var, void * to_write, size_t l
 	}
 	else
 	{
-		err = ESP_ERR_INVALID_ARG;
 		ESP_LOGE(TAG, "Buffer de escritura nulo");
 	}
 
@@ -549,52 +774,21 @@ esp_err_t aqi_config_manager_set(aqi_config_var_t var, void * to_write, size_t l
 
 esp_err_t aqi_config_manager_set_all(const AQI_device_config_data_t_ptr config)
 {
-	esp_err_t err[AQI_NUM_CFG_VARS];
 	esp_err_t ret = ESP_FAIL;
-	uint8_t writings_number = 0;
-	uint8_t i;
+	aqi_config_var_t invalid;
 
 	if (config != NULL)
 	{
-		if (xSemaphoreTake(aqi_config_manager_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+		if ((invalid = aqi_config_find_invalid(config)) != AQI_CV_NOT_VAR)
 		{
-			err[AQI_CV_SCREEN_TIME] = nvs_set_u8(aqi_nvs_handle, AQI_KEY_SCREEN_TIME, config->save_screen_seconds);
-			err[AQI_CV_ROOM_NAME] = nvs_set_str(aqi_nvs_handle, AQI_KEY_ROOM_NAME, config->room_name);
-			err[AQI_CV_ALARM_TEMP_H] = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_TEMP_H, config->alarm_temp_h);
-			err[AQI_CV_ALARM_TEMP_L] = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_TEMP_L, config->alarm_temp_l);
-			err[AQI_CV_ALARM_HUMIDITY_H] = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_HUMIDITY_H, config->alarm_humidity_h);
-			err[AQI_CV_ALARM_HUMIDITY_L] = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_HUMIDITY_L, config->alarm_humidity_l);
-			err[AQI_CV_ALARM_VOC_INDEX_LIMIT] = nvs_set_u16(aqi_nvs_handle, AQI_KEY_ALARM_VOC_INDEX_LIMIT, config->alarm_voc_index);
-			err[AQI_CV_WIFI_PROVISIONING_STATE] = nvs_set_i8(aqi_nvs_handle, AQI_KEY_WIFI_PROVISIONING_STATE, (int8_t) config->reset_wifi_provisioning);
-
-			for (i = 0; i < AQI_NUM_CFG_VARS; i++)
-			{
-				if (err[i] == ESP_OK)
-				{
-					writings_number++;
-				}
-				else
-				{
-					ESP_LOGE(TAG, "Error escribiendo variable %u: %s", i, esp_err_to_name(err[i]));
-				}
-			}
-
-			// Solo commit cuando todas las escrituras se pueden realizar
-			if (writings_number == AQI_NUM_CFG_VARS)
-			{
-				esp_err_t commit_err = nvs_commit(aqi_nvs_handle);
-				if (commit_err == ESP_OK)
-				{
-					// sincroniza la cache
-					aqi_device_config_data_clone(config, &aqi_config_cache);
-					ret = ESP_OK;
-				}
-				else
-				{
-					ESP_LOGE(TAG, "Error en nvs_commit: %s", esp_err_to_name(commit_err));
-				}
-			}
-
+			ESP_LOGE(TAG, "%s fuera de rango (%" PRIu32 "), no se guarda la config",
+					aqi_config_fields[invalid].json_key,
+					aqi_config_field_get_uint(config, &aqi_config_fields[invalid]));
+			ret = ESP_ERR_INVALID_ARG;
+		}
+		else if (xSemaphoreTake(aqi_config_manager_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+		{
+			ret = aqi_config_update(config, NULL);
 			xSemaphoreGive(aqi_config_manager_mutex);
 		}
 		else
@@ -665,160 +859,80 @@ esp_err_t aqi_config_manager_release()
 	return err;
 }
 
-esp_err_t aqi_process_received_config_data(const char* incoming_data, int len)
+esp_err_t aqi_process_received_config_data(const char* incoming_data, int len,
+										aqi_config_update_result_t *result)
 {
 	esp_err_t err = ESP_FAIL;
+	const aqi_config_cache_entry_t *current;
 	AQI_device_config_data_t new_config_data;
-	AQI_device_config_data_t current_config_data;
-	aqi_config_var_t var_failed = AQI_CV_NOT_VAR;
+	aqi_config_patch_t patch;
+	uint32_t changed = 0;
+	bool reset_wifi_provisioning = false;
 
-	if (incoming_data != NULL)
+	if (result != NULL)
 	{
-		err = aqi_device_config_data_type_parse(incoming_data, len, &new_config_data);
-		if (err == ESP_OK)
-		{
-			err = aqi_config_manager_get_all(&current_config_data, &var_failed);
+		// revision actual por si no se llega a procesar
+		memset(result, 0, sizeof(*result));
+		aqi_config_manager_get_snapshot(&new_config_data, &result->version);
+	}
 
-			// conservar integridad en la actualizacion de los datos a modo
-			// de transaccion, o se lee todo o nada
-			if (err == ESP_OK)
-			{
-				// ========Debug=======
-				ESP_LOGI(TAG, "Config current:\n"
-						"screen time = %u\n"
-						"room name = %s\n"
-						"temp_H = %u\n"
-						"temp_L = %u\n"
-						"humi_H = %u\n"
-						"humi_L = %u\n"
-						"voc level = %u\n"
-						"reset_wifi_prov = %d\n\n"
-						"New config:\n"
-						"screen time = %u\n"
-												"room name = %s\n"
-												"temp_H = %u\n"
-												"temp_L = %u\n"
-												"humi_H = %u\n"
-												"humi_L = %u\n"
-												"voc level = %u\n"
-												"reset_wifi_prov = %d\n\n", current_config_data.save_screen_seconds,
-						current_config_data.room_name, current_config_data.alarm_temp_h,
-						current_config_data.alarm_temp_l, current_config_data.alarm_humidity_h,
-						current_config_data.alarm_humidity_l, current_config_data.alarm_voc_index,
-						current_config_data.reset_wifi_provisioning,
-						new_config_data.save_screen_seconds, new_config_data.room_name,
-						new_config_data.alarm_temp_h, new_config_data.alarm_temp_l,
-						new_config_data.alarm_humidity_h, new_config_data.alarm_humidity_l,
-						new_config_data.alarm_voc_index, new_config_data.reset_wifi_provisioning);
-				//=====================
-
-				// Solo actualizamos los que hayan cambiado
-				// activar procedimiento adecuado en el sistema a cada cambio de config
-
-				if (current_config_data.save_screen_seconds
-						!= new_config_data.save_screen_seconds)
-				{
-					if (aqi_config_manager_set(AQI_CV_SCREEN_TIME,
-							&(new_config_data.save_screen_seconds), sizeof(uint8_t)) == ESP_OK)
-					{
-						// Actualizar var en cache
-						aqi_config_cache.save_screen_seconds = new_config_data.save_screen_seconds;
-						// TODO notificar cambio de tiempo de pantalla inactiva
-					}
-				}
-
-				if (strncmp(current_config_data.room_name, new_config_data.room_name,
-						AQI_MAX_ROOM_NAME_SZ) != 0)
-				{
-					if (aqi_config_manager_set(AQI_CV_ROOM_NAME,
-							&(new_config_data.room_name), AQI_MAX_ROOM_NAME_SZ) == ESP_OK)
-					{
-						// Actualizar var en cache
-						strncpy(aqi_config_cache.room_name, new_config_data.room_name,
-								AQI_MAX_ROOM_NAME_SZ);
-						// TODO notificar cambio de nombre de estancia
-					}
-				}
-
-				if (current_config_data.alarm_temp_h
-						!= new_config_data.alarm_temp_h)
-				{
-					if (aqi_config_manager_set(AQI_CV_ALARM_TEMP_H,
-							&(new_config_data.alarm_temp_h), sizeof(uint16_t)) == ESP_OK)
-					{
-						// Actualizar var en cache
-						aqi_config_cache.alarm_temp_h = new_config_data.alarm_temp_h;
-					// TODO notificar cambio de limite de alarma de temp superior
-					}
-				}
-
-				if (current_config_data.alarm_temp_l
-						!= new_config_data.alarm_temp_l)
-				{
-					if (aqi_config_manager_set(AQI_CV_ALARM_TEMP_L,
-							&(new_config_data.alarm_temp_l), sizeof(uint16_t)) == ESP_OK)
-					{
-						// Actualizar var en cache
-						aqi_config_cache.alarm_temp_l = new_config_data.alarm_temp_l;
-					// TODO notificar cambio de limite de alarma de temp inferior
-					}
-				}
-
-				if (current_config_data.alarm_humidity_h
-						!= new_config_data.alarm_humidity_h)
-				{
-					if (aqi_config_manager_set(AQI_CV_ALARM_HUMIDITY_H,
-							&(new_config_data.alarm_humidity_h), sizeof(uint16_t)) == ESP_OK)
-					{
-						aqi_config_cache.alarm_humidity_h = new_config_data.alarm_humidity_h;
-						// TODO notificar cambio de limite de alarma de humedad superior
-					}
-				}
-
-				if (current_config_data.alarm_humidity_l
-						!= new_config_data.alarm_humidity_l)
-				{
-					if (aqi_config_manager_set(AQI_CV_ALARM_HUMIDITY_L,
-							&(new_config_data.alarm_humidity_l), sizeof(uint16_t)) == ESP_OK)
-					{
-						aqi_config_cache.alarm_humidity_l = new_config_data.alarm_humidity_l;
-						// TODO notificar cambio de limite de alarma de humedad inferior
-					}
-				}
-
-				if (current_config_data.alarm_voc_index
-						!= new_config_data.alarm_voc_index)
-				{
-					if (aqi_config_manager_set(AQI_CV_ALARM_VOC_INDEX_LIMIT,
-							&(new_config_data.alarm_voc_index), sizeof(uint16_t)) == ESP_OK)
-					{
-						aqi_config_cache.alarm_voc_index = new_config_data.alarm_voc_index;
-					// TODO notificar cambio de limite de alarma de voc index
-					}
-				}
-
-				// Solo hay que comprobar si se quiere resetear el provisioning
-				// para notificar el inicio del proceso
-				if (new_config_data.reset_wifi_provisioning)
-				{
-					// TODO guardar los params de aprendizaje del algoritmo de VOC
-					//		antes del reset ?
-					// TODO notificar el reset del provisioning
-
-					aqi_config_manager_reset_wifi_provisioning();
-				}
-			}
-			else
-			{
-				ESP_LOGE(TAG, "Lectura de config actual de la flash fallida.\n"
-							  "Tipo error: %s; Var fallida: %d",
-							  esp_err_to_name(err), var_failed);
-			}
-		}
+	if (incoming_data == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
 	}
-	else
+
+	// la version se comprueba y el parche se guarda sin soltar el mutex:
+	// nadie puede cambiar la config entre medias
+	if (xSemaphoreTake(aqi_config_manager_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
 	{
-		err = ESP_ERR_INVALID_ARG;
+		ESP_LOGE(TAG, "No se pudo tomar el mutex");
+		return ESP_ERR_TIMEOUT;
+	}
+
+	current = aqi_config_cache_current();
+
+	// los campos que no vengan en el JSON conservan su valor actual
+	new_config_data = current->config;
+	err = aqi_device_config_data_type_parse(incoming_data, len, &new_config_data, &patch);
+
+	if ((err != ESP_FAIL) && patch.has_version && (patch.version != current->revision))
+	{
+		ESP_LOGW(TAG, "Cambio de config sobre la revision %" PRIu32 ", la actual es la %" PRIu32,
+				patch.version, current->revision);
+		err = ESP_ERR_INVALID_STATE;
+	}
+
+	if (err == ESP_OK)
+	{
+		// el flag de aprovisionamiento no se guarda aqui, lo gestiona
+		// aqi_config_manager_reset_wifi_provisioning
+		reset_wifi_provisioning = ((patch.present & AQI_CV_BIT(AQI_CV_WIFI_PROVISIONING_STATE)) != 0)
+				&& new_config_data.reset_wifi_provisioning;
+		new_config_data.reset_wifi_provisioning = current->config.reset_wifi_provisioning;
+
+		// Todos los cambios en un solo commit del blob: o se aplican
+		// todos o ninguno. Sin cambios no se escribe nada, con cambios
+		// sube la revision y se avisa a los modulos suscritos
+		err = aqi_config_update(&new_config_data, &changed);
+	}
+
+	if (result != NULL)
+	{
+		result->version = aqi_config_cache_current()->revision;
+		result->changed = changed;
+	}
+
+	xSemaphoreGive(aqi_config_manager_mutex);
+
+	// Solo hay que comprobar si se quiere resetear el provisioning
+	// para notificar el inicio del proceso
+	if ((err == ESP_OK) && reset_wifi_provisioning)
+	{
+		// TODO guardar los params de aprendizaje del algoritmo de VOC
+		//		antes del reset ?
+		// TODO notificar el reset del provisioning
+
+		aqi_config_manager_reset_wifi_provisioning();
 	}
 
 	return err;
@@ -11,34 +11,45 @@
 #include "esp_err.h"
 #include "aqi_device_config_type.h"
 
-// Config vars keys
-#define AQI_KEY_SCREEN_TIME						"SCRT"
-#define AQI_KEY_ROOM_NAME						"ROOM"
-#define AQI_KEY_ALARM_TEMP_H					"TH"
-#define AQI_KEY_ALARM_TEMP_L					"TL"
-#define AQI_KEY_ALARM_HUMIDITY_H				"HH"
-#define AQI_KEY_ALARM_HUMIDITY_L				"HL"
-#define AQI_KEY_ALARM_VOC_INDEX_LIMIT			"VOCL"
-#define AQI_KEY_WIFI_PROVISIONING_STATE			"WPRVST"
+// La config se guarda en la NVS en un solo blob con CRC, un commit por
+// actualizacion. Subir la version solo si cambia el tipo u orden de los
+// campos: los campos nuevos se anaden al final de AQI_device_config_data_t
+// y un blob anterior se migra solo, los que no trae toman su valor por defecto.
+// La version 2 anade la revision de la config; un blob de la version 1 se
+// migra con la revision 1
+#define AQI_KEY_CONFIG_BLOB						"CFG"
+#define AQI_CONFIG_BLOB_VERSION					2u
+
+// Las claves del formato antiguo, una por variable, estan en la lista
+// AQI_DEVICE_CONFIG_VARS. Solo se leen en el primer arranque para migrarlas
+// al blob
 
 // numero de tags en aqi_config_var_t - 1 (el ultimo es un no-valor para inicializar
 // variables de tipo aqi_config_var_t)
-#define AQI_NUM_CFG_VARS						8u
+#define AQI_NUM_CFG_VARS						AQI_CONFIG_NUM_FIELDS
 
+#define AQI_CV_ENUM(id, field, type, nvs_key, json_key, def, min, max, flags)	AQI_CV_##id,
+
+// Generado de AQI_DEVICE_CONFIG_VARS, indexa aqi_config_fields
 typedef enum
 {
-	AQI_CV_SCREEN_TIME,
-	AQI_CV_ROOM_NAME,
-	AQI_CV_ALARM_TEMP_H,
-	AQI_CV_ALARM_TEMP_L,
-	AQI_CV_ALARM_HUMIDITY_H,
-	AQI_CV_ALARM_HUMIDITY_L,
-	AQI_CV_ALARM_VOC_INDEX_LIMIT,
-	AQI_CV_WIFI_PROVISIONING_STATE,
+	AQI_DEVICE_CONFIG_VARS(AQI_CV_ENUM)
 	AQI_CV_NOT_VAR
 
 } aqi_config_var_t;
 
+// Mascara de variables, p.ej. para gss_channel_config_t.config_vars
+#define AQI_CV_BIT(var)							(1u << (var))
+
+/**
+ * Resultado de aplicar un JSON de configuracion recibido
+ */
+typedef struct
+{
+	uint32_t version;		// revision de la config tras procesar el JSON
+	uint32_t changed;		// mascara AQI_CV_BIT de las variables cambiadas
+} aqi_config_update_result_t;
+
 
 /**
  * @brief Inicializa el gestor de configuración del dispositivo.
@@ -52,7 +63,8 @@ esp_err_t aqi_config_manager_init();
 /**
  * @brief Obtiene el valor de una variable de configuración especifica.
  * 	      Esta operacion siempre se realiza desde la cache local.
- * 	      Esta opracion es thread-safe
+ * 	      Esta opracion es thread-safe y no bloquea. Para leer varias
+ * 	      variables coherentes entre si usar aqi_config_manager_get_snapshot
  *
  * @param var La variable de configuración a obtener.
  * @param out_buffer Puntero al buffer donde se almacenará el valor obtenido.
@@ -60,36 +72,55 @@ esp_err_t aqi_config_manager_init();
  *
  * @return
  *     - ESP_OK: Operación exitosa.
- *     - ESP_ERR_INVALID_ARG: out_buffer es NULL o su longitud (len)
- *     							no coincide con el tipo de datos para
- *     							la variable de configuracion var.
+ *     - ESP_ERR_INVALID_ARG: out_buffer es NULL, var no es una variable
+ *     							o su longitud (len) no coincide con el
+ *     							tamano de la variable en aqi_config_fields.
  */
 esp_err_t aqi_config_manager_get(aqi_config_var_t var, void * out_buffer, size_t len);
 
 /**
- * @brief Obtiene todos los datos de configuración del dispositivo. No comprueba
- * 		  si los datos se han marcado como cambiados o no.
+ * @brief Copia toda la configuracion de la cache local en una sola lectura
+ * 		  coherente. No toma el mutex ni espera a los commits en la NVS:
+ * 		  set y set_all publican cada nueva version en una de las dos copias
+ * 		  de la cache mientras los lectores usan la otra.
+ * 		  Esta operacion es thread-safe y se puede llamar desde cualquier core.
+ *
+ * @param config Destino de la copia.
+ * @param version[out] Opcional (NULL). Revision de la config copiada: se
+ * 		  guarda con ella en la NVS y sube cada vez que cambia alguna variable.
+ *
+ * @return
+ *     - ESP_OK: Operación exitosa.
+ *     - ESP_ERR_INVALID_ARG: config es NULL.
+ */
+esp_err_t aqi_config_manager_get_snapshot(AQI_device_config_data_t_ptr config, uint32_t *version);
+
+/**
+ * @brief Obtiene todos los datos de configuración del dispositivo leyendo el
+ * 		  blob de la NVS. No comprueba si los datos se han marcado como cambiados o no.
  * 		  Esta funcion no es thread-safe y se puede ejecutar aunque el aqi_config_manager
  * 		  no haya sido inicializado con aqi_config_manager_init().
  *
  * @param config Puntero a la estructura donde se almacenarán los datos de configuración.
- * @param key_data_failed[out] Puntero a aqi_config_var_t, cuando se produce un error de lectura
- *        en la flash de una de las variables de config indica que variable produjo el error. Si
- *        no se han producido errores de lectura y todas las variables son accesibles en la flash
- *        devuelve. Esto permite utilizar la función para comprobar la existencia de las variables
- *        de configuracion en la flash
+ * @param key_data_failed[out] Puntero a aqi_config_var_t. Con el blob todas las variables
+ *        se leen juntas, siempre devuelve AQI_CV_NOT_VAR. Se mantiene por compatibilidad
+ *        con el formato antiguo de una clave por variable
  *
  * @return
  *     - ESP_OK: Operación exitosa.
  *     - ESP_ERR_INVALID_ARG: Argumento inválido.
- *     - ESP_FAIL: Error al obtener los datos.
+ *     - ESP_ERR_NVS_NOT_FOUND: No hay config guardada.
+ *     - ESP_ERR_INVALID_CRC, ESP_ERR_INVALID_SIZE, ESP_ERR_INVALID_VERSION: blob no valido.
  *
- * @warning Lee desde la cache local
+ * @warning Lee desde la flash, no desde la cache local
  */
 esp_err_t aqi_config_manager_get_all(AQI_device_config_data_t_ptr config, aqi_config_var_t* key_data_failed);
 
 /**
  * @brief Establece el valor de una variable de configuración específica.
+ * 		  Reescribe el blob de config con un solo commit si el valor cambia,
+ * 		  sube la revision y avisa con GSS_CONFIG_CHANGED a los canales que
+ * 		  la vigilan.
  * 		  Esta operacion es thread-safe.
  *
  * @param var La variable de configuración a establecer.
@@ -98,7 +129,8 @@ esp_err_t aqi_config_manager_get_all(AQI_device_config_data_t_ptr config, aqi_co
  *
  * @return
  *     - ESP_OK: Operación exitosa.
- *     - ESP_ERR_INVALID_ARG: Argumento inválido.
+ *     - ESP_ERR_INVALID_ARG: Argumento inválido o valor fuera del rango
+ *       de la variable en aqi_config_fields.
  *     - ESP_FAIL: Error al establecer el valor.
  *
  * @warning No es thread-safe. Lee directamente de la flash, no lee de la cahce local.
@@ -108,13 +140,18 @@ esp_err_t aqi_config_manager_set(aqi_config_var_t var, void * to_write, size_t l
 
 /**
  * @brief Establece todos los datos de configuración del dispositivo.
+ * 		  Se guardan en el blob con un solo commit: o cambian todos o ninguno.
+ * 		  Si no cambia ninguno no se escribe nada, si no sube la revision en
+ * 		  uno. Los canales del GSS que vigilan alguna de las variables
+ * 		  cambiadas reciben un solo GSS_CONFIG_CHANGED con todas ellas.
  * 		  Esta operacion es thread-safe
  *
  * @param config Puntero a la estructura que contiene los datos de configuración.
  *
  * @return
  *     - ESP_OK: Operación exitosa.
- *     - ESP_ERR_INVALID_ARG: Argumento inválido.
+ *     - ESP_ERR_INVALID_ARG: Argumento inválido o alguna variable fuera de rango,
+ *       no se guarda nada.
  *     - ESP_FAIL: Error al establecer los datos.
  *
  * @warning No es thread-safe
@@ -139,18 +176,28 @@ esp_err_t aqi_config_manager_release();
 
 /**
  * @brief Procesa datos JSON recibidos para leer nueva configuración.
- * 		  Actualiza la configuración que haya cambiado y marca como
- * 		  cambiados las variables que se hayan cambiado en memoria.
+ * 		  El JSON es un parche (JSON merge-patch, RFC 7396) sobre la config
+ * 		  actual: solo se validan y aplican las claves que trae, null vuelve
+ * 		  al valor por defecto. O se aplica todo el parche o nada, con un solo
+ * 		  commit y solo si cambia alguna variable.
+ * 		  Si trae AQI_CFG_JSON_VERSION_KEY solo se aplica si coincide con la
+ * 		  revision actual (concurrencia optimista). Un objeto sin claves
+ * 		  conocidas, p.ej. {}, no cambia nada y sirve para consultar la revision.
+ * 		  Esta operacion es thread-safe
  *
- * @param incoming_data La variable de configuración a establecer.
  * @param incoming_data Puntero a cadena con datos JSON.
  * @param len Longitud del los datos recibidos.
+ * @param result[out] Opcional (NULL). Revision tras procesar el JSON, tambien
+ * 		  si se rechaza, y variables cambiadas.
  *
  * @return
- *     - ESP_OK: Procesamiento exitoso.
- *     - ESP_ERR_INVALID_ARG: Argumento inválido, incoming_data es NULL
- *     - ESP_FAIL: Procesamiento abortado.
+ *     - ESP_OK: Procesamiento exitoso, aunque no cambie nada.
+ *     - ESP_ERR_INVALID_ARG: incoming_data es NULL o algun valor no es valido.
+ *     - ESP_ERR_INVALID_STATE: la version del JSON no es la revision actual.
+ *     - ESP_FAIL: el JSON no es un objeto bien formado.
+ *     - ESP_ERR_TIMEOUT o error de la NVS: no se ha guardado.
  */
-esp_err_t aqi_process_received_config_data(const char* incoming_data, int len);
+esp_err_t aqi_process_received_config_data(const char* incoming_data, int len,
+										aqi_config_update_result_t *result);
 
 #endif /* MAIN_AQI_CONFIG_MANAGER_H_ */
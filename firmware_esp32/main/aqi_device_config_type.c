@@ -6,12 +6,289 @@
  */
 
 #include "aqi_device_config_type.h"
+#include <stdatomic.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "esp_log.h"
 
+#include "sensors_rollup.h"
+
 static const char *TAG = "AQI_DEVICE_CONFIG_TYPE";
 
+#define AQI_CFG_FIELD_DESC(id, field, type, nvs_key, json_key, def, min, max, flags) \
+	{ (nvs_key), (json_key), sizeof(json_key) - 1, AQI_CFG_TYPE_##type, AQI_CFG_SIZE_##type, (flags), \
+	  offsetof(AQI_device_config_data_t, field), (min), (max) },
+
+// en el orden de la lista, que es el de aqi_config_var_t
+const aqi_config_field_t aqi_config_fields[] = {
+	AQI_DEVICE_CONFIG_VARS(AQI_CFG_FIELD_DESC)
+};
+
+// el tipo de cada linea de la lista debe coincidir con el de su campo
+#define AQI_CFG_CHECK_SIZE(id, field, type, nvs_key, json_key, def, min, max, flags) \
+	_Static_assert(sizeof(((AQI_device_config_data_t *)0)->field) == AQI_CFG_SIZE_##type, \
+			#field " no es de tipo " #type);
+AQI_DEVICE_CONFIG_VARS(AQI_CFG_CHECK_SIZE)
+
+/*
+ * Claves del JSON de configuracion. Se buscan con un hash perfecto: cada
+ * clave cae en un slot distinto de la tabla, asi que basta una comparacion
+ * para saber si una clave es conocida. La tabla se rellena de
+ * aqi_config_fields en el primer parse; al anadir claves hay que comprobar
+ * los multiplicadores con test/config_key_hash.py
+ */
+#define AQI_CFG_KEY_HASH_SIZE		32
+
+_Static_assert(AQI_CONFIG_NUM_FIELDS < AQI_CFG_KEY_HASH_SIZE, "Tabla de claves pequena");
+
+// indice en aqi_config_fields + 1, 0: slot libre
+static uint8_t config_key_slots[AQI_CFG_KEY_HASH_SIZE];
+// 0: sin rellenar, 1: hash perfecto, 2: hay colisiones, busqueda lineal
+static atomic_uint config_key_slots_state = 0;
+
+typedef struct
+{
+	AQI_device_config_data_t config;
+	aqi_config_patch_t patch;
+	unsigned errors;			// valores no validos
+	bool object;				// el documento es un objeto
+} aqi_cfg_parse_ctx_t;
+
+static uint8_t aqi_cfg_key_hash(const char *key, size_t len)
+{
+	return (uint8_t)((len + (5u * (uint8_t)key[len - 1]) + (11u * (uint8_t)key[len / 2])
+			+ (uint8_t)key[0]) & (AQI_CFG_KEY_HASH_SIZE - 1));
+}
+
+static bool aqi_cfg_key_equal(const aqi_config_field_t *field, const char *name, size_t name_len)
+{
+	return (field->json_key_len == name_len) && (memcmp(field->json_key, name, name_len) == 0);
+}
+
+/**
+ * Rellena los slots del hash. Si dos tareas lo hacen a la vez escriben lo
+ * mismo, el estado se publica al final
+ */
+static void aqi_cfg_key_slots_init(void)
+{
+	uint8_t slots[AQI_CFG_KEY_HASH_SIZE];
+	unsigned state = 1;
+
+	memset(slots, 0, sizeof(slots));
+	for (size_t i = 0; i < AQI_CONFIG_NUM_FIELDS; i++)
+	{
+		const aqi_config_field_t *field = &aqi_config_fields[i];
+		uint8_t h = aqi_cfg_key_hash(field->json_key, field->json_key_len);
+
+		if (slots[h] != 0)
+		{
+			ESP_LOGE(TAG, "Colision de %s con %s en el hash de claves, revisar test/config_key_hash.py",
+					field->json_key, aqi_config_fields[slots[h] - 1].json_key);
+			state = 2;
+			break;
+		}
+		slots[h] = (uint8_t)(i + 1);
+	}
+
+	memcpy(config_key_slots, slots, sizeof(slots));
+	atomic_store_explicit(&config_key_slots_state, state, memory_order_release);
+}
+
+static const aqi_config_field_t* aqi_cfg_find_key(const char *name, size_t name_len)
+{
+	unsigned state = atomic_load_explicit(&config_key_slots_state, memory_order_acquire);
+	uint8_t slot;
+
+	if (state == 0)
+	{
+		aqi_cfg_key_slots_init();
+		state = atomic_load_explicit(&config_key_slots_state, memory_order_acquire);
+	}
+
+	if (state == 1)
+	{
+		slot = config_key_slots[aqi_cfg_key_hash(name, name_len)];
+		if ((slot == 0) || !aqi_cfg_key_equal(&aqi_config_fields[slot - 1], name, name_len))
+		{
+			return NULL;
+		}
+		return &aqi_config_fields[slot - 1];
+	}
+
+	for (size_t i = 0; i < AQI_CONFIG_NUM_FIELDS; i++)
+	{
+		if (aqi_cfg_key_equal(&aqi_config_fields[i], name, name_len))
+		{
+			return &aqi_config_fields[i];
+		}
+	}
+
+	return NULL;
+}
+
+static bool aqi_cfg_value_in_range(const aqi_config_field_t *field, uint32_t value)
+{
+	if ((value == 0) && ((field->flags & AQI_CFG_ZERO_OFF) != 0))
+	{
+		return true;
+	}
+
+	return (value >= field->min) && (value <= field->max);
+}
+
+/**
+ * Entero sin signo en decimal, sin signo ni decimales. false si el token
+ * no es un numero asi o supera max
+ */
+static bool aqi_cfg_parse_uint(const struct json_token *token, uint32_t max, uint32_t *out)
+{
+	uint64_t value = 0;
+
+	if ((token->type != JSON_TYPE_NUMBER) || (token->len <= 0))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < token->len; i++)
+	{
+		char c = token->ptr[i];
+
+		if ((c < '0') || (c > '9'))
+		{
+			return false;
+		}
+		value = (value * 10) + (uint64_t)(c - '0');
+		if (value > max)
+		{
+			return false;
+		}
+	}
+
+	*out = (uint32_t)value;
+	return true;
+}
+
+/**
+ * Callback de json_walk: un solo recorrido del documento, cada valor de
+ * primer nivel se lleva a su campo sin copias intermedias
+ */
+static void aqi_cfg_walk_cb(void *callback_data, const char *name, size_t name_len,
+							const char *path, const struct json_token *token)
+{
+	aqi_cfg_parse_ctx_t *ctx = (aqi_cfg_parse_ctx_t *)callback_data;
+	const aqi_config_field_t *entry;
+	uint8_t *field;
+	uint32_t value;
+
+	// fin del documento: solo se admite un objeto
+	if (path[0] == '\0')
+	{
+		if (token->type == JSON_TYPE_OBJECT_END)
+		{
+			ctx->object = true;
+		}
+		return;
+	}
+
+	// inicios de objeto/array y claves anidadas (path distinto de ".clave")
+	if ((token->ptr == NULL) || (name == NULL) || (name_len == 0)
+			|| (path[0] != '.') || (strlen(path) != (name_len + 1)))
+	{
+		return;
+	}
+
+	if ((name_len == (sizeof(AQI_CFG_JSON_VERSION_KEY) - 1))
+			&& (memcmp(name, AQI_CFG_JSON_VERSION_KEY, name_len) == 0))
+	{
+		if (!aqi_cfg_parse_uint(token, UINT32_MAX, &ctx->patch.version))
+		{
+			ESP_LOGE(TAG, AQI_CFG_JSON_VERSION_KEY ": se esperaba un entero: %.*s", token->len, token->ptr);
+			ctx->errors++;
+			return;
+		}
+		ctx->patch.has_version = true;
+		return;
+	}
+
+	// claves desconocidas se ignoran
+	if ((entry = aqi_cfg_find_key(name, name_len)) == NULL)
+	{
+		return;
+	}
+
+	field = (uint8_t *)&ctx->config + entry->offset;
+
+	// null: vuelve al valor por defecto
+	if (token->type == JSON_TYPE_NULL)
+	{
+		AQI_device_config_data_t defaults;
+
+		aqi_device_config_data_type_defaults(&defaults);
+		memcpy(field, (const uint8_t *)&defaults + entry->offset, entry->size);
+		ctx->patch.present |= (1u << (entry - aqi_config_fields));
+		return;
+	}
+
+	switch (entry->type)
+	{
+	case AQI_CFG_TYPE_U8:
+	case AQI_CFG_TYPE_U16:
+		if (!aqi_cfg_parse_uint(token, entry->max, &value) || !aqi_cfg_value_in_range(entry, value))
+		{
+			ESP_LOGE(TAG, "%s: valor no valido (%s%u..%u): %.*s", entry->json_key,
+					((entry->flags & AQI_CFG_ZERO_OFF) != 0) ? "0 o " : "", entry->min, entry->max,
+					token->len, token->ptr);
+			ctx->errors++;
+			return;
+		}
+		if (entry->type == AQI_CFG_TYPE_U8)
+		{
+			*field = (uint8_t)value;
+		}
+		else
+		{
+			*(uint16_t *)field = (uint16_t)value;
+		}
+		break;
+	case AQI_CFG_TYPE_BOOL:
+		if ((token->type != JSON_TYPE_TRUE) && (token->type != JSON_TYPE_FALSE))
+		{
+			ESP_LOGE(TAG, "%s: se esperaba true o false: %.*s", entry->json_key, token->len, token->ptr);
+			ctx->errors++;
+			return;
+		}
+		*(bool *)field = (token->type == JSON_TYPE_TRUE);
+		break;
+	case AQI_CFG_TYPE_STR:
+	{
+		char room_name[AQI_CFG_SIZE_STR];
+		int len;
+
+		// se desescapa directamente al tamano del campo, lo que no cabe se trunca
+		if ((token->type != JSON_TYPE_STRING)
+				|| ((len = json_unescape(token->ptr, token->len, room_name, sizeof(room_name) - 1)) < 0))
+		{
+			ESP_LOGE(TAG, "%s: se esperaba un texto: %.*s", entry->json_key, token->len, token->ptr);
+			ctx->errors++;
+			return;
+		}
+		room_name[(len < (int)sizeof(room_name)) ? len : (int)(sizeof(room_name) - 1)] = '\0';
+		// un nombre vacio no cambia el actual
+		if (strlen(room_name) == 0)
+		{
+			return;
+		}
+		strncpy((char *)field, room_name, entry->size);
+		break;
+	}
+	default:
+		return;
+	}
+
+	ctx->patch.present |= (1u << (entry - aqi_config_fields));
+}
+
 bool aqi_device_config_data_type_init(AQI_device_config_data_t_ptr device_config_data ,
 										uint8_t save_screen_seconds,
 										const char * room_name,
@@ -61,62 +338,102 @@ bool aqi_device_config_data_clone(const AQI_device_config_data_t_ptr src, AQI_de
         return false;
     }
 
-    dest->save_screen_seconds = src->save_screen_seconds;
-    strncpy(dest->room_name, src->room_name, AQI_MAX_ROOM_NAME_SZ);
+    *dest = *src;
     dest->room_name[AQI_MAX_ROOM_NAME_SZ - 1] = '\0'; // Asegura terminación nula
 
-    dest->alarm_temp_h = src->alarm_temp_h;
-    dest->alarm_temp_l = src->alarm_temp_l;
-    dest->alarm_humidity_h = src->alarm_humidity_h;
-    dest->alarm_humidity_l = src->alarm_humidity_l;
-    dest->alarm_voc_index = src->alarm_voc_index;
-    dest->reset_wifi_provisioning = src->reset_wifi_provisioning;
-
     return true;
 }
 
+#define AQI_CFG_DEFAULT_U8(field, def)		device_config_data->field = (def);
+#define AQI_CFG_DEFAULT_U16(field, def)		device_config_data->field = (def);
+#define AQI_CFG_DEFAULT_BOOL(field, def)	device_config_data->field = (def);
+#define AQI_CFG_DEFAULT_STR(field, def)		strncpy(device_config_data->field, (def), AQI_CFG_SIZE_STR - 1);
+#define AQI_CFG_DEFAULT(id, field, type, nvs_key, json_key, def, min, max, flags) \
+	AQI_CFG_DEFAULT_##type(field, def)
+
+void aqi_device_config_data_type_defaults(AQI_device_config_data_t_ptr device_config_data)
+{
+	if (device_config_data == NULL)
+	{
+		return;
+	}
+
+	memset(device_config_data, 0, sizeof(*device_config_data));
+	AQI_DEVICE_CONFIG_VARS(AQI_CFG_DEFAULT)
+}
+
+uint32_t aqi_config_field_get_uint(const AQI_device_config_data_t *config, const aqi_config_field_t *field)
+{
+	const uint8_t *value = (const uint8_t *)config + field->offset;
+
+	switch (field->type)
+	{
+	case AQI_CFG_TYPE_U8:
+		return *value;
+	case AQI_CFG_TYPE_U16:
+		return *(const uint16_t *)value;
+	case AQI_CFG_TYPE_BOOL:
+		return *(const bool *)value ? 1u : 0u;
+	default:
+		return 0;
+	}
+}
+
+bool aqi_config_field_is_valid(const AQI_device_config_data_t *config, const aqi_config_field_t *field)
+{
+	if (field->type == AQI_CFG_TYPE_STR)
+	{
+		return true;
+	}
+
+	return aqi_cfg_value_in_range(field, aqi_config_field_get_uint(config, field));
+}
+
+bool aqi_config_field_equal(const AQI_device_config_data_t *a, const AQI_device_config_data_t *b,
+							const aqi_config_field_t *field)
+{
+	if (field->type == AQI_CFG_TYPE_STR)
+	{
+		return strncmp((const char *)a + field->offset, (const char *)b + field->offset, field->size) == 0;
+	}
+
+	return aqi_config_field_get_uint(a, field) == aqi_config_field_get_uint(b, field);
+}
 
 esp_err_t aqi_device_config_data_type_parse(const char *data, int data_len,
-								AQI_device_config_data_t_ptr device_config_data)
+								AQI_device_config_data_t_ptr device_config_data,
+								aqi_config_patch_t *patch)
 {
-	int ret = 0;
-	char * room_name = NULL;
-
-	ret = json_scanf(data, data_len,
-			"{ screen_sec: %hhu,"
-			"room: %Q,"
-			"alarm_voc: %hu,"
-			"alarm_temp_h: %hu,"
-			"alarm_temp_l: %hu,"
-			"alarm_hum_h: %hu,"
-			"alarm_hum_l: %hu,"
-			"rst_wifi_prov: %B }",
-			&(device_config_data->save_screen_seconds),
-			&room_name,
-			&(device_config_data->alarm_voc_index),
-			&(device_config_data->alarm_temp_h),
-			&(device_config_data->alarm_temp_l),
-			&(device_config_data->alarm_humidity_h),
-			&(device_config_data->alarm_humidity_l),
-			&(device_config_data->reset_wifi_provisioning)
-	);
-
-	if ((room_name != NULL) && (strlen(room_name) > 0))
-	{
-		strncpy(device_config_data->room_name, room_name, AQI_MAX_ROOM_NAME_SZ);
-		device_config_data->room_name[AQI_MAX_ROOM_NAME_SZ-1] = '\0';
-		free(room_name);
+	aqi_cfg_parse_ctx_t ctx;
+
+	if ((data == NULL) || (data_len <= 0) || (device_config_data == NULL))
+	{
+		return ESP_FAIL;
 	}
 
-	// no data consumed or scan error
-	if (ret <= 0)
+	// se trabaja sobre una copia, un documento mal formado o con algun
+	// valor no valido no cambia nada
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.config = *device_config_data;
+
+	if ((json_walk(data, data_len, aqi_cfg_walk_cb, &ctx) < 0) || !ctx.object)
 	{
-		ret = ESP_FAIL;
+		ESP_LOGE(TAG, "JSON de configuracion mal formado");
+		return ESP_FAIL;
 	}
-	else
+
+	if (patch != NULL)
 	{
-		ret = ESP_OK;
+		*patch = ctx.patch;
 	}
 
-	return ret;
+	if (ctx.errors > 0)
+	{
+		ESP_LOGE(TAG, "%u valores no validos, no se aplica ningun cambio", ctx.errors);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	*device_config_data = ctx.config;
+
+	return ESP_OK;
 }
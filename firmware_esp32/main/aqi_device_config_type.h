@@ -8,12 +8,20 @@
 #ifndef MAIN_AQI_DEVICE_CONFIG_TYPE_H_
 #define MAIN_AQI_DEVICE_CONFIG_TYPE_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
 #include "frozen.h"
 
 #define AQI_MAX_ROOM_NAME_SZ	16
 
+// Maximo de muestras agrupadas en una publicacion MQTT
+#define AQI_MAX_MQTT_BATCH_SAMPLES	60
+
+// Se guarda tal cual en el blob de config de la NVS: los campos nuevos van
+// al final (ver AQI_CONFIG_BLOB_DATA_LEN en aqi_config_manager.c)
 typedef struct AQI_device_config_data_t
 {
 	uint8_t save_screen_seconds;
@@ -23,11 +31,104 @@ typedef struct AQI_device_config_data_t
 	uint16_t alarm_humidity_h;
 	uint16_t alarm_humidity_l;
 	uint16_t alarm_voc_index;
+	uint8_t mqtt_batch_samples;		// muestras por publicacion MQTT (1: sin batching)
+	uint16_t mqtt_batch_seconds;	// edad maxima de un batch antes de publicarlo (0: sin limite)
+	uint16_t mqtt_deadband_temp;	// cambio minimo de temperatura para publicar una muestra
+	uint16_t mqtt_deadband_humidity;	// cambio minimo de humedad para publicar una muestra
+	uint16_t mqtt_deadband_voc;		// cambio minimo de indice VOC para publicar una muestra
+	uint8_t mqtt_deadband_rel_pct;	// cambio relativo (%) que tambien publica (0: desactivado)
+	uint16_t mqtt_heartbeat_seconds;	// maximo sin publicar con deadband (0: se publica todo)
+	uint16_t sensors_rollup_seconds;	// ventana de los agregados de medidas (0: sin agregados)
 	bool reset_wifi_provisioning;	// true: queremos entrar en modo wifi provisioning
 } AQI_device_config_data_t;
 
 typedef AQI_device_config_data_t* AQI_device_config_data_t_ptr;
 
+/*
+ * Variables de configuracion, una linea por variable. Al anadir una basta
+ * con su linea aqui y su campo al final de AQI_device_config_data_t.
+ *
+ * X(id, campo, tipo, clave NVS, clave JSON, por defecto, min, max, flags)
+ *
+ * id:			sufijo de su aqi_config_var_t (AQI_CV_<id>)
+ * tipo:		U8, U16, BOOL o STR (texto de AQI_MAX_ROOM_NAME_SZ)
+ * clave NVS:	la del formato antiguo de una clave por variable
+ * min, max:	rango admitido de los enteros
+ * flags:		AQI_CFG_ZERO_OFF si 0 (desactivado) vale fuera del rango
+ *
+ * SENSORS_ROLLUP_* estan en sensors_rollup.h, que debe incluir quien
+ * expanda la lista
+ */
+#define AQI_DEVICE_CONFIG_VARS(X) \
+	X(SCREEN_TIME,				save_screen_seconds,		U8,		"SCRT",		"screen_sec",		30,		0,	UINT8_MAX,	0) \
+	X(ROOM_NAME,				room_name,					STR,	"ROOM",		"room",				"Room",	0,	0,			0) \
+	X(ALARM_TEMP_H,				alarm_temp_h,				U16,	"TH",		"alarm_temp_h",		30,		0,	UINT16_MAX,	0) \
+	X(ALARM_TEMP_L,				alarm_temp_l,				U16,	"TL",		"alarm_temp_l",		17,		0,	UINT16_MAX,	0) \
+	X(ALARM_HUMIDITY_H,			alarm_humidity_h,			U16,	"HH",		"alarm_hum_h",		70,		0,	UINT16_MAX,	0) \
+	X(ALARM_HUMIDITY_L,			alarm_humidity_l,			U16,	"HL",		"alarm_hum_l",		40,		0,	UINT16_MAX,	0) \
+	X(ALARM_VOC_INDEX_LIMIT,	alarm_voc_index,			U16,	"VOCL",		"alarm_voc",		300,	0,	UINT16_MAX,	0) \
+	X(WIFI_PROVISIONING_STATE,	reset_wifi_provisioning,	BOOL,	"WPRVST",	"rst_wifi_prov",	false,	0,	1,			0) \
+	X(MQTT_BATCH_SAMPLES,		mqtt_batch_samples,			U8,		"BTCHN",	"batch_n",			1,		1,	AQI_MAX_MQTT_BATCH_SAMPLES,	0) \
+	X(MQTT_BATCH_SECONDS,		mqtt_batch_seconds,			U16,	"BTCHS",	"batch_sec",		0,		0,	UINT16_MAX,	0) \
+	X(MQTT_DEADBAND_TEMP,		mqtt_deadband_temp,			U16,	"DBT",		"db_temp",			1,		0,	UINT16_MAX,	0) \
+	X(MQTT_DEADBAND_HUMIDITY,	mqtt_deadband_humidity,		U16,	"DBH",		"db_hum",			2,		0,	UINT16_MAX,	0) \
+	X(MQTT_DEADBAND_VOC,		mqtt_deadband_voc,			U16,	"DBV",		"db_voc",			10,		0,	UINT16_MAX,	0) \
+	X(MQTT_DEADBAND_REL_PCT,	mqtt_deadband_rel_pct,		U8,		"DBR",		"db_rel_pct",		0,		0,	100,		0) \
+	X(MQTT_HEARTBEAT_SECONDS,	mqtt_heartbeat_seconds,		U16,	"HBS",		"hb_sec",			0,		0,	UINT16_MAX,	0) \
+	X(SENSORS_ROLLUP_SECONDS,	sensors_rollup_seconds,		U16,	"RLPS",		"rollup_sec",		0,		SENSORS_ROLLUP_MIN_SECONDS,	SENSORS_ROLLUP_MAX_SECONDS,	AQI_CFG_ZERO_OFF)
+
+#define AQI_CFG_COUNT_VAR(id, field, type, nvs_key, json_key, def, min, max, flags)	+ 1
+#define AQI_CONFIG_NUM_FIELDS	(0u AQI_DEVICE_CONFIG_VARS(AQI_CFG_COUNT_VAR))
+
+// 0 es "desactivado" y se admite aunque este fuera de [min, max]
+#define AQI_CFG_ZERO_OFF		(1u << 0)
+
+typedef enum
+{
+	AQI_CFG_TYPE_U8,
+	AQI_CFG_TYPE_U16,
+	AQI_CFG_TYPE_BOOL,
+	AQI_CFG_TYPE_STR,
+} aqi_cfg_type_t;
+
+#define AQI_CFG_SIZE_U8			sizeof(uint8_t)
+#define AQI_CFG_SIZE_U16		sizeof(uint16_t)
+#define AQI_CFG_SIZE_BOOL		sizeof(bool)
+#define AQI_CFG_SIZE_STR		AQI_MAX_ROOM_NAME_SZ
+
+/**
+ * Descriptor de una variable, generado de AQI_DEVICE_CONFIG_VARS
+ */
+typedef struct
+{
+	const char *nvs_key;
+	const char *json_key;
+	uint8_t json_key_len;
+	uint8_t type;			// aqi_cfg_type_t
+	uint8_t size;			// bytes del campo
+	uint8_t flags;			// AQI_CFG_*
+	uint16_t offset;		// campo en AQI_device_config_data_t
+	uint16_t min;
+	uint16_t max;
+} aqi_config_field_t;
+
+// indexada por aqi_config_var_t
+extern const aqi_config_field_t aqi_config_fields[];
+
+// Clave del JSON de configuracion con la version de la config sobre la que
+// se ha preparado el cambio (ver aqi_process_received_config_data)
+#define AQI_CFG_JSON_VERSION_KEY	"version"
+
+/**
+ * Lo que trae un JSON de configuracion, lo rellena aqi_device_config_data_type_parse
+ */
+typedef struct
+{
+	uint32_t present;		// bit i: trae la clave de aqi_config_fields[i]
+	bool has_version;		// trae AQI_CFG_JSON_VERSION_KEY
+	uint32_t version;
+} aqi_config_patch_t;
+
 /**
  * @brief Function to initialize an AQI_device_config_data_t structure with provided configuration values.
  *			This function sets all fields of the AQI_device_config_data_t structure, including screen timeout,
@@ -66,18 +167,53 @@ bool aqi_device_config_data_type_init(AQI_device_config_data_t_ptr device_config
  */
 bool aqi_device_config_data_clone(const AQI_device_config_data_t_ptr src, AQI_device_config_data_t_ptr dest);
 
+/**
+ * @brief Pone todos los campos a su valor por defecto de AQI_DEVICE_CONFIG_VARS.
+ * 			El relleno del struct queda a 0.
+ */
+void aqi_device_config_data_type_defaults(AQI_device_config_data_t_ptr device_config_data);
+
+/**
+ * @brief Valor de un campo entero o bool de la config
+ */
+uint32_t aqi_config_field_get_uint(const AQI_device_config_data_t *config, const aqi_config_field_t *field);
+
+/**
+ * @brief true si el campo tiene un valor admitido: dentro de [min, max] o 0
+ * 			con AQI_CFG_ZERO_OFF. Los textos siempre son validos.
+ */
+bool aqi_config_field_is_valid(const AQI_device_config_data_t *config, const aqi_config_field_t *field);
+
+/**
+ * @brief true si el campo tiene el mismo valor en las dos configs
+ */
+bool aqi_config_field_equal(const AQI_device_config_data_t *a, const AQI_device_config_data_t *b,
+							const aqi_config_field_t *field);
+
 
 /**
  * @brief Function to parse incoming AQI_device_config_data_t data inside a C string
- * 			in json format to a AQI_device_config_data_t
+ * 			in json format to a AQI_device_config_data_t, with JSON merge-patch
+ * 			semantics (RFC 7396): only the fields present in the JSON are written,
+ * 			the rest keep their previous value, and a null value resets the field
+ * 			to its default. An empty room name is ignored.
+ * 			The document is walked once, top level keys are looked up in a
+ * 			perfect hash table of aqi_config_fields and unknown keys are ignored.
+ * 			The patch is all or nothing: if any value is out of its [min, max]
+ * 			range or has a wrong type it is logged and no field is written.
+ * 			A malformed document changes nothing.
  *
  * @param data			Incoming sensors_data datatype in json string format
  * @param data_len		length of data
  * @param sensors_data	pointer to a AQI_device_config_data_t object
- * @return Returns ESP_OK if data is well formatted else returns ESP_FAIL
+ * @param patch[out]	optional (NULL), keys found in the JSON
+ * @return Returns ESP_OK if the patch was applied, even if it has no known
+ * 			keys, ESP_ERR_INVALID_ARG if some value is not valid and ESP_FAIL if
+ * 			data is not a well formatted JSON object
  */
 esp_err_t aqi_device_config_data_type_parse(const char *data, int data_len,
-								AQI_device_config_data_t_ptr device_config_data);
+								AQI_device_config_data_t_ptr device_config_data,
+								aqi_config_patch_t *patch);
 
 
 #endif /* MAIN_AQI_DEVICE_CONFIG_TYPE_H_ */
@@ -0,0 +1,429 @@
+/*
+ * aqi_json_schema.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include "aqi_json_schema.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+#include "frozen.h"
+
+static const char *TAG = "AQI_JSON";
+
+/*
+ * Fragmentos constantes de cada mensaje, tal y como los escribe json_printf
+ * a partir de los formatos de referencia (las claves sin comillas se
+ * entrecomillan y los separadores se copian tal cual)
+ */
+#define AQI_JSON_MEASURE_HUMIDITY		" { \"humidity_rh\": "
+#define AQI_JSON_MEASURE_TEMP			", \"temp_celsius\": "
+#define AQI_JSON_MEASURE_VOC_RAW		",\"voc_raw\": "
+#define AQI_JSON_MEASURE_VOC_INDEX		",\"voc_index\": "
+#define AQI_JSON_MEASURE_END			"}"
+
+#define AQI_JSON_ALARM_DISABLE			"{ \"disable\": "
+#define AQI_JSON_ALARM_CLASS			", \"alarm_class\": "
+#define AQI_JSON_ALARM_INFO				",\"info\": "
+
+#define AQI_JSON_BATCH_HEADER			"{\"sent_ms\": "
+#define AQI_JSON_BATCH_SAMPLES			", \"samples\": ["
+#define AQI_JSON_BATCH_T_MS				"{\"t_ms\": "
+#define AQI_JSON_BATCH_HUMIDITY			", \"humidity_rh\": "
+#define AQI_JSON_BATCH_TEMP				", \"temp_celsius\": "
+#define AQI_JSON_BATCH_VOC_RAW			", \"voc_raw\": "
+#define AQI_JSON_BATCH_VOC_INDEX		", \"voc_index\": "
+#define AQI_JSON_BATCH_END				"]}"
+
+#define AQI_JSON_LEN(s)					(sizeof(s) - 1)
+
+// cifras maximas de un uint16_t y de un int64_t con signo
+#define AQI_JSON_U16_DIGITS				5
+#define AQI_JSON_I64_DIGITS				20
+
+_Static_assert(AQI_JSON_MEASURE_MAX_LEN >= (AQI_JSON_LEN(AQI_JSON_MEASURE_HUMIDITY)
+		+ AQI_JSON_LEN(AQI_JSON_MEASURE_TEMP) + AQI_JSON_LEN(AQI_JSON_MEASURE_VOC_RAW)
+		+ AQI_JSON_LEN(AQI_JSON_MEASURE_VOC_INDEX) + AQI_JSON_LEN(AQI_JSON_MEASURE_END)
+		+ (4 * AQI_JSON_U16_DIGITS)), "AQI_JSON_MEASURE_MAX_LEN too small");
+_Static_assert(AQI_JSON_BATCH_SAMPLE_MAX_LEN >= (1 + AQI_JSON_LEN(AQI_JSON_BATCH_T_MS)
+		+ AQI_JSON_I64_DIGITS + AQI_JSON_LEN(AQI_JSON_BATCH_HUMIDITY)
+		+ AQI_JSON_LEN(AQI_JSON_BATCH_TEMP) + AQI_JSON_LEN(AQI_JSON_BATCH_VOC_RAW)
+		+ AQI_JSON_LEN(AQI_JSON_BATCH_VOC_INDEX) + AQI_JSON_LEN(AQI_JSON_MEASURE_END)
+		+ (4 * AQI_JSON_U16_DIGITS)), "AQI_JSON_BATCH_SAMPLE_MAX_LEN too small");
+
+typedef struct
+{
+	const char *text;
+	size_t len;
+} aqi_json_fragment_t;
+
+#define AQI_JSON_FRAGMENT(s)			{ (s), AQI_JSON_LEN(s) }
+
+// el texto de cada alarma con sus comillas y el cierre del objeto (%Q })
+static const aqi_json_fragment_t alarm_info_fragments[AC_MAX_CLASSES] = {
+	[AC_TEMP_H] = AQI_JSON_FRAGMENT("\"" AC_INFO_TEMP_H "\" }"),
+	[AC_TEMP_L] = AQI_JSON_FRAGMENT("\"" AC_INFO_TEMP_L "\" }"),
+	[AC_HUM_H] = AQI_JSON_FRAGMENT("\"" AC_INFO_HUM_H "\" }"),
+	[AC_HUM_L] = AQI_JSON_FRAGMENT("\"" AC_INFO_HUM_L "\" }"),
+	[AC_VOC_LIMIT] = AQI_JSON_FRAGMENT("\"" AC_INFO_VOC_LIMIT "\" }"),
+};
+
+/*
+ * Escritor sobre un buffer con comprobacion de espacio. Si algo no cabe
+ * se marca el desbordamiento y el resto de escrituras no hacen nada
+ */
+typedef struct
+{
+	char *pos;
+	char *end;			// ultimo byte util, reservado para el '\0'
+	bool overflow;
+} aqi_json_writer_t;
+
+static void aqi_json_writer_init(aqi_json_writer_t *w, char *buffer, size_t size)
+{
+	w->pos = buffer;
+	w->end = buffer + size - 1;
+	w->overflow = false;
+}
+
+static void aqi_json_put(aqi_json_writer_t *w, const char *text, size_t len)
+{
+	if (w->overflow || ((size_t)(w->end - w->pos) < len))
+	{
+		w->overflow = true;
+		return;
+	}
+
+	memcpy(w->pos, text, len);
+	w->pos += len;
+}
+
+#define aqi_json_put_literal(w, s)		aqi_json_put((w), (s), AQI_JSON_LEN(s))
+
+static void aqi_json_put_u64(aqi_json_writer_t *w, uint64_t value)
+{
+	char digits[AQI_JSON_I64_DIGITS];
+	size_t n = sizeof(digits);
+
+	// de la cifra menos significativa a la mas significativa
+	do
+	{
+		digits[--n] = (char)('0' + (value % 10));
+		value /= 10;
+	} while (value != 0);
+
+	aqi_json_put(w, &digits[n], sizeof(digits) - n);
+}
+
+static void aqi_json_put_u16(aqi_json_writer_t *w, uint16_t value)
+{
+	char digits[AQI_JSON_U16_DIGITS];
+	size_t n = sizeof(digits);
+	// en 32 bits, mas barato que la division de 64 bits de aqi_json_put_u64
+	uint32_t v = value;
+
+	do
+	{
+		digits[--n] = (char)('0' + (v % 10));
+		v /= 10;
+	} while (v != 0);
+
+	aqi_json_put(w, &digits[n], sizeof(digits) - n);
+}
+
+static void aqi_json_put_i64(aqi_json_writer_t *w, int64_t value)
+{
+	if (value < 0)
+	{
+		aqi_json_put_literal(w, "-");
+		aqi_json_put_u64(w, (uint64_t)0 - (uint64_t)value);
+	}
+	else
+	{
+		aqi_json_put_u64(w, (uint64_t)value);
+	}
+}
+
+/**
+ * Termina la cadena y devuelve su longitud, 0 si no ha cabido
+ */
+static size_t aqi_json_writer_finish(aqi_json_writer_t *w, char *buffer)
+{
+	if (w->overflow)
+	{
+		buffer[0] = '\0';
+		return 0;
+	}
+
+	*w->pos = '\0';
+
+	return (size_t)(w->pos - buffer);
+}
+
+size_t aqi_json_write_measure(char *buffer, size_t size, const Sensors_data_t *sensors_data)
+{
+	aqi_json_writer_t w;
+
+	if ((buffer == NULL) || (size == 0) || (sensors_data == NULL))
+	{
+		return 0;
+	}
+
+	aqi_json_writer_init(&w, buffer, size);
+	aqi_json_put_literal(&w, AQI_JSON_MEASURE_HUMIDITY);
+	aqi_json_put_u16(&w, sensors_data->relative_humidity);
+	aqi_json_put_literal(&w, AQI_JSON_MEASURE_TEMP);
+	aqi_json_put_u16(&w, sensors_data->temperature_celsius);
+	aqi_json_put_literal(&w, AQI_JSON_MEASURE_VOC_RAW);
+	aqi_json_put_u16(&w, sensors_data->voc_raw);
+	aqi_json_put_literal(&w, AQI_JSON_MEASURE_VOC_INDEX);
+	aqi_json_put_u16(&w, sensors_data->voc_index);
+	aqi_json_put_literal(&w, AQI_JSON_MEASURE_END);
+
+	return aqi_json_writer_finish(&w, buffer);
+}
+
+size_t aqi_json_write_alarm(char *buffer, size_t size, const Alarm_data_t *alarm_data)
+{
+	aqi_json_writer_t w;
+
+	if ((buffer == NULL) || (size == 0) || (alarm_data == NULL)
+			|| (alarm_data->alarm_class < 0) || (alarm_data->alarm_class >= AC_MAX_CLASSES))
+	{
+		return 0;
+	}
+
+	const aqi_json_fragment_t *info = &alarm_info_fragments[alarm_data->alarm_class];
+
+	aqi_json_writer_init(&w, buffer, size);
+	aqi_json_put_literal(&w, AQI_JSON_ALARM_DISABLE);
+	if (alarm_data->disable)
+	{
+		aqi_json_put_literal(&w, "true");
+	}
+	else
+	{
+		aqi_json_put_literal(&w, "false");
+	}
+	aqi_json_put_literal(&w, AQI_JSON_ALARM_CLASS);
+	aqi_json_put_u16(&w, (uint16_t)alarm_data->alarm_class);
+	aqi_json_put_literal(&w, AQI_JSON_ALARM_INFO);
+	aqi_json_put(&w, info->text, info->len);
+
+	return aqi_json_writer_finish(&w, buffer);
+}
+
+size_t aqi_json_write_batch_header(char *buffer, size_t size, int64_t sent_ms)
+{
+	aqi_json_writer_t w;
+
+	if ((buffer == NULL) || (size == 0))
+	{
+		return 0;
+	}
+
+	aqi_json_writer_init(&w, buffer, size);
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_HEADER);
+	aqi_json_put_i64(&w, sent_ms);
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_SAMPLES);
+
+	return aqi_json_writer_finish(&w, buffer);
+}
+
+size_t aqi_json_write_batch_sample(char *buffer, size_t size, bool first, int64_t t_ms,
+								const Sensors_data_t *sensors_data)
+{
+	aqi_json_writer_t w;
+
+	if ((buffer == NULL) || (size == 0) || (sensors_data == NULL))
+	{
+		return 0;
+	}
+
+	aqi_json_writer_init(&w, buffer, size);
+	if (!first)
+	{
+		aqi_json_put_literal(&w, ",");
+	}
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_T_MS);
+	aqi_json_put_i64(&w, t_ms);
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_HUMIDITY);
+	aqi_json_put_u16(&w, sensors_data->relative_humidity);
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_TEMP);
+	aqi_json_put_u16(&w, sensors_data->temperature_celsius);
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_VOC_RAW);
+	aqi_json_put_u16(&w, sensors_data->voc_raw);
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_VOC_INDEX);
+	aqi_json_put_u16(&w, sensors_data->voc_index);
+	aqi_json_put_literal(&w, AQI_JSON_MEASURE_END);
+
+	return aqi_json_writer_finish(&w, buffer);
+}
+
+size_t aqi_json_write_batch_end(char *buffer, size_t size)
+{
+	aqi_json_writer_t w;
+
+	if ((buffer == NULL) || (size == 0))
+	{
+		return 0;
+	}
+
+	aqi_json_writer_init(&w, buffer, size);
+	aqi_json_put_literal(&w, AQI_JSON_BATCH_END);
+
+	return aqi_json_writer_finish(&w, buffer);
+}
+
+//****************************************************************************
+//      AUTOCOMPROBACION Y MEDIDA FRENTE A json_printf
+//****************************************************************************
+
+// valores en los que cambia el numero de cifras, el resto son aleatorios
+static const uint16_t selftest_edges[] = { 0, 9, 10, 99, 100, 999, 1000, 9999, 10000, UINT16_MAX };
+#define SELFTEST_EDGES_COUNT	(sizeof(selftest_edges) / sizeof(selftest_edges[0]))
+
+static uint16_t aqi_json_selftest_value(uint32_t i, uint32_t field)
+{
+	uint32_t k = (i * 4) + field;
+
+	if (k < SELFTEST_EDGES_COUNT)
+	{
+		return selftest_edges[k];
+	}
+
+	return (uint16_t)(esp_random() >> (field * 4));
+}
+
+/**
+ * Compara la salida de las dos implementaciones, con la diferencia en el log
+ */
+static bool aqi_json_selftest_compare(const char *what, const char *expected, int expected_len,
+								const char *got, size_t got_len)
+{
+	if ((expected_len >= 0) && ((size_t)expected_len == got_len)
+			&& (memcmp(expected, got, got_len) == 0))
+	{
+		return true;
+	}
+
+	ESP_LOGE(TAG, "%s distinto:\n json_printf(%d): %s\n schema(%u): %s", what, expected_len,
+			expected, (unsigned)got_len, got);
+	return false;
+}
+
+esp_err_t aqi_json_schema_selftest(uint32_t iterations, aqi_json_bench_t *out)
+{
+	char reference[AQI_JSON_BATCH_SAMPLE_MAX_LEN + 16];
+	char result[AQI_JSON_BATCH_SAMPLE_MAX_LEN + 16];
+	int64_t t0;
+
+	if ((out == NULL) || (iterations == 0))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	memset(out, 0, sizeof(*out));
+	out->iterations = iterations;
+
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		Sensors_data_t sample = {
+			.relative_humidity = aqi_json_selftest_value(i, 0),
+			.temperature_celsius = aqi_json_selftest_value(i, 1),
+			.voc_raw = aqi_json_selftest_value(i, 2),
+			.voc_index = aqi_json_selftest_value(i, 3),
+		};
+		Alarm_data_t alarm = {
+			.disable = ((i & 1) != 0),
+			.alarm_class = (Alarm_class)(i % AC_MAX_CLASSES),
+			.info = alarm_class_info((Alarm_class)(i % AC_MAX_CLASSES)),
+		};
+		int64_t t_ms = ((int64_t)esp_random() << 8) | (i & 0xFF);
+		struct json_out ref_out;
+		int ref_len;
+		size_t len;
+
+		// medida
+		ref_out = (struct json_out)JSON_OUT_BUF(reference, sizeof(reference));
+		t0 = esp_timer_get_time();
+		ref_len = (sensors_type_to_JSON(&ref_out, sizeof(reference), &sample) == ESP_OK) ?
+				(int)ref_out.u.buf.len : -1;
+		out->printf_us += esp_timer_get_time() - t0;
+
+		t0 = esp_timer_get_time();
+		len = aqi_json_write_measure(result, sizeof(result), &sample);
+		out->schema_us += esp_timer_get_time() - t0;
+
+		out->checked++;
+		if (!aqi_json_selftest_compare("medida", reference, ref_len, result, len))
+		{
+			out->mismatches++;
+		}
+
+		// muestra de un batch, con el mismo formato que mqtt_flush_batch
+		ref_out = (struct json_out)JSON_OUT_BUF(reference, sizeof(reference));
+		t0 = esp_timer_get_time();
+		ref_len = json_printf(&ref_out, "%s{t_ms: %" PRId64 ", humidity_rh: %u, temp_celsius: %u, "
+				"voc_raw: %u, voc_index: %u}", ((i & 1) == 0) ? "" : ",", t_ms,
+				sample.relative_humidity, sample.temperature_celsius, sample.voc_raw, sample.voc_index);
+		out->printf_us += esp_timer_get_time() - t0;
+
+		t0 = esp_timer_get_time();
+		len = aqi_json_write_batch_sample(result, sizeof(result), ((i & 1) == 0), t_ms, &sample);
+		out->schema_us += esp_timer_get_time() - t0;
+
+		out->checked++;
+		if (!aqi_json_selftest_compare("muestra de batch", reference, ref_len, result, len))
+		{
+			out->mismatches++;
+		}
+
+		// alarma
+		ref_out = (struct json_out)JSON_OUT_BUF(reference, sizeof(reference));
+		t0 = esp_timer_get_time();
+		ref_len = (alarm_type_to_JSON(&ref_out, sizeof(reference), &alarm) == ESP_OK) ?
+				(int)ref_out.u.buf.len : -1;
+		out->printf_us += esp_timer_get_time() - t0;
+
+		t0 = esp_timer_get_time();
+		len = aqi_json_write_alarm(result, sizeof(result), &alarm);
+		out->schema_us += esp_timer_get_time() - t0;
+
+		out->checked++;
+		if (!aqi_json_selftest_compare("alarma", reference, ref_len, result, len))
+		{
+			out->mismatches++;
+		}
+	}
+
+	// cabecera y cierre del batch
+	struct json_out ref_out = JSON_OUT_BUF(reference, sizeof(reference));
+	int ref_len = json_printf(&ref_out, "{sent_ms: %" PRId64 ", samples: [", (int64_t)INT32_MAX * 1000);
+	size_t len = aqi_json_write_batch_header(result, sizeof(result), (int64_t)INT32_MAX * 1000);
+
+	out->checked++;
+	if (!aqi_json_selftest_compare("cabecera de batch", reference, ref_len, result, len))
+	{
+		out->mismatches++;
+	}
+
+	ref_out = (struct json_out)JSON_OUT_BUF(reference, sizeof(reference));
+	ref_len = json_printf(&ref_out, "]}");
+	len = aqi_json_write_batch_end(result, sizeof(result));
+
+	out->checked++;
+	if (!aqi_json_selftest_compare("cierre de batch", reference, ref_len, result, len))
+	{
+		out->mismatches++;
+	}
+
+	return (out->mismatches == 0) ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,97 @@
+/*
+ * aqi_json_schema.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Serializador JSON especializado para los mensajes fijos que publica el
+ *  sender MQTT. Genera exactamente los mismos bytes que json_printf con los
+ *  formatos de sensors_type_to_JSON, alarm_type_to_JSON y del batch, pero
+ *  sin interpretar el formato en cada llamada: las claves son fragmentos
+ *  constantes con su longitud calculada al compilar, los enteros se
+ *  convierten directamente a ASCII y los textos de las alarmas ya van
+ *  escapados y entrecomillados.
+ *
+ *  aqi_json_schema_selftest compara las dos implementaciones byte a byte
+ *  y mide lo que tarda cada una (comando de consola jsonbench).
+ */
+
+#ifndef MAIN_AQI_JSON_SCHEMA_H_
+#define MAIN_AQI_JSON_SCHEMA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sensors_type.h"
+#include "alarm_type.h"
+
+// longitud maxima (sin el '\0') de cada mensaje, valores de 5 cifras
+#define AQI_JSON_MEASURE_MAX_LEN		84
+#define AQI_JSON_BATCH_SAMPLE_MAX_LEN	116
+
+typedef struct
+{
+	uint32_t checked;			// mensajes comparados
+	uint32_t mismatches;		// mensajes distintos entre las dos implementaciones
+	uint32_t iterations;
+	int64_t printf_us;			// tiempo total con json_printf
+	int64_t schema_us;			// tiempo total con el serializador especializado
+} aqi_json_bench_t;
+
+/**
+ * @brief Escribe una medida en el mismo formato que sensors_type_to_JSON
+ *
+ * @param buffer	destino, se termina con '\0'
+ * @param size		tamano del destino
+ *
+ * @return longitud escrita sin el '\0', 0 si no cabe o los argumentos
+ * 		   no son validos
+ */
+size_t aqi_json_write_measure(char *buffer, size_t size, const Sensors_data_t *sensors_data);
+
+/**
+ * @brief Escribe una alarma en el mismo formato que alarm_type_to_JSON
+ *
+ * @return longitud escrita sin el '\0', 0 si no cabe o la clase de alarma
+ * 		   no es valida
+ */
+size_t aqi_json_write_alarm(char *buffer, size_t size, const Alarm_data_t *alarm_data);
+
+/**
+ * @brief Escribe la cabecera de un batch: {sent_ms, samples: [
+ *
+ * @return longitud escrita sin el '\0', 0 si no cabe
+ */
+size_t aqi_json_write_batch_header(char *buffer, size_t size, int64_t sent_ms);
+
+/**
+ * @brief Escribe una muestra de un batch, precedida de ',' si no es la
+ * 		  primera
+ *
+ * @return longitud escrita sin el '\0', 0 si no cabe
+ */
+size_t aqi_json_write_batch_sample(char *buffer, size_t size, bool first, int64_t t_ms,
+								const Sensors_data_t *sensors_data);
+
+/**
+ * @brief Cierra un batch
+ *
+ * @return longitud escrita sin el '\0', 0 si no cabe
+ */
+size_t aqi_json_write_batch_end(char *buffer, size_t size);
+
+/**
+ * @brief Serializa 'iterations' medidas, muestras de batch y alarmas con
+ * 		  json_printf y con este modulo, compara los resultados byte a byte
+ * 		  y mide el tiempo de cada uno. Los valores recorren los cambios de
+ * 		  numero de cifras y valores aleatorios
+ *
+ * @return ESP_OK si todos coinciden, ESP_FAIL si hay diferencias o
+ * 		   ESP_ERR_INVALID_ARG
+ */
+esp_err_t aqi_json_schema_selftest(uint32_t iterations, aqi_json_bench_t *out);
+
+#endif /* MAIN_AQI_JSON_SCHEMA_H_ */
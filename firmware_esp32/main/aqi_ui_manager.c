@@ -12,6 +12,7 @@
 #include "global_system_signaler.h"
 #include "sensors_type.h"
 #include "alarm_type.h"
+#include "aqi_alarm_manager.h"
 #include "aqi_config_manager.h"
 
 #define USE_BLUFI
@@ -42,6 +43,12 @@ typedef struct
     lv_obj_t* voc_max;
 } voc_widget_data_handler;
 
+// Canal del GSS que alimenta la UI
+#define UI_GSS_CHANNEL_NAME		"gui"
+#define UI_GSS_CHANNEL_DEPTH	6
+
+static GSS_ID ui_gss_channel = GSS_ID_INVALID;
+
 static lv_obj_t* label_temperature = NULL;
 static lv_obj_t* label_humidity = NULL;
 static lv_obj_t* contenedor_alarmas = NULL;
@@ -119,7 +126,7 @@ static void alarm_label_event_cb(lv_event_t * e)
         Alarm_data_ptr associated_alarm_data = (Alarm_data_ptr)lv_obj_get_user_data(obj);
         if (associated_alarm_data)
         {
-            ESP_LOGI(TAG, "Liberando memoria de Alarm_data_t en LV_EVENT_DELETE: %p",
+            ESP_LOGI(TAG, "Liberando referencia a Alarm_data_t en LV_EVENT_DELETE: %p",
             		associated_alarm_data);
             alarm_data_release(associated_alarm_data);
         }
@@ -128,24 +135,7 @@ static void alarm_label_event_cb(lv_event_t * e)
 
 static void update_periodic_ui_data_cb(lv_timer_t * timer)
 {
-	// update room name
-    char* updated_room_name = (char*)calloc(AQI_MAX_ROOM_NAME_SZ, sizeof(char));
-
-    if (updated_room_name != NULL)
-    {
-    	if (aqi_config_manager_get(AQI_CV_ROOM_NAME,
-    			updated_room_name, AQI_MAX_ROOM_NAME_SZ) == ESP_OK)
-    	{
-    		const char* current_text = lv_label_get_text(ui_top_bar_handler.label_room);
-
-    		if (strcmp(current_text, updated_room_name) != 0)
-    		{
-    			lv_label_set_text(ui_top_bar_handler.label_room, updated_room_name);
-    		}
-    	}
-    }
-
-    free(updated_room_name);
+    // el nombre de la room llega con GSS_CONFIG_CHANGED, aqui solo el estado de la red
 
     // update network status icon
 #ifdef USE_BLUFI
@@ -167,6 +157,20 @@ static void update_periodic_ui_data_cb(lv_timer_t * timer)
 // Forward declaration
 static void insert_alarm_row(lv_obj_t* container, const Alarm_data_ptr alarm_data);
 
+/**
+ * Muestra el nombre de la room de la config. Al crear la UI y cuando la
+ * task recibe un GSS_CONFIG_CHANGED con AQI_CV_ROOM_NAME
+ */
+static void update_room_name(void)
+{
+	char room_name[AQI_MAX_ROOM_NAME_SZ];
+
+	if (aqi_config_manager_get(AQI_CV_ROOM_NAME, room_name, sizeof(room_name)) == ESP_OK)
+	{
+		lv_label_set_text(ui_top_bar_handler.label_room, room_name);
+	}
+}
+
 // Task Function
 void aqi_UI_Task (void *pvparameters)
 {
@@ -186,7 +190,7 @@ void aqi_UI_Task (void *pvparameters)
 
 		// EL CODIGO QUE SE BLOQUEA EN LA COLA CORRESPONDIENTE
 		// DEL GRUPO DE COLAS USANDO LAS FUNCIONES DEL GLOBAL_SYSTEM_SIGNALER
-		if (gss_wait_for_signal(GSS_ID_GUI, &recv_msg, portMAX_DELAY) == ESP_OK)
+		if (gss_wait_for_signal(ui_gss_channel, &recv_msg, portMAX_DELAY) == ESP_OK)
 		{
 			ESP_LOGI(TAG, "aqi_UI ME DESBLOQUEO");
 			input_sensors_data = (Sensors_data_ptr)recv_msg.data;
@@ -235,20 +239,29 @@ void aqi_UI_Task (void *pvparameters)
 				else
 				{
 					ESP_LOGI(TAG, "aqi_UI eliminar ALARMA que se desactiva");
-					// Si es una desactivacion de alarma
-					// Solo liberar memoria reservada donde se aloja un Alarm_data_t
-					// si se se desactiva la alarma (lo hace la siguiente funcion),
-					// en este caso hay que liberar tambien
-					// el del incoming_alarm que es un mensaje de desactivacion y
-					// siempre hay que descartarlos
+					// Si es una desactivacion de alarma, el label de la
+					// activacion suelta su referencia al borrarse
 					remove_alarm_row_by_class(contenedor_alarmas, incoming_alarm->alarm_class);
-
-					ESP_LOGI(TAG, "Liberando memoria de msg de desactivacion de alarma en %p",
-							recv_msg.data);
-					gss_release_message(&recv_msg);
 				}
+				aqi_alarm_manager_record_delivery(AQI_ALARM_SINK_UI, incoming_alarm);
+
+				// La alarma es compartida con el resto de canales, el label
+				// que la muestra tiene su propia referencia, se devuelve
+				// siempre la del mensaje
+				gss_release_message(&recv_msg);
 			}
 				break;
+			case GSS_CONFIG_CHANGED:
+				// solo llegan las variables de channel_cfg.config_vars
+				if ((*(const uint32_t *)recv_msg.data & AQI_CV_BIT(AQI_CV_ROOM_NAME)) != 0)
+				{
+					update_room_name();
+				}
+				gss_release_message(&recv_msg);
+				break;
+			default:
+				gss_release_message(&recv_msg);
+				break;
 			}
 		}
 		else
@@ -500,8 +513,9 @@ static void insert_alarm_row(lv_obj_t* container, const Alarm_data_ptr alarm_dat
 	lv_label_set_long_mode(label_alarm, LV_LABEL_LONG_SCROLL_CIRCULAR);
 	lv_obj_set_width(label_alarm, lv_pct(100));
 	lv_label_set_text(label_alarm, alarm_data->info);
-	// Asignar datos de alarma procedentes de gss
-	lv_obj_set_user_data(label_alarm, (void*)alarm_data);
+	// Asignar datos de alarma procedentes de gss, el label mantiene
+	// una referencia propia hasta LV_EVENT_DELETE
+	lv_obj_set_user_data(label_alarm, (void*)alarm_type_retain(alarm_data));
 	// Asignamos callback para liberacion de memoria cuando se elimine realmente
 	// el objeto label
 	lv_obj_add_event_cb(label_alarm, alarm_label_event_cb, LV_EVENT_DELETE, NULL);
@@ -665,13 +679,32 @@ void aqi_ui_init(lv_disp_t *disp)
 	// NOTA: a partir de aqui se pueden crear "alarms rows" con 'insert_alarm_row'
 	// asignando como padre a 'contenedor_alarmas'
 
+	// Registrar el canal del GSS antes de lanzar la task que lo consume
+	gss_channel_config_t channel_cfg = {
+			.name = UI_GSS_CHANNEL_NAME,
+			.depth = UI_GSS_CHANNEL_DEPTH,
+			// la pantalla solo necesita la ultima lectura, nunca una atrasada
+			.policy = GSS_OVERFLOW_OVERWRITE_LATEST,
+			.signals = GSS_SIGNAL_BIT(GSS_SENSORS_DATA_READY) | GSS_SIGNAL_BIT(GSS_ALARM_READY)
+					| GSS_SIGNAL_BIT(GSS_CONFIG_CHANGED),
+			.config_vars = AQI_CV_BIT(AQI_CV_ROOM_NAME),
+	};
+	if (gss_register_channel(&channel_cfg, &ui_gss_channel) != ESP_OK)
+	{
+		ESP_LOGE(TAG, "No se ha podido registrar el canal de la UI en el GSS");
+		return;
+	}
+
+	// con el canal ya registrado: un cambio posterior llega por el GSS
+	update_room_name();
+
 	// Lanzar task
 	if (xTaskCreatePinnedToCore(aqi_UI_Task, "aqi_UI", 4096, NULL, 4, NULL, 1) != pdPASS)
 	{
 		ESP_LOGE(TAG, "No se ha creado la task de la UI");
 	}
 
-	// Crear temporizadores lvgl para tareas periodicas de la UI
+	// Crear temporizadores lvgl para tareas periodicas de la UI (estado de la red)
 	lv_timer_create(update_periodic_ui_data_cb, 5000, NULL);
 }
 
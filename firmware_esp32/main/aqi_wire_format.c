@@ -0,0 +1,120 @@
+/*
+ * aqi_wire_format.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include "aqi_wire_format.h"
+
+// posiciones dentro de un batch
+#define AQI_WIRE_BATCH_COUNT_OFFSET		(AQI_WIRE_HEADER_SIZE + 4)
+
+static void aqi_wire_put_u16(uint8_t *dst, uint16_t value)
+{
+	dst[0] = (uint8_t)(value & 0xFF);
+	dst[1] = (uint8_t)(value >> 8);
+}
+
+static void aqi_wire_put_u32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = (uint8_t)(value & 0xFF);
+	dst[1] = (uint8_t)((value >> 8) & 0xFF);
+	dst[2] = (uint8_t)((value >> 16) & 0xFF);
+	dst[3] = (uint8_t)(value >> 24);
+}
+
+static void aqi_wire_put_header(uint8_t *dst, AQI_WIRE_SCHEMA schema)
+{
+	dst[0] = AQI_WIRE_VERSION;
+	dst[1] = (uint8_t)schema;
+}
+
+/**
+ * Los cuatro valores de una medida, en el orden del formato
+ */
+static void aqi_wire_put_sensors(uint8_t *dst, const Sensors_data_t *sensors_data)
+{
+	aqi_wire_put_u16(&dst[0], sensors_data->relative_humidity);
+	aqi_wire_put_u16(&dst[2], sensors_data->temperature_celsius);
+	aqi_wire_put_u16(&dst[4], sensors_data->voc_raw);
+	aqi_wire_put_u16(&dst[6], sensors_data->voc_index);
+}
+
+esp_err_t aqi_wire_encode_measure(const Sensors_data_t *sensors_data, uint8_t *buffer,
+								size_t size, size_t *out_len)
+{
+	if ((sensors_data == NULL) || (buffer == NULL) || (out_len == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (size < AQI_WIRE_MEASURE_SIZE)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	aqi_wire_put_header(buffer, AQI_WIRE_SCHEMA_MEASURE);
+	aqi_wire_put_sensors(&buffer[AQI_WIRE_HEADER_SIZE], sensors_data);
+	*out_len = AQI_WIRE_MEASURE_SIZE;
+
+	return ESP_OK;
+}
+
+esp_err_t aqi_wire_encode_alarm(const Alarm_data_t *alarm_data, uint8_t *buffer,
+								size_t size, size_t *out_len)
+{
+	if ((alarm_data == NULL) || (buffer == NULL) || (out_len == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (size < AQI_WIRE_ALARM_SIZE)
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	aqi_wire_put_header(buffer, AQI_WIRE_SCHEMA_ALARM);
+	buffer[AQI_WIRE_HEADER_SIZE] = (uint8_t)alarm_data->alarm_class;
+	buffer[AQI_WIRE_HEADER_SIZE + 1] = alarm_data->disable ? AQI_WIRE_ALARM_FLAG_DISABLE : 0;
+	*out_len = AQI_WIRE_ALARM_SIZE;
+
+	return ESP_OK;
+}
+
+esp_err_t aqi_wire_encode_batch_header(uint32_t sent_ms, uint8_t count, uint8_t *buffer,
+								size_t size, size_t *out_len)
+{
+	if ((buffer == NULL) || (out_len == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (size < AQI_WIRE_BATCH_SIZE(count))
+	{
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	aqi_wire_put_header(buffer, AQI_WIRE_SCHEMA_BATCH);
+	aqi_wire_put_u32(&buffer[AQI_WIRE_HEADER_SIZE], sent_ms);
+	buffer[AQI_WIRE_BATCH_COUNT_OFFSET] = count;
+	*out_len = AQI_WIRE_BATCH_HEADER_SIZE;
+
+	return ESP_OK;
+}
+
+esp_err_t aqi_wire_encode_batch_sample(uint8_t index, uint32_t t_ms, const Sensors_data_t *sensors_data,
+								uint8_t *buffer, size_t size, size_t *out_len)
+{
+	if ((sensors_data == NULL) || (buffer == NULL) || (out_len == NULL)
+			|| (size < AQI_WIRE_BATCH_HEADER_SIZE) || (index >= buffer[AQI_WIRE_BATCH_COUNT_OFFSET]))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	// la cabecera ya comprobo que el batch completo cabe
+	uint8_t *dst = &buffer[AQI_WIRE_BATCH_SIZE(index)];
+
+	aqi_wire_put_u32(dst, t_ms);
+	aqi_wire_put_sensors(&dst[4], sensors_data);
+	*out_len = AQI_WIRE_BATCH_SIZE(index + 1);
+
+	return ESP_OK;
+}
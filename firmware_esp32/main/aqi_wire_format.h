@@ -0,0 +1,96 @@
+/*
+ * aqi_wire_format.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Formato binario compacto de medidas y alarmas para MQTT. Todos los
+ *  mensajes empiezan por [version][schema] y los campos van en little
+ *  endian sin padding:
+ *
+ *  AQI_WIRE_SCHEMA_MEASURE (10 bytes)
+ *      u8 version, u8 schema, u16 humidity_rh, u16 temp_celsius,
+ *      u16 voc_raw, u16 voc_index
+ *  AQI_WIRE_SCHEMA_ALARM (4 bytes)
+ *      u8 version, u8 schema, u8 alarm_class, u8 flags (bit0: disable)
+ *  AQI_WIRE_SCHEMA_BATCH (7 + 12 * count bytes)
+ *      u8 version, u8 schema, u32 sent_ms, u8 count,
+ *      count x { u32 t_ms, u16 humidity_rh, u16 temp_celsius,
+ *                u16 voc_raw, u16 voc_index }
+ *
+ *  Los tiempos son milisegundos desde el arranque (esp_timer) truncados
+ *  a 32 bits. El decodificador de referencia esta en test/aqi_wire_decoder.py,
+ *  cualquier cambio de formato debe ir con una nueva version.
+ */
+
+#ifndef MAIN_AQI_WIRE_FORMAT_H_
+#define MAIN_AQI_WIRE_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sensors_type.h"
+#include "alarm_type.h"
+
+#define AQI_WIRE_VERSION				1
+
+#define AQI_WIRE_HEADER_SIZE			2
+#define AQI_WIRE_MEASURE_SIZE			(AQI_WIRE_HEADER_SIZE + 8)
+#define AQI_WIRE_ALARM_SIZE				(AQI_WIRE_HEADER_SIZE + 2)
+#define AQI_WIRE_BATCH_HEADER_SIZE		(AQI_WIRE_HEADER_SIZE + 5)
+#define AQI_WIRE_BATCH_SAMPLE_SIZE		12
+#define AQI_WIRE_BATCH_SIZE(count)		(AQI_WIRE_BATCH_HEADER_SIZE + ((count) * AQI_WIRE_BATCH_SAMPLE_SIZE))
+
+#define AQI_WIRE_ALARM_FLAG_DISABLE		(1u << 0)
+
+typedef enum
+{
+	AQI_WIRE_SCHEMA_MEASURE = 1,
+	AQI_WIRE_SCHEMA_ALARM = 2,
+	AQI_WIRE_SCHEMA_BATCH = 3,
+} AQI_WIRE_SCHEMA;
+
+/**
+ * @brief Codifica una medida
+ *
+ * @param sensors_data	medida a codificar
+ * @param buffer		destino
+ * @param size			tamano del destino
+ * @param[out] out_len	bytes escritos
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG o ESP_ERR_INVALID_SIZE si no cabe
+ */
+esp_err_t aqi_wire_encode_measure(const Sensors_data_t *sensors_data, uint8_t *buffer,
+								size_t size, size_t *out_len);
+
+/**
+ * @brief Codifica una alarma. El texto informativo no se envia, lo
+ * 		  deduce el receptor de la clase de alarma
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG o ESP_ERR_INVALID_SIZE si no cabe
+ */
+esp_err_t aqi_wire_encode_alarm(const Alarm_data_t *alarm_data, uint8_t *buffer,
+								size_t size, size_t *out_len);
+
+/**
+ * @brief Escribe la cabecera de un batch de 'count' muestras. Las muestras
+ * 		  se anaden despues con aqi_wire_encode_batch_sample
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG o ESP_ERR_INVALID_SIZE si el batch
+ * 		   completo no cabe en el buffer
+ */
+esp_err_t aqi_wire_encode_batch_header(uint32_t sent_ms, uint8_t count, uint8_t *buffer,
+								size_t size, size_t *out_len);
+
+/**
+ * @brief Escribe la muestra 'index' de un batch cuya cabecera ya esta
+ * 		  en el buffer
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG si index no es valido para el batch
+ */
+esp_err_t aqi_wire_encode_batch_sample(uint8_t index, uint32_t t_ms, const Sensors_data_t *sensors_data,
+								uint8_t *buffer, size_t size, size_t *out_len);
+
+#endif /* MAIN_AQI_WIRE_FORMAT_H_ */
@@ -7,167 +7,976 @@
 
 #include "global_system_signaler.h"
 
+#include <string.h>
+#include <stdatomic.h>
+
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 
 static const char * TAG = "GSS";
 
-static QueueHandle_t channels[GSS_MAX_CHANNELS];
-static uint8_t channels_size[] = {
-		GSS_MQTT_SENDER_QUEUE_LENGTH,
-		GSS_GUI_QUEUE_LENGTH
+#define GSS_SENSORS_RING_MASK	(GSS_SENSORS_RING_LENGTH - 1)
+
+_Static_assert((GSS_SENSORS_RING_LENGTH & GSS_SENSORS_RING_MASK) == 0,
+		"GSS_SENSORS_RING_LENGTH must be power of two");
+_Static_assert(GSS_MAX_CHANNELS <= 32, "subscribers mask is 32 bits wide");
+
+/*
+ * Ring de datos de sensores: un productor (sensors service) y un cursor de
+ * lectura por canal. Cada slot guarda el numero de secuencia de la muestra
+ * que contiene, el lector lo comprueba antes y despues de copiar para
+ * detectar que el productor lo ha sobrescrito mientras tanto.
+ */
+typedef struct
+{
+	atomic_uint_fast32_t seq;
+	int64_t published_us;
+	Sensors_data_t data;
+} gss_ring_slot_t;
+
+static gss_ring_slot_t sensors_ring[GSS_SENSORS_RING_LENGTH];
+// secuencia de la proxima muestra a publicar
+static atomic_uint_fast32_t sensors_ring_head;
+
+/*
+ * Elemento de la lane de prioridad, con el instante de envio para medir
+ * cuanto espera el mensaje
+ */
+typedef struct
+{
+	GSS_Message msg;
+	int64_t enqueued_us;
+} gss_lane_item_t;
+
+typedef struct
+{
+	bool in_use;
+	const char *name;
+	uint8_t depth;
+	GSS_OVERFLOW_POLICY policy;
+	uint32_t signals;			// mascara de suscripciones
+	QueueHandle_t priority_lane;	// alarmas, rollups y cambios de config, se leen antes que el ring
+	SemaphoreHandle_t doorbell;	// despierta al consumidor, puede ir en un queue set
+	atomic_bool wake_requested;	// gss_wake_channel: la espera vuelve sin mensaje
+	// lectura del ring, solo la modifica la tarea consumidora
+	uint32_t cursor;			// secuencia de la proxima muestra a leer
+	uint32_t received;
+	uint32_t dropped;
+	uint32_t superseded;
+	gss_sensors_record_t record;	// copia entregada en GSS_Message.data
+	// cambios de config: los productores acumulan en config_pending y solo
+	// encolan un aviso si no hay otro en la lane (config_queued)
+	uint32_t config_vars;		// variables que interesan al canal
+	atomic_uint config_pending;
+	atomic_bool config_queued;
+	uint32_t config_changed;	// mascara entregada en GSS_Message.data
+	// telemetria, lane_* las actualizan los productores con channels_lock
+	uint32_t lane_sent;
+	uint32_t lane_dropped;
+	uint8_t lane_peak;
+	uint8_t backlog_peak;
+	uint32_t dwell_max_us;
+	uint32_t dwell_hist[GSS_DWELL_HIST_BUCKETS];
+} gss_channel_t;
+
+static gss_channel_t channels[GSS_MAX_CHANNELS];
+// por cada tipo de senal, mascara de canales suscritos
+static uint32_t subscribers[GSS_SIGNAL_MAX];
+static portMUX_TYPE channels_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * Como se retiene y libera el payload de cada tipo de senal. NULL si el
+ * dato no es compartido (pertenece al canal)
+ */
+typedef void (*gss_payload_retain_fn)(void *data);
+typedef void (*gss_payload_release_fn)(void *data);
+
+static void gss_alarm_payload_retain(void *data)
+{
+	alarm_type_retain((Alarm_data_ptr)data);
+}
+
+static void gss_alarm_payload_release(void *data)
+{
+	alarm_data_release((Alarm_data_ptr)data);
+}
+
+static void gss_rollup_payload_retain(void *data)
+{
+	sensors_rollup_retain((Sensors_rollup_ptr)data);
+}
+
+static void gss_rollup_payload_release(void *data)
+{
+	sensors_rollup_release((Sensors_rollup_ptr)data);
+}
+
+static const gss_payload_retain_fn payload_retain[GSS_SIGNAL_MAX] = {
+		[GSS_SENSORS_DATA_READY] = NULL,
+		[GSS_ALARM_READY] = gss_alarm_payload_retain,
+		[GSS_ROLLUP_READY] = gss_rollup_payload_retain,
+		[GSS_CONFIG_CHANGED] = NULL,
+};
+
+static const gss_payload_release_fn payload_release[GSS_SIGNAL_MAX] = {
+		[GSS_SENSORS_DATA_READY] = NULL,
+		[GSS_ALARM_READY] = gss_alarm_payload_release,
+		[GSS_ROLLUP_READY] = gss_rollup_payload_release,
+		[GSS_CONFIG_CHANGED] = NULL,
 };
 
+
+static bool gss_is_valid_id(GSS_ID id)
+{
+	return ((id >= 0) && (id < GSS_MAX_CHANNELS) && channels[id].in_use);
+}
+
+static uint32_t gss_get_subscribers(GSS_SIGNAL signal)
+{
+	uint32_t mask;
+
+	portENTER_CRITICAL(&channels_lock);
+	mask = subscribers[signal];
+	portEXIT_CRITICAL(&channels_lock);
+
+	return mask;
+}
+
+/**
+ * Despierta al consumidor del canal. El doorbell es binario, varias
+ * notificaciones seguidas se agrupan en una
+ */
+static void gss_ring_doorbell(GSS_ID id)
+{
+	xSemaphoreGive(channels[id].doorbell);
+}
+
 esp_err_t gss_initialize()
 {
-	/* queue creation and checking for each data channel */
+	/* slots vacios: ninguna secuencia valida */
+	for (int slot = 0; slot < GSS_SENSORS_RING_LENGTH; ++slot)
+	{
+		atomic_store(&sensors_ring[slot].seq, UINT32_MAX);
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t gss_register_channel(const gss_channel_config_t *config, GSS_ID *out_id)
+{
+	GSS_ID id = GSS_ID_INVALID;
+	QueueHandle_t priority_lane;
+	SemaphoreHandle_t doorbell;
+
+	if ((config == NULL) || (out_id == NULL) || (config->name == NULL)
+			|| (config->depth == 0) || (config->depth > GSS_MAX_CHANNEL_DEPTH)
+			|| (config->policy >= GSS_OVERFLOW_MAX))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if (gss_find_channel(config->name) != GSS_ID_INVALID)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	// la profundidad del canal solo limita las muestras pendientes, la
+	// lane tiene tamano fijo para que una rafaga de muestras no la afecte
+	priority_lane = xQueueCreate(GSS_PRIORITY_LANE_LENGTH, sizeof(gss_lane_item_t));
+	doorbell = xSemaphoreCreateBinary();
+	if ((priority_lane == NULL) || (doorbell == NULL))
+	{
+		ESP_LOGE(TAG, "Not enough heap available for data channel creation");
+		if (priority_lane != NULL) vQueueDelete(priority_lane);
+		if (doorbell != NULL) vSemaphoreDelete(doorbell);
+		return ESP_ERR_NO_MEM;
+	}
+
+	portENTER_CRITICAL(&channels_lock);
 	for (int ch = 0; ch < GSS_MAX_CHANNELS; ++ch)
 	{
-		if (channels[ch] == NULL)
+		if (!channels[ch].in_use)
 		{
-			// create each queue only one time
-			channels[ch] = xQueueCreate(channels_size[ch],
-							sizeof(GSS_Message));
-			if (channels[ch] == NULL)
-			{
-				ESP_LOGE(TAG, "Not enough heap available for data channel creation");
-				return ESP_FAIL;
-			}
+			id = (GSS_ID)ch;
+			memset(&channels[ch], 0, sizeof(channels[ch]));
+			channels[ch].name = config->name;
+			channels[ch].depth = config->depth;
+			channels[ch].policy = config->policy;
+			channels[ch].config_vars = config->config_vars;
+			channels[ch].priority_lane = priority_lane;
+			channels[ch].doorbell = doorbell;
+			channels[ch].in_use = true;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&channels_lock);
+
+	if (id == GSS_ID_INVALID)
+	{
+		ESP_LOGE(TAG, "No free channels for %s", config->name);
+		vQueueDelete(priority_lane);
+		vSemaphoreDelete(doorbell);
+		return ESP_ERR_NO_MEM;
+	}
+
+	for (int s = 0; s < GSS_SIGNAL_MAX; ++s)
+	{
+		if ((config->signals & GSS_SIGNAL_BIT(s)) != 0)
+		{
+			gss_subscribe(id, (GSS_SIGNAL)s);
 		}
 	}
 
+	ESP_LOGI(TAG, "Channel %s registered with id %d, depth %u", config->name, id, config->depth);
+	*out_id = id;
+
 	return ESP_OK;
 }
 
-esp_err_t  gss_wait_for_signal(GSS_ID id, GSS_Message* recv_msg, const TickType_t xTicksToWait)
+GSS_ID gss_find_channel(const char *name)
 {
-	esp_err_t ret = ESP_ERR_TIMEOUT;
-	BaseType_t waiting_ret = errQUEUE_EMPTY;
+	GSS_ID id = GSS_ID_INVALID;
 
-	switch (id)
+	if (name == NULL)
 	{
-	case GSS_ID_MQTT_SENDER:
-		waiting_ret = xQueueReceive(channels[GSS_ID_MQTT_SENDER], (void *) recv_msg, xTicksToWait);
-		break;
-	case GSS_ID_GUI:
-		waiting_ret = xQueueReceive(channels[GSS_ID_GUI], (void *) recv_msg, xTicksToWait);
-		break;
+		return id;
 	}
 
-	ret = waiting_ret == pdPASS ? ESP_OK : ret;
+	portENTER_CRITICAL(&channels_lock);
+	for (int ch = 0; ch < GSS_MAX_CHANNELS; ++ch)
+	{
+		if (channels[ch].in_use && (strcmp(channels[ch].name, name) == 0))
+		{
+			id = (GSS_ID)ch;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&channels_lock);
 
-	return ret;
+	return id;
 }
 
-esp_err_t gss_send_sensors_data(Sensors_data_ptr sensors_data, GSS_ID target)
+esp_err_t gss_subscribe(GSS_ID id, GSS_SIGNAL signal)
 {
-	esp_err_t ret = ESP_FAIL;
-	BaseType_t send_ret = errQUEUE_FULL;
+	if (!gss_is_valid_id(id) || (signal >= GSS_SIGNAL_MAX))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	portENTER_CRITICAL(&channels_lock);
+	if ((channels[id].signals & GSS_SIGNAL_BIT(signal)) == 0)
+	{
+		channels[id].signals |= GSS_SIGNAL_BIT(signal);
+		subscribers[signal] |= (1u << id);
+		if (signal == GSS_SENSORS_DATA_READY)
+		{
+			// se reciben las muestras publicadas a partir de ahora
+			channels[id].cursor = atomic_load(&sensors_ring_head);
+		}
+	}
+	portEXIT_CRITICAL(&channels_lock);
 
-	GSS_Message buffer;
-	buffer.signal = GSS_SENSORS_DATA_READY;
-	buffer.data = (void*) sensors_data;
+	return ESP_OK;
+}
 
-	if (sensors_data == NULL)
+esp_err_t gss_unsubscribe(GSS_ID id, GSS_SIGNAL signal)
+{
+	if (!gss_is_valid_id(id) || (signal >= GSS_SIGNAL_MAX))
 	{
-		ret = ESP_ERR_INVALID_ARG;
+		return ESP_ERR_INVALID_ARG;
 	}
-	else
+
+	portENTER_CRITICAL(&channels_lock);
+	channels[id].signals &= ~GSS_SIGNAL_BIT(signal);
+	subscribers[signal] &= ~(1u << id);
+	portEXIT_CRITICAL(&channels_lock);
+
+	return ESP_OK;
+}
+
+const char* gss_channel_name(GSS_ID id)
+{
+	return gss_is_valid_id(id) ? channels[id].name : "UNKNOWN_CHANNEL";
+}
+
+static void gss_record_merge(gss_sensors_record_t *record, const Sensors_data_t *sample)
+{
+#define GSS_MERGE_FIELD(field) \
+	do { \
+		if (sample->field < record->min.field) record->min.field = sample->field; \
+		if (sample->field > record->max.field) record->max.field = sample->field; \
+	} while (0)
+
+	GSS_MERGE_FIELD(voc_raw);
+	GSS_MERGE_FIELD(voc_index);
+	GSS_MERGE_FIELD(temperature_celsius);
+	GSS_MERGE_FIELD(relative_humidity);
+
+#undef GSS_MERGE_FIELD
+
+	record->last = *sample;
+	record->count++;
+}
+
+/**
+ * Anota en el histograma del canal lo que ha esperado un mensaje desde
+ * su envio. Solo la llama la tarea consumidora del canal
+ */
+static void gss_record_dwell(gss_channel_t *ch, int64_t sent_us)
+{
+	int64_t elapsed = esp_timer_get_time() - sent_us;
+	uint32_t dwell_us = (elapsed < 0) ? 0 : ((elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed);
+	int bucket = 0;
+
+	if ((dwell_us >> GSS_DWELL_HIST_BASE_SHIFT) != 0)
+	{
+		// bits significativos por encima de la base: log2 del intervalo
+		bucket = (32 - __builtin_clz(dwell_us)) - GSS_DWELL_HIST_BASE_SHIFT;
+		if (bucket >= GSS_DWELL_HIST_BUCKETS)
+		{
+			bucket = GSS_DWELL_HIST_BUCKETS - 1;
+		}
+	}
+
+	ch->dwell_hist[bucket]++;
+	if (dwell_us > ch->dwell_max_us)
+	{
+		ch->dwell_max_us = dwell_us;
+	}
+}
+
+/**
+ * Copia la muestra con secuencia 'seq' del ring.
+ *
+ * @return false si el productor la ha sobrescrito antes o durante la copia
+ */
+static bool gss_ring_copy(uint32_t seq, Sensors_data_t *out, int64_t *published_us)
+{
+	gss_ring_slot_t *slot = &sensors_ring[seq & GSS_SENSORS_RING_MASK];
+	uint32_t seq_before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	Sensors_data_t copy = slot->data;
+	int64_t copy_us = slot->published_us;
+	atomic_thread_fence(memory_order_acquire);
+	uint32_t seq_after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+	if ((seq_before == seq) && (seq_after == seq))
 	{
-		switch (target)
+		*out = copy;
+		*published_us = copy_us;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Muestras pendientes que admite el canal segun su politica, las que
+ * pasen de ahi se sustituyen (buzon) o se pierden al leer el ring
+ */
+static uint32_t gss_backlog_limit(const gss_channel_t *ch)
+{
+	switch (ch->policy)
+	{
+	case GSS_OVERFLOW_OVERWRITE_LATEST:
+		return 1;
+	case GSS_OVERFLOW_COALESCE:
+		return GSS_SENSORS_RING_LENGTH;
+	case GSS_OVERFLOW_DROP_OLDEST:
+	default:
+		return ch->depth;
+	}
+}
+
+/**
+ * Lee del ring lo que corresponda al canal segun su politica. Solo la
+ * llama la tarea consumidora del canal, que es la unica que modifica su
+ * cursor.
+ *
+ * @return true si se ha dejado un registro en ch->record
+ */
+static bool gss_ring_read(gss_channel_t *ch)
+{
+	Sensors_data_t sample;
+	int64_t published_us;
+	int64_t oldest_us = 0;
+	uint32_t backlog_limit = gss_backlog_limit(ch);
+	bool have_record = false;
+
+	if ((ch->signals & GSS_SIGNAL_BIT(GSS_SENSORS_DATA_READY)) == 0)
+	{
+		return false;
+	}
+
+	uint32_t head = atomic_load_explicit(&sensors_ring_head, memory_order_acquire);
+
+	if ((head - ch->cursor) > ch->backlog_peak)
+	{
+		ch->backlog_peak = ((head - ch->cursor) > UINT8_MAX) ? UINT8_MAX : (uint8_t)(head - ch->cursor);
+	}
+
+	while (ch->cursor != head)
+	{
+		uint32_t backlog = head - ch->cursor;
+
+		// mas muestras pendientes de las que admite el canal: en el buzon se
+		// sustituyen por la mas reciente, en el resto se han perdido
+		if (backlog > backlog_limit)
 		{
-		case GSS_ID_MQTT_SENDER:
-			if (channels[GSS_ID_MQTT_SENDER] != NULL)
+			if (ch->policy == GSS_OVERFLOW_OVERWRITE_LATEST)
 			{
-				send_ret = xQueueSend(channels[GSS_ID_MQTT_SENDER], &buffer, 0);
+				ch->superseded += backlog - backlog_limit;
 			}
 			else
 			{
-				ret = ESP_ERR_INVALID_ARG;
+				ch->dropped += backlog - backlog_limit;
 			}
-			break;
-		case GSS_ID_GUI:
-			if (channels[GSS_ID_GUI] != NULL)
+			ch->cursor = head - backlog_limit;
+		}
+
+		if (gss_ring_copy(ch->cursor, &sample, &published_us))
+		{
+			if (!have_record)
 			{
-				send_ret = xQueueSend(channels[GSS_ID_GUI], &buffer, 0);
+				// la espera del registro es la de su muestra mas antigua
+				oldest_us = published_us;
+				ch->record.last = sample;
+				ch->record.min = sample;
+				ch->record.max = sample;
+				ch->record.count = 1;
+				have_record = true;
 			}
 			else
 			{
-				ret = ESP_ERR_INVALID_ARG;
+				// solo en COALESCE se llega con un registro ya empezado
+				gss_record_merge(&ch->record, &sample);
+				ch->superseded++;
+			}
+			ch->record.published_us = published_us;
+			ch->cursor++;
+
+			if (ch->policy != GSS_OVERFLOW_COALESCE)
+			{
+				break;
 			}
-			break;
-		default:
-			ret = ESP_ERR_INVALID_ARG;
 		}
+		else
+		{
+			// sobrescrito durante la copia: el productor esta escribiendo
+			// la muestra cursor + LENGTH en este slot, esta se pierde
+			ch->dropped++;
+			ch->cursor++;
+		}
+
+		head = atomic_load_explicit(&sensors_ring_head, memory_order_acquire);
+	}
 
-		if (ret != ESP_ERR_INVALID_ARG)
+	if (have_record)
+	{
+		ch->received++;
+		gss_record_dwell(ch, oldest_us);
+	}
+
+	return have_record;
+}
+
+/**
+ * Intenta obtener un mensaje de la lane de prioridad del canal sin bloquear
+ */
+static bool gss_try_receive_priority(GSS_ID id, GSS_Message* recv_msg)
+{
+	gss_channel_t *ch = &channels[id];
+	gss_lane_item_t item;
+
+	while (xQueueReceive(ch->priority_lane, (void *) &item, 0) == pdPASS)
+	{
+		gss_record_dwell(ch, item.enqueued_us);
+		*recv_msg = item.msg;
+
+		if (item.msg.signal != GSS_CONFIG_CHANGED)
+		{
+			return true;
+		}
+
+		// a partir de aqui un cambio nuevo encola otro aviso, ninguno se pierde
+		atomic_store(&ch->config_queued, false);
+		ch->config_changed = atomic_exchange(&ch->config_pending, 0);
+		// vacio si un aviso anterior ya entrego estos cambios
+		if (ch->config_changed != 0)
 		{
-			ret = (send_ret == pdPASS) ? ESP_OK : ESP_ERR_NO_MEM;
+			recv_msg->data = (void*) &ch->config_changed;
+			return true;
 		}
 	}
 
-	return ret;
+	return false;
 }
 
-esp_err_t gss_send_alarm_data(Alarm_data_ptr alarm_data, GSS_ID target)
+/**
+ * Intenta obtener datos de sensores para el canal sin bloquear
+ */
+static bool gss_try_receive_sensors(GSS_ID id, GSS_Message* recv_msg)
 {
-	esp_err_t ret = ESP_FAIL;
-	BaseType_t send_ret = errQUEUE_FULL;
+	gss_channel_t *ch = &channels[id];
 
-	GSS_Message buffer;
-	buffer.signal = GSS_ALARM_READY;  // Usamos el valor correcto del enum GSS_SIGNAL
-	buffer.data = (void*) alarm_data;
+	if (gss_ring_read(ch))
+	{
+		recv_msg->signal = GSS_SENSORS_DATA_READY;
+		recv_msg->data = (void*) &ch->record;
+		return true;
+	}
 
-	if (alarm_data == NULL)
+	return false;
+}
+
+/**
+ * Intenta obtener un mensaje del canal sin bloquear, las alarmas primero
+ */
+static bool gss_try_receive(GSS_ID id, GSS_Message* recv_msg)
+{
+	return (gss_try_receive_priority(id, recv_msg) || gss_try_receive_sensors(id, recv_msg));
+}
+
+/**
+ * Ticks que quedan de espera, portMAX_DELAY es infinito
+ */
+static bool gss_remaining_ticks(TickType_t start, TickType_t xTicksToWait, TickType_t *remaining)
+{
+	if (xTicksToWait == portMAX_DELAY)
 	{
-		ret = ESP_ERR_INVALID_ARG;
+		*remaining = portMAX_DELAY;
+		return true;
 	}
-	else
+
+	TickType_t elapsed = xTaskGetTickCount() - start;
+
+	if (elapsed >= xTicksToWait)
 	{
-		switch (target)
+		return false;
+	}
+	*remaining = xTicksToWait - elapsed;
+
+	return true;
+}
+
+esp_err_t  gss_wait_for_signal(GSS_ID id, GSS_Message* recv_msg, const TickType_t xTicksToWait)
+{
+	TickType_t start = xTaskGetTickCount();
+	TickType_t remaining = xTicksToWait;
+
+	if (!gss_is_valid_id(id) || (recv_msg == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	while (1)
+	{
+		if (gss_try_receive(id, recv_msg))
 		{
-		case GSS_ID_MQTT_SENDER:
-			if (channels[GSS_ID_MQTT_SENDER] != NULL)
-			{
-				send_ret = xQueueSend(channels[GSS_ID_MQTT_SENDER], &buffer, 0);
-			}
-			else
-			{
-				ret = ESP_ERR_INVALID_ARG;
-			}
-			break;
-		case GSS_ID_GUI:
-			if (channels[GSS_ID_GUI] != NULL)
+			return ESP_OK;
+		}
+
+		if (!gss_remaining_ticks(start, xTicksToWait, &remaining))
+		{
+			return ESP_ERR_TIMEOUT;
+		}
+
+		// dormir hasta que se publique algo en el canal
+		(void)xSemaphoreTake(channels[id].doorbell, remaining);
+
+		if (atomic_exchange(&channels[id].wake_requested, false))
+		{
+			return ESP_ERR_TIMEOUT;
+		}
+	}
+}
+
+esp_err_t gss_channel_set_create(const GSS_ID *ids, uint8_t count, gss_channel_set_t *set)
+{
+	if ((ids == NULL) || (set == NULL) || (count == 0) || (count > GSS_MAX_CHANNELS))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (!gss_is_valid_id(ids[i]))
+		{
+			return ESP_ERR_INVALID_ARG;
+		}
+	}
+
+	// cada doorbell binario aporta como mucho un evento al set
+	set->queue_set = xQueueCreateSet(count);
+	if (set->queue_set == NULL)
+	{
+		return ESP_ERR_NO_MEM;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		// un miembro debe estar vacio al anadirse al set, lo pendiente
+		// se recoge igualmente porque la espera sondea los canales antes
+		(void)xSemaphoreTake(channels[ids[i]].doorbell, 0);
+		if (xQueueAddToSet(channels[ids[i]].doorbell, set->queue_set) != pdPASS)
+		{
+			ESP_LOGE(TAG, "Channel %s could not be added to the set", channels[ids[i]].name);
+			return ESP_FAIL;
+		}
+		set->ids[i] = ids[i];
+	}
+	set->count = count;
+
+	return ESP_OK;
+}
+
+esp_err_t gss_wait_for_signal_any(gss_channel_set_t *set, GSS_ID *from,
+								GSS_Message* recv_msg, const TickType_t xTicksToWait)
+{
+	TickType_t start = xTaskGetTickCount();
+	TickType_t remaining = xTicksToWait;
+
+	if ((set == NULL) || (set->queue_set == NULL) || (recv_msg == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	while (1)
+	{
+		// sondear en orden los canales del set, primero todas las lanes
+		// de prioridad y despues los datos de sensores
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (int i = 0; i < set->count; ++i)
 			{
-				send_ret = xQueueSend(channels[GSS_ID_GUI], &buffer, 0);
+				bool received = (pass == 0) ? gss_try_receive_priority(set->ids[i], recv_msg)
+											: gss_try_receive_sensors(set->ids[i], recv_msg);
+				if (received)
+				{
+					if (from != NULL)
+					{
+						*from = set->ids[i];
+					}
+					return ESP_OK;
+				}
 			}
-			else
+		}
+
+		if (!gss_remaining_ticks(start, xTicksToWait, &remaining))
+		{
+			return ESP_ERR_TIMEOUT;
+		}
+
+		QueueSetMemberHandle_t member = xQueueSelectFromSet(set->queue_set, remaining);
+		if (member != NULL)
+		{
+			// consumir el evento del doorbell, el mensaje se lee al sondear
+			(void)xSemaphoreTake((SemaphoreHandle_t)member, 0);
+		}
+
+		for (int i = 0; i < set->count; ++i)
+		{
+			if (atomic_exchange(&channels[set->ids[i]].wake_requested, false))
 			{
-				ret = ESP_ERR_INVALID_ARG;
+				return ESP_ERR_TIMEOUT;
 			}
-			break;
-		default:
-			ret = ESP_ERR_INVALID_ARG;
 		}
+	}
+}
+
+esp_err_t gss_wake_channel(GSS_ID id)
+{
+	if (!gss_is_valid_id(id))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	// el aviso se guarda aunque el consumidor no este esperando, su
+	// siguiente espera sin mensajes vuelve en cuanto toma el doorbell
+	atomic_store(&channels[id].wake_requested, true);
+	gss_ring_doorbell(id);
+
+	return ESP_OK;
+}
+
+esp_err_t gss_publish_sensors_data(const Sensors_data_t *sensors_data)
+{
+	if (sensors_data == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	uint32_t seq = atomic_load_explicit(&sensors_ring_head, memory_order_relaxed);
+	gss_ring_slot_t *slot = &sensors_ring[seq & GSS_SENSORS_RING_MASK];
 
-		if (ret != ESP_ERR_INVALID_ARG)
+	// invalidar el slot mientras se escribe para que un lector no lo acepte
+	atomic_store_explicit(&slot->seq, UINT32_MAX, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->data = *sensors_data;
+	slot->published_us = esp_timer_get_time();
+	atomic_store_explicit(&slot->seq, seq, memory_order_release);
+	atomic_store_explicit(&sensors_ring_head, seq + 1, memory_order_release);
+
+	uint32_t targets = gss_get_subscribers(GSS_SENSORS_DATA_READY);
+	for (GSS_ID ch = 0; targets != 0; ++ch, targets >>= 1)
+	{
+		if ((targets & 1u) != 0)
+		{
+			gss_ring_doorbell(ch);
+		}
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t gss_get_sensors_ring_stats(GSS_ID id, gss_ring_stats_t *out)
+{
+	if (!gss_is_valid_id(id) || (out == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	uint32_t head = atomic_load_explicit(&sensors_ring_head, memory_order_acquire);
+	gss_channel_t *ch = &channels[id];
+
+	out->published = head;
+	out->received = ch->received;
+	out->dropped = ch->dropped;
+	out->superseded = ch->superseded;
+	// muestras que el consumidor aun no ha leido pero ya pasan del limite
+	// del canal, con el mismo criterio que gss_ring_read
+	uint32_t backlog_limit = gss_backlog_limit(ch);
+	if ((ch->signals & GSS_SIGNAL_BIT(GSS_SENSORS_DATA_READY))
+			&& ((head - ch->cursor) > backlog_limit))
+	{
+		if (ch->policy == GSS_OVERFLOW_OVERWRITE_LATEST)
 		{
-			ret = (send_ret == pdPASS) ? ESP_OK : ESP_ERR_NO_MEM;
+			out->superseded += (head - ch->cursor) - backlog_limit;
+		}
+		else
+		{
+			out->dropped += (head - ch->cursor) - backlog_limit;
 		}
 	}
 
+	return ESP_OK;
+}
+
+esp_err_t gss_get_channel_stats(GSS_ID id, gss_channel_stats_t *out)
+{
+	esp_err_t ret = gss_get_sensors_ring_stats(id, (out != NULL) ? &out->ring : NULL);
+
+	if (ret != ESP_OK)
+	{
+		return ret;
+	}
+
+	gss_channel_t *ch = &channels[id];
+
+	portENTER_CRITICAL(&channels_lock);
+	out->alarms_sent = ch->lane_sent;
+	out->alarms_dropped = ch->lane_dropped;
+	out->lane_peak = ch->lane_peak;
+	portEXIT_CRITICAL(&channels_lock);
+
+	// los escribe la tarea consumidora, una copia algo desfasada es aceptable
+	out->backlog_peak = ch->backlog_peak;
+	out->dwell_max_us = ch->dwell_max_us;
+	memcpy(out->dwell_hist, ch->dwell_hist, sizeof(out->dwell_hist));
+
+	return ESP_OK;
+}
+
+/**
+ * Encola un payload compartido en la lane de prioridad de un canal. El canal
+ * toma su propia referencia, que se devuelve si no se puede encolar.
+ * GSS_CONFIG_CHANGED no lleva payload, los cambios estan en el canal
+ */
+static esp_err_t gss_lane_send(GSS_SIGNAL signal, void *data, GSS_ID target)
+{
+	esp_err_t ret = ESP_FAIL;
+
+	gss_lane_item_t buffer;
+	buffer.msg.signal = signal;
+	buffer.msg.data = data;
+
+	if (!gss_is_valid_id(target) || (signal == GSS_SENSORS_DATA_READY) || (signal >= GSS_SIGNAL_MAX)
+			|| ((data == NULL) != (payload_retain[signal] == NULL)))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if (data != NULL)
+	{
+		payload_retain[signal](data);
+	}
+
+	buffer.enqueued_us = esp_timer_get_time();
+	if (xQueueSend(channels[target].priority_lane, &buffer, 0) == pdPASS)
+	{
+		UBaseType_t waiting = uxQueueMessagesWaiting(channels[target].priority_lane);
+
+		portENTER_CRITICAL(&channels_lock);
+		channels[target].lane_sent++;
+		if (waiting > channels[target].lane_peak)
+		{
+			channels[target].lane_peak = (uint8_t)waiting;
+		}
+		portEXIT_CRITICAL(&channels_lock);
+
+		gss_ring_doorbell(target);
+		ret = ESP_OK;
+	}
+	else
+	{
+		portENTER_CRITICAL(&channels_lock);
+		channels[target].lane_dropped++;
+		portEXIT_CRITICAL(&channels_lock);
+
+		if (data != NULL)
+		{
+			payload_release[signal](data);
+		}
+		ret = ESP_ERR_NO_MEM;
+	}
+
 	return ret;
 }
 
+esp_err_t gss_send_alarm_data(Alarm_data_ptr alarm_data, GSS_ID target)
+{
+	return gss_lane_send(GSS_ALARM_READY, (void*) alarm_data, target);
+}
+
+esp_err_t gss_broadcast_alarm_data(Alarm_data_ptr alarm_data, uint8_t *delivered)
+{
+	uint8_t sent = 0;
+	uint32_t targets;
+
+	if (alarm_data == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	targets = gss_get_subscribers(GSS_ALARM_READY);
+	for (GSS_ID ch = 0; targets != 0; ++ch, targets >>= 1)
+	{
+		if ((targets & 1u) == 0)
+		{
+			continue;
+		}
+
+		if (gss_send_alarm_data(alarm_data, ch) == ESP_OK)
+		{
+			sent++;
+		}
+		else
+		{
+			ESP_LOGW(TAG, "Lane de prioridad de %s llena, alarma no entregada", channels[ch].name);
+		}
+	}
+
+	if (delivered != NULL)
+	{
+		*delivered = sent;
+	}
+
+	return (sent > 0) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t gss_broadcast_rollup_data(Sensors_rollup_ptr rollup, uint8_t *delivered)
+{
+	uint8_t sent = 0;
+	uint8_t failed = 0;
+	uint32_t targets;
+
+	if (rollup == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	targets = gss_get_subscribers(GSS_ROLLUP_READY);
+	for (GSS_ID ch = 0; targets != 0; ++ch, targets >>= 1)
+	{
+		if ((targets & 1u) == 0)
+		{
+			continue;
+		}
+
+		if (gss_lane_send(GSS_ROLLUP_READY, (void*) rollup, ch) == ESP_OK)
+		{
+			sent++;
+		}
+		else
+		{
+			failed++;
+			ESP_LOGW(TAG, "Lane de prioridad de %s llena, rollup no entregado", channels[ch].name);
+		}
+	}
+
+	if (delivered != NULL)
+	{
+		*delivered = sent;
+	}
+
+	// sin suscriptores no es un error, la agregacion sigue activa
+	return ((sent > 0) || (failed == 0)) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t gss_broadcast_config_changed(uint32_t changed, uint8_t *delivered)
+{
+	uint8_t sent = 0;
+	uint8_t failed = 0;
+	uint32_t targets;
+
+	targets = gss_get_subscribers(GSS_CONFIG_CHANGED);
+	for (GSS_ID ch = 0; targets != 0; ++ch, targets >>= 1)
+	{
+		uint32_t vars = changed & channels[ch].config_vars;
+
+		if (((targets & 1u) == 0) || (vars == 0))
+		{
+			continue;
+		}
+
+		atomic_fetch_or(&channels[ch].config_pending, vars);
+
+		// ya hay un aviso en la lane, entregara tambien estos cambios
+		if (atomic_exchange(&channels[ch].config_queued, true))
+		{
+			sent++;
+			continue;
+		}
+
+		if (gss_lane_send(GSS_CONFIG_CHANGED, NULL, ch) == ESP_OK)
+		{
+			sent++;
+		}
+		else
+		{
+			// los cambios quedan pendientes para el siguiente aviso
+			atomic_store(&channels[ch].config_queued, false);
+			failed++;
+			ESP_LOGW(TAG, "Lane de prioridad de %s llena, cambio de config pendiente", channels[ch].name);
+		}
+	}
+
+	if (delivered != NULL)
+	{
+		*delivered = sent;
+	}
+
+	return (failed == 0) ? ESP_OK : ESP_ERR_NO_MEM;
+}
 
 void gss_release_message(GSS_Message* msg)
 {
 	assert(msg != NULL);
 
-	if (msg->data != NULL)
+	if ((msg->data != NULL) && (msg->signal < GSS_SIGNAL_MAX)
+			&& (payload_release[msg->signal] != NULL))
 	{
-		free(msg->data);
-		msg->data = NULL;
+		payload_release[msg->signal](msg->data);
 	}
+	msg->data = NULL;
 }
-
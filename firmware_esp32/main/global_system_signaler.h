@@ -11,30 +11,68 @@
 /* FreeRTOS includes. */
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 /* Data types includes */
 #include "sensors_type.h"
 #include "alarm_type.h"
+#include "sensors_rollup.h"
 
-/* Define the lengths of the IPCs */
-#define GSS_MQTT_SENDER_QUEUE_LENGTH	6
-#define GSS_GUI_QUEUE_LENGTH			6
+/* Number of slots of the sensors data ring (must be power of two) */
+#define GSS_SENSORS_RING_LENGTH			8
 
-/* Number of channels */
-#define GSS_MAX_CHANNELS	2
+/* Maximum number of channels that can be registered */
+#define GSS_MAX_CHANNELS	4
 
-typedef enum
-{
-	GSS_ID_MQTT_SENDER,
-	GSS_ID_GUI
-} GSS_ID;
+/* Maximum depth of a channel */
+#define GSS_MAX_CHANNEL_DEPTH	GSS_SENSORS_RING_LENGTH
+
+/* Slots of the priority lane of each channel: an activation and a
+ * deactivation of every alarm class, a pending rollup and a pending
+ * config change */
+#define GSS_PRIORITY_LANE_LENGTH	(2 * AC_MAX_CLASSES + 2)
+
+/* Dwell time histogram: bucket 0 counts waits below 2^GSS_DWELL_HIST_BASE_SHIFT us,
+ * every next bucket doubles the limit and the last one has no upper limit */
+#define GSS_DWELL_HIST_BUCKETS		12
+#define GSS_DWELL_HIST_BASE_SHIFT	8
+
+/* Upper limit (exclusive) in us of a dwell histogram bucket */
+#define GSS_DWELL_BUCKET_LIMIT_US(bucket)	(1ul << (GSS_DWELL_HIST_BASE_SHIFT + (bucket)))
+
+/* Id of a registered channel */
+typedef int8_t GSS_ID;
+
+#define GSS_ID_INVALID		((GSS_ID)-1)
 
 typedef enum
 {
 	GSS_SENSORS_DATA_READY,
-	GSS_ALARM_READY
+	GSS_ALARM_READY,
+	GSS_ROLLUP_READY,
+	GSS_CONFIG_CHANGED,
+	GSS_SIGNAL_MAX
 } GSS_SIGNAL;
 
+/* Signal mask for subscriptions */
+#define GSS_SIGNAL_BIT(signal)	(1u << (signal))
+
+/**
+ * What a channel does with its pending sensors samples. The producer never
+ * blocks nor loses the freshest reading whatever the policy. Messages with
+ * pointer payloads (alarms, rollups) travel in the priority lane of the
+ * channel and are never evicted: when the lane is full the send fails and
+ * the producer decides.
+ */
+typedef enum
+{
+	GSS_OVERFLOW_DROP_OLDEST,		// beyond 'depth' pending samples the oldest are discarded
+	GSS_OVERFLOW_OVERWRITE_LATEST,	// mailbox: only the newest pending sample is delivered
+	GSS_OVERFLOW_COALESCE,			// all pending samples are merged in one min/max/last record
+	GSS_OVERFLOW_MAX
+} GSS_OVERFLOW_POLICY;
+
 typedef struct
 {
 	GSS_SIGNAL signal;
@@ -42,16 +80,120 @@ typedef struct
 } GSS_Message;
 
 /**
- * @brief Initialize IPCs used by GSS.
+ * Data of a GSS_SENSORS_DATA_READY message. 'last' is the first member so
+ * the data can also be read as a Sensors_data_ptr. Unless the channel
+ * coalesces, min and max are equal to last and count is 1.
+ */
+typedef struct
+{
+	Sensors_data_t last;
+	Sensors_data_t min;
+	Sensors_data_t max;
+	uint16_t count;			// samples merged in this record
+	int64_t published_us;	// esp_timer_get_time() when 'last' was published
+} gss_sensors_record_t;
+
+/**
+ * Channel creation parameters
+ */
+typedef struct
+{
+	const char *name;				// static string, used for lookup and logs
+	uint8_t depth;					// 1..GSS_MAX_CHANNEL_DEPTH
+	GSS_OVERFLOW_POLICY policy;
+	uint32_t signals;				// GSS_SIGNAL_BIT mask of initial subscriptions
+	uint32_t config_vars;			// AQI_CV_BIT mask of the config variables
+									// notified with GSS_CONFIG_CHANGED
+} gss_channel_config_t;
+
+/**
+ * Set of channels a task waits on at once (FreeRTOS queue set)
+ */
+typedef struct
+{
+	QueueSetHandle_t queue_set;
+	uint8_t count;
+	GSS_ID ids[GSS_MAX_CHANNELS];
+} gss_channel_set_t;
+
+/**
+ * Counters of the sensors data ring for one consumer
+ */
+typedef struct
+{
+	uint32_t published;		// samples written by the producer
+	uint32_t received;		// samples read by this consumer
+	uint32_t dropped;		// samples discarded before this consumer read them
+	uint32_t superseded;	// samples replaced by a newer one or merged (mailbox, coalesce)
+} gss_ring_stats_t;
+
+/**
+ * Telemetry of one channel, to size its depth from real data
+ */
+typedef struct
+{
+	gss_ring_stats_t ring;
+	uint32_t alarms_sent;		// alarms, rollups and config changes queued in the priority lane
+	uint32_t alarms_dropped;	// alarms, rollups and config changes rejected because the lane was full
+	uint8_t lane_peak;			// most messages waiting in the lane at once
+	uint8_t backlog_peak;		// most samples pending in the ring at a read
+	uint32_t dwell_max_us;		// longest wait between send/publish and reception
+	uint32_t dwell_hist[GSS_DWELL_HIST_BUCKETS];
+} gss_channel_stats_t;
+
+/**
+ * @brief Initialize the GSS. Channels are registered afterwards by
+ * 		  the consumer modules.
  *
- * @return ESP_OK if all the IPCs have been initialized properly
- * 			else returns ESP_FAIL.
+ * @return ESP_OK
  */
 esp_err_t gss_initialize();
 
+/**
+ * @brief Registers a new channel. Each channel has its own priority lane
+ * 		  (queue of GSS_PRIORITY_LANE_LENGTH alarms and rollups), a read cursor on the
+ * 		  sensors ring and a doorbell semaphore that wakes up the consumer.
+ *
+ * @param config	channel parameters
+ * @param[out] out_id	Id of the new channel
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if config is not valid,
+ * 		   ESP_ERR_INVALID_STATE if a channel with the same name exists,
+ * 		   ESP_ERR_NO_MEM if there are no free channels or no heap
+ */
+esp_err_t gss_register_channel(const gss_channel_config_t *config, GSS_ID *out_id);
+
+/**
+ * @brief Looks for a registered channel by name
+ *
+ * @return Id of the channel or GSS_ID_INVALID
+ */
+GSS_ID gss_find_channel(const char *name);
+
+/**
+ * @brief Subscribes/unsubscribes a channel to a signal type
+ */
+esp_err_t gss_subscribe(GSS_ID id, GSS_SIGNAL signal);
+esp_err_t gss_unsubscribe(GSS_ID id, GSS_SIGNAL signal);
+
+/**
+ * @brief Name of a registered channel. For debug only
+ */
+const char* gss_channel_name(GSS_ID id);
+
 /**
  * @brief Blocks the caller task to wait for a signal from the GSS
  *
+ * Pending GSS_ALARM_READY messages are always returned before pending
+ * GSS_SENSORS_DATA_READY ones, so an alarm only waits for the message the
+ * consumer is processing and for the alarms ahead of it in the lane, never
+ * for the sensors backlog.
+ *
+ * For GSS_SENSORS_DATA_READY messages data points to a gss_sensors_record_t
+ * owned by the channel that stays valid until the next call on the same
+ * channel. For GSS_CONFIG_CHANGED messages it points to a uint32_t, also
+ * owned by the channel, with the AQI_CV_BIT mask of the changed variables.
+ *
  * @param id Id of the data channel where the task is waiting for a signal.
  * @param recv_msg Message that wakes up the task.
  * @param xTicksToWait The maximun time in ticks to get blocked.
@@ -59,7 +201,8 @@ esp_err_t gss_initialize();
  * @return Returns ESP_OK if  you have been unblocked in the channel
  * 		   because there is data to process.
  * 		   Returns ESP_ERR_TIMEOUT if you have not received any data after
- * 		   an amount of time xTicksToWait system ticks.
+ * 		   an amount of time xTicksToWait system ticks, or earlier if
+ * 		   gss_wake_channel was called for the channel.
  * 		   In other words you must call this function to get blocked
  * 		   waiting for the signaling of an event through the GSS.
  */
@@ -67,37 +210,141 @@ esp_err_t  gss_wait_for_signal(GSS_ID id, GSS_Message* recv_msg,
 								const TickType_t xTicksToWait);
 
 /**
- * @brief Sends new sensors data message for the task assigned to the target tag.
+ * @brief Creates a set to wait on several channels at once. A channel
+ * 		  added to a set must only be waited through the set.
+ *
+ * @param ids		channels of the set
+ * @param count		number of channels
+ * @param[out] set	set to use with gss_wait_for_signal_any
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_NO_MEM
+ */
+esp_err_t gss_channel_set_create(const GSS_ID *ids, uint8_t count, gss_channel_set_t *set);
+
+/**
+ * @brief Blocks the caller task until any channel of the set has a message.
+ * 		  The priority lanes of all the channels are drained before any
+ * 		  sensors data is returned.
+ *
+ * @param set			set of channels
+ * @param[out] from		channel that delivered the message (optional)
+ * @param recv_msg		received message
+ * @param xTicksToWait	maximum time in ticks to get blocked
+ *
+ * @return ESP_OK or ESP_ERR_TIMEOUT (also when a channel of the set is
+ * 		   woken with gss_wake_channel)
+ */
+esp_err_t gss_wait_for_signal_any(gss_channel_set_t *set, GSS_ID *from,
+								GSS_Message* recv_msg, const TickType_t xTicksToWait);
+
+/**
+ * @brief Wakes up the consumer of a channel without a message, so a task
+ * 		  blocked in gss_wait_for_signal can attend events that do not go
+ * 		  through the GSS (task notifications, driver callbacks...).
+ * 		  If the consumer is not waiting, its next wait without pending
+ * 		  messages returns at once.
+ *
+ * @param id	channel to wake up
+ * @return ESP_OK or ESP_ERR_INVALID_ARG
+ */
+esp_err_t gss_wake_channel(GSS_ID id);
+
+/**
+ * @brief Publishes new sensors data for all the subscribed channels. The data
+ * 		  is copied into a statically allocated ring, each channel keeps its
+ * 		  own read cursor. It never blocks: if a channel is too slow its
+ * 		  pending samples are handled by its overflow policy.
  *
- * @param sensors_data	Pointer to the sensors data to be sent.
- * @param target	ID of the GSS data channel assigned to the destination task
- * 					that we want the data will be sent.
- * @return Returns ESP_OK if data message could be sent. If channel is full
- * 		   returns ESP_ERR_NO_MEM. If sensors_data is invalid pointer
- * 		   or data channels are NULL returns ESP_ERR_INVALID_ARG.
- * 		   Else returns ESP_FAIL
+ * @param sensors_data	Pointer to the sensors data to be published.
+ * @return Returns ESP_OK if data has been published. If sensors_data is
+ * 		   NULL returns ESP_ERR_INVALID_ARG.
  *
- * @warning Ensure that target ID matches with the destination task.
+ * @warning Only one task (the sensors service) can publish.
  */
-esp_err_t gss_send_sensors_data(Sensors_data_ptr sensors_data, GSS_ID target);
+esp_err_t gss_publish_sensors_data(const Sensors_data_t *sensors_data);
 
 /**
- * @brief Sends new alarm data message for the task assigned to the target tag.
+ * @brief Copies the counters of the sensors data ring for a channel
+ *
+ * @param id	ID of the GSS data channel
+ * @param out	Counters
+ * @return ESP_OK or ESP_ERR_INVALID_ARG
+ */
+esp_err_t gss_get_sensors_ring_stats(GSS_ID id, gss_ring_stats_t *out);
+
+/**
+ * @brief Copies the telemetry of a channel: ring counters, priority lane
+ * 		  counters, peaks and the histogram of the time messages wait in the
+ * 		  channel (esp_timer_get_time from publish/send to reception).
+ * 		  Counters are never reset.
+ *
+ * @param id	ID of the GSS data channel
+ * @param out	Telemetry
+ * @return ESP_OK or ESP_ERR_INVALID_ARG
+ */
+esp_err_t gss_get_channel_stats(GSS_ID id, gss_channel_stats_t *out);
+
+/**
+ * @brief Sends new alarm data message to the priority lane of one channel.
+ * 		  On success the channel takes its own reference to the alarm, the
+ * 		  caller keeps its reference and must release it.
  *
  * @param alarm_data Pointer to the alarm data to be sent.
- * @param target     ID of the GSS data channel assigned to the destination task
- *                   that we want the data to be sent to.
- * @return Returns ESP_OK if data message could be sent. If channel is full
+ * @param target     ID of the GSS data channel
+ * @return Returns ESP_OK if data message could be sent. If the lane is full
  *         returns ESP_ERR_NO_MEM. If alarm_data is invalid pointer
- *         or data channels are NULL returns ESP_ERR_INVALID_ARG.
- *         Else returns ESP_FAIL
- *
- * @warning Ensure that target ID matches with the destination task.
+ *         or target is not a registered channel returns ESP_ERR_INVALID_ARG.
  */
 esp_err_t gss_send_alarm_data(Alarm_data_ptr alarm_data, GSS_ID target);
 
 /**
- * @brief Release the data of a 'GSS_Message'
+ * @brief Delivers the same alarm payload to every channel subscribed to
+ * 		  GSS_ALARM_READY, each channel holds a reference to it instead of a copy.
+ *
+ * @param alarm_data	Pointer to the alarm data to be sent. The caller keeps
+ * 						its reference and must release it.
+ * @param[out] delivered	Optional, number of channels that got the alarm
+ * @return Returns ESP_OK if the alarm has been delivered to one channel at
+ * 		   least, ESP_ERR_INVALID_ARG if alarm_data is NULL, else ESP_ERR_NO_MEM
+ */
+esp_err_t gss_broadcast_alarm_data(Alarm_data_ptr alarm_data, uint8_t *delivered);
+
+/**
+ * @brief Delivers a closed rollup window to every channel subscribed to
+ * 		  GSS_ROLLUP_READY through its priority lane, each channel holds a
+ * 		  reference to it like with alarms.
+ *
+ * @param rollup	Pointer to the rollup. The caller keeps its reference and
+ * 					must release it.
+ * @param[out] delivered	Optional, number of channels that got the rollup
+ * @return Returns ESP_OK if the rollup has been delivered to one channel at
+ * 		   least or there are no subscribers, ESP_ERR_INVALID_ARG if rollup
+ * 		   is NULL, else ESP_ERR_NO_MEM
+ */
+esp_err_t gss_broadcast_rollup_data(Sensors_rollup_ptr rollup, uint8_t *delivered);
+
+/**
+ * @brief Notifies a config change to every channel subscribed to
+ * 		  GSS_CONFIG_CHANGED that watches any of the changed variables.
+ * 		  Changes are accumulated per channel: a channel has at most one
+ * 		  GSS_CONFIG_CHANGED message in its priority lane and it delivers
+ * 		  every change since the last one it received, so a burst of
+ * 		  updates wakes up the consumer once. If the lane is full the
+ * 		  changes stay pending and are delivered with the next notification.
+ *
+ * @param changed	AQI_CV_BIT mask of the changed variables
+ * @param[out] delivered	Optional, number of channels notified
+ * @return Returns ESP_OK if every interested channel has a pending
+ * 		   notification, else ESP_ERR_NO_MEM
+ *
+ * @warning Called by the config manager after committing the new config
+ */
+esp_err_t gss_broadcast_config_changed(uint32_t changed, uint8_t *delivered);
+
+/**
+ * @brief Release the data of a 'GSS_Message'. Sensors data is owned by the
+ * 		  channel so it is only unlinked from the message, like config
+ * 		  changes, alarms give back the reference of the channel.
  *
  * @param msg	Message which data want to be released.
  */
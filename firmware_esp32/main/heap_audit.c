@@ -0,0 +1,76 @@
+/*
+ * heap_audit.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include "heap_audit.h"
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+
+//Include FreeRTOS headers
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char * TAG = "HEAP_AUDIT";
+
+static TaskHandle_t audit_task_handle = NULL;
+static uint32_t audit_period_ms = 0;
+static uint32_t audit_runs = 0;
+static uint32_t audit_failures = 0;
+
+static void heap_audit_task(void *pvParameters)
+{
+	while (1)
+	{
+		vTaskDelay(pdMS_TO_TICKS(audit_period_ms));
+
+		// recorrido completo del heap, imprime los bloques corruptos
+		bool ok = heap_caps_check_integrity_all(true);
+
+		audit_runs++;
+		if (!ok)
+		{
+			audit_failures++;
+			ESP_LOGE(TAG, "Heap corrupto detectado en la comprobacion %lu", (unsigned long)audit_runs);
+		}
+
+		ESP_LOGD(TAG, "Heap libre=%u minimo=%u", heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+				heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+	}
+}
+
+esp_err_t heap_audit_start(uint32_t period_ms)
+{
+	if (audit_task_handle != NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	audit_period_ms = (period_ms > 0) ? period_ms : 1;
+
+	if (xTaskCreate(heap_audit_task, "heap_audit", HEAP_AUDIT_TASK_STACK_SIZE, NULL,
+			HEAP_AUDIT_TASK_PRIORITY, &audit_task_handle) != pdPASS)
+	{
+		audit_task_handle = NULL;
+		return ESP_ERR_NO_MEM;
+	}
+
+	ESP_LOGI(TAG, "Auditoria del heap cada %lu ms", (unsigned long)audit_period_ms);
+
+	return ESP_OK;
+}
+
+void heap_audit_get_counters(uint32_t *runs, uint32_t *failures)
+{
+	if (runs != NULL)
+	{
+		*runs = audit_runs;
+	}
+	if (failures != NULL)
+	{
+		*failures = audit_failures;
+	}
+}
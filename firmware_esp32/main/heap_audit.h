@@ -0,0 +1,36 @@
+/*
+ * heap_audit.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Tarea opcional que recorre periodicamente el heap comprobando su
+ *  integridad, fuera del camino de creacion de mensajes.
+ */
+
+#ifndef MAIN_HEAP_AUDIT_H_
+#define MAIN_HEAP_AUDIT_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define HEAP_AUDIT_TASK_STACK_SIZE	2560
+#define HEAP_AUDIT_TASK_PRIORITY	1
+
+/**
+ * @brief Arranca la tarea de auditoria del heap
+ *
+ * @param period_ms	periodo entre comprobaciones
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE si ya esta en marcha o
+ * 		   ESP_ERR_NO_MEM si no se puede crear la tarea
+ */
+esp_err_t heap_audit_start(uint32_t period_ms);
+
+/**
+ * @brief Numero de comprobaciones realizadas y de las que han fallado
+ */
+void heap_audit_get_counters(uint32_t *runs, uint32_t *failures);
+
+#endif /* MAIN_HEAP_AUDIT_H_ */
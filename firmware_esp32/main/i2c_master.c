@@ -2,6 +2,7 @@
  *
  */
 
+#include "i2c_master.h"
 #include "driver/i2c.h"
 #include "esp_err.h"
 #include "esp_log.h"
@@ -10,6 +11,9 @@
 static bool i2c_port_0_started = false;
 static bool i2c_port_1_started = false;
 
+static i2c_master_stats_t i2c_trans_stats;
+static portMUX_TYPE i2c_trans_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
 //Logging TAG for this module I2C_master
 static const char *TAG = "I2C_master";
 
@@ -126,3 +130,163 @@ esp_err_t i2c_master_close(i2c_port_t i2c_master_port)
 
 	return result;
 }
+
+
+/*
+ * Capa de transacciones sin reserva dinamica
+ */
+
+esp_err_t i2c_master_device_init(i2c_master_device_t *dev, i2c_port_t port,
+								uint8_t address, TickType_t bus_timeout)
+{
+	if (dev == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	dev->port = port;
+	dev->address = address;
+	dev->bus_timeout = bus_timeout;
+
+	return ESP_OK;
+}
+
+/**
+ * Rellena el enlace con una transaccion completa: START, direccion, datos y
+ * STOP. Lectura si rx no es NULL. ESP_ERR_NO_MEM si no cabe en el buffer
+ * del enlace
+ */
+static esp_err_t i2c_master_device_link_build(const i2c_master_device_t *dev, i2c_cmd_handle_t cmd,
+											const uint8_t *tx, uint8_t *rx, size_t len)
+{
+	uint8_t rw = (rx != NULL) ? I2C_MASTER_READ : I2C_MASTER_WRITE;
+	esp_err_t result = i2c_master_start(cmd);
+
+	if (result == ESP_OK)
+	{
+		// direccion y operacion con ACK
+		result = i2c_master_write_byte(cmd, (dev->address << 1) | rw, I2C_ACK);
+	}
+
+	if ((result == ESP_OK) && (rx != NULL))
+	{
+		result = i2c_master_read(cmd, rx, len, I2C_MASTER_LAST_NACK);
+	}
+	else if ((result == ESP_OK) && (len > 0))
+	{
+		result = i2c_master_write(cmd, tx, len, I2C_ACK);
+	}
+
+	if (result == ESP_OK)
+	{
+		result = i2c_master_stop(cmd);
+	}
+
+	return result;
+}
+
+/**
+ * Ejecuta una transaccion con el enlace de comandos sobre el buffer estatico
+ * del dispositivo. Si no cupiera se reconstruye en el heap y se contabiliza
+ * para poder detectarlo. Un enlace incompleto nunca llega al bus
+ */
+static esp_err_t i2c_master_device_transaction(i2c_master_device_t *dev, const uint8_t *tx,
+												uint8_t *rx, size_t len)
+{
+	esp_err_t result = ESP_ERR_NO_MEM;
+	bool is_dynamic = false;
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(dev->link_buffer, sizeof(dev->link_buffer));
+
+	if (cmd != NULL)
+	{
+		result = i2c_master_device_link_build(dev, cmd, tx, rx, len);
+		if (result != ESP_OK)
+		{
+			i2c_cmd_link_delete_static(cmd);
+			cmd = NULL;
+		}
+	}
+
+	if ((cmd == NULL) && (result == ESP_ERR_NO_MEM))
+	{
+		ESP_LOGW(TAG, "Buffer estatico insuficiente para dispositivo 0x%02x", dev->address);
+		is_dynamic = true;
+		if ((cmd = i2c_cmd_link_create()) != NULL)
+		{
+			result = i2c_master_device_link_build(dev, cmd, tx, rx, len);
+			if (result != ESP_OK)
+			{
+				i2c_cmd_link_delete(cmd);
+				cmd = NULL;
+			}
+		}
+	}
+
+	if (cmd == NULL)
+	{
+		ESP_LOGE(TAG, "No se pudo preparar la transaccion con 0x%02x: %s", dev->address,
+				esp_err_to_name(result));
+		portENTER_CRITICAL(&i2c_trans_stats_lock);
+		i2c_trans_stats.errors++;
+		portEXIT_CRITICAL(&i2c_trans_stats_lock);
+		return result;
+	}
+
+	result = i2c_master_cmd_begin(dev->port, cmd, dev->bus_timeout);
+
+	if (is_dynamic)
+	{
+		i2c_cmd_link_delete(cmd);
+	}
+	else
+	{
+		i2c_cmd_link_delete_static(cmd);
+	}
+
+	portENTER_CRITICAL(&i2c_trans_stats_lock);
+	if (is_dynamic)
+	{
+		i2c_trans_stats.dynamic_links++;
+	}
+	else
+	{
+		i2c_trans_stats.transactions++;
+	}
+	if (result != ESP_OK)
+	{
+		i2c_trans_stats.errors++;
+	}
+	portEXIT_CRITICAL(&i2c_trans_stats_lock);
+
+	return result;
+}
+
+esp_err_t i2c_master_device_write(i2c_master_device_t *dev, const uint8_t *data, size_t len)
+{
+	if ((dev == NULL) || ((data == NULL) && (len > 0)))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	return i2c_master_device_transaction(dev, data, NULL, len);
+}
+
+esp_err_t i2c_master_device_read(i2c_master_device_t *dev, uint8_t *data, size_t len)
+{
+	if ((dev == NULL) || (data == NULL) || (len == 0))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	return i2c_master_device_transaction(dev, NULL, data, len);
+}
+
+void i2c_master_get_stats(i2c_master_stats_t *out)
+{
+	if (out != NULL)
+	{
+		portENTER_CRITICAL(&i2c_trans_stats_lock);
+		*out = i2c_trans_stats;
+		portEXIT_CRITICAL(&i2c_trans_stats_lock);
+	}
+}
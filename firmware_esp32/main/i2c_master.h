@@ -12,10 +12,77 @@
 #define I2C_ACK		true
 #define I2C_NACK	false
 
+// Numero de operaciones "transaccion" de I2C_LINK_RECOMMENDED_SIZE que caben en el
+// buffer de comandos de cada dispositivo. Cada una reserva espacio para 5 comandos,
+// justo lo que usa la transaccion mas larga que construye el driver (lectura: start,
+// direccion, read, read del ultimo byte con NACK y stop; una escritura usa 4). Los
+// drivers nunca encadenan escritura y lectura en un mismo enlace (el trigger y el
+// fetch del SGP40 son transacciones separadas), asi que bastaria con 1: la segunda
+// es margen para no caer al enlace en heap si cambia el tamano interno de los
+// comandos del IDF o se anade una escritura seguida de lectura con repeated start.
+#define I2C_MASTER_DEVICE_MAX_TRANSACTIONS	2
+#define I2C_MASTER_DEVICE_LINK_BUFFER_SIZE	I2C_LINK_RECOMMENDED_SIZE(I2C_MASTER_DEVICE_MAX_TRANSACTIONS)
+
+/**
+ * Dispositivo esclavo del bus con su buffer de comandos estatico.
+ * El buffer se reutiliza en cada transaccion, de modo que las lecturas y
+ * escrituras no reservan memoria del heap. Un dispositivo solo puede usarse
+ * desde un contexto a la vez.
+ */
+typedef struct
+{
+	i2c_port_t port;
+	uint8_t address;
+	TickType_t bus_timeout;
+	uint8_t link_buffer[I2C_MASTER_DEVICE_LINK_BUFFER_SIZE];
+} i2c_master_device_t;
+
+/**
+ * Contadores de la capa de transacciones
+ */
+typedef struct
+{
+	uint32_t transactions;		// transacciones completadas con buffer estatico
+	uint32_t dynamic_links;		// transacciones que tuvieron que reservar en el heap
+	uint32_t errors;			// transacciones que fallaron en el bus o no se pudieron preparar
+} i2c_master_stats_t;
+
 extern esp_err_t i2c_master_init(i2c_port_t i2c_master_port, gpio_num_t sda_io_num,
                                     gpio_num_t scl_io_num,  gpio_pullup_t pull_up_en, bool fastMode);
 
 
 extern esp_err_t i2c_master_close(i2c_port_t i2c_master_port);
 
+/**
+ * @brief Prepara un dispositivo para la capa de transacciones. Se llama una
+ * 		  sola vez desde el init del driver del sensor.
+ *
+ * @param dev			dispositivo a inicializar
+ * @param port			puerto I2C ya instalado con i2c_master_init
+ * @param address		direccion de 7 bits del esclavo
+ * @param bus_timeout	ticks maximos de espera por el bus en cada transaccion
+ *
+ * @return ESP_OK o ESP_ERR_INVALID_ARG si dev es NULL
+ */
+extern esp_err_t i2c_master_device_init(i2c_master_device_t *dev, i2c_port_t port,
+										uint8_t address, TickType_t bus_timeout);
+
+/**
+ * @brief Transaccion completa de escritura: START, direccion+W, datos, STOP.
+ */
+extern esp_err_t i2c_master_device_write(i2c_master_device_t *dev, const uint8_t *data, size_t len);
+
+/**
+ * @brief Transaccion completa de lectura: START, direccion+R, datos (NACK en
+ * 		  el ultimo byte), STOP.
+ */
+extern esp_err_t i2c_master_device_read(i2c_master_device_t *dev, uint8_t *data, size_t len);
+
+/**
+ * @brief Copia los contadores de la capa de transacciones. Con los drivers en
+ * 		  regimen permanente dynamic_links debe mantenerse a 0: cuenta las
+ * 		  transacciones que no cupieron en el buffer estatico.
+ */
+extern void i2c_master_get_stats(i2c_master_stats_t *out);
+
 #endif /* MAIN_I2C_MASTER_H_ */
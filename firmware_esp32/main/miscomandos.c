@@ -5,6 +5,7 @@
  *      Author: jcgar
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
@@ -26,6 +27,16 @@
 #include "mqtt.h"
 
 #include "aqi_config_manager.h"
+#include "sensors_service.h"
+#include "i2c_master.h"
+#include "aqi_alarm_manager.h"
+#include "global_system_signaler.h"
+#include "heap_audit.h"
+#include "mqtt_outbox.h"
+#include "mqtt_deadband.h"
+#include "sensors_rollup.h"
+#include "aqi_json_schema.h"
+#include "mqtt_inbound.h"
 
 
 static int Cmd_led(int argc, char **argv)
@@ -270,14 +281,19 @@ static int Cmd_cfg(int argc, char **argv)
 	ESP_ERROR_CHECK( aqi_config_manager_get_all(&current, &failed) );
 
 	printf("=====FLASH CFG=====\n");
-	printf("screen time=%u\n", current.save_screen_seconds);
-	printf("room name=%s\n", current.room_name);
-	printf("temp_H=%u\n", current.alarm_temp_h);
-	printf("temp_L=%u\n", current.alarm_temp_l);
-	printf("humidity_H=%u\n", current.alarm_humidity_h);
-	printf("humidity_L=%u\n", current.alarm_humidity_l);
-	printf("voc_level=%u\n", current.alarm_voc_index);
-	printf("reset_wifi_prov=%u\n", current.reset_wifi_provisioning);
+	for (size_t i = 0; i < AQI_NUM_CFG_VARS; i++)
+	{
+		const aqi_config_field_t *field = &aqi_config_fields[i];
+
+		if (field->type == AQI_CFG_TYPE_STR)
+		{
+			printf("%s=%s\n", field->json_key, (const char *)&current + field->offset);
+		}
+		else
+		{
+			printf("%s=%" PRIu32 "\n", field->json_key, aqi_config_field_get_uint(&current, field));
+		}
+	}
 	printf("===================\n");
 
     return 0;
@@ -295,6 +311,355 @@ static void register_Cmd_read_config(void)
     ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
 }
 
+static int Cmd_sensors(int argc, char **argv)
+{
+	sensors_service_latency_t latency;
+	i2c_master_stats_t i2c_stats;
+
+	sensors_service_get_latency(&latency);
+	i2c_master_get_stats(&i2c_stats);
+
+	printf("=====LATENCIAS MUESTREO (us)=====\n");
+	printf("ciclos=%lu\n", (unsigned long)latency.cycles);
+	printf("%-14s %10s %10s %10s\n", "fase", "ultima", "media", "max");
+	for (int p = 0; p < SENSORS_PHASE_MAX; p++)
+	{
+		unsigned long avg = (latency.cycles > 0) ?
+				(unsigned long)(latency.phase[p].sum_us / latency.cycles) : 0;
+
+		printf("%-14s %10lu %10lu %10lu\n", sensors_service_phase_to_string(p),
+				(unsigned long)latency.phase[p].last_us, avg,
+				(unsigned long)latency.phase[p].max_us);
+	}
+	// referencia: lo que costaria el ciclo con las conversiones en serie
+	printf("conversion en serie (datasheet)=%lu\n",
+			(unsigned long)((SHT40_MEASURE_TIME_HIGH_MS + SGP40_TIME_UNTIL_MEASURE_AVAILABLE_MS) * 1000));
+	// en regimen permanente el bus no debe reservar memoria dinamica
+	printf("i2c transacciones=%lu reservas heap=%lu errores=%lu\n",
+			(unsigned long)i2c_stats.transactions, (unsigned long)i2c_stats.dynamic_links,
+			(unsigned long)i2c_stats.errors);
+	printf("=================================\n");
+
+    return 0;
+
+}
+
+static void register_Cmd_sensors(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "sensors",
+        .help = "Muestra el desglose de latencias por fase del muestreo de sensores y los contadores del bus I2C",
+        .hint = NULL,
+        .func = &Cmd_sensors,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static int Cmd_alarms(int argc, char **argv)
+{
+	aqi_alarm_latency_t latency;
+
+	printf("=====LATENCIA ALARMAS (us)=====\n");
+	printf("%-6s %8s %10s %10s %10s %10s\n", "sink", "alarmas", "ultima", "media", "max", ">limite");
+	for (int s = 0; s < AQI_ALARM_SINK_MAX; s++)
+	{
+		aqi_alarm_manager_get_latency(s, &latency);
+		unsigned long avg = (latency.count > 0) ?
+				(unsigned long)(latency.sum_us / latency.count) : 0;
+
+		printf("%-6s %8lu %10lu %10lu %10lu %10lu\n", aqi_alarm_sink_to_string(s),
+				(unsigned long)latency.count, (unsigned long)latency.last_us, avg,
+				(unsigned long)latency.max_us, (unsigned long)latency.over_budget);
+	}
+	printf("limite=%lu\n", (unsigned long)AQI_ALARM_LATENCY_BUDGET_US);
+	printf("===============================\n");
+
+    return 0;
+}
+
+static void register_Cmd_alarms(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "alarms",
+        .help = "Muestra la latencia desde la evaluacion de cada alarma hasta su publicacion MQTT y su aparicion en pantalla",
+        .hint = NULL,
+        .func = &Cmd_alarms,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static int Cmd_gss(int argc, char **argv)
+{
+	gss_channel_stats_t stats;
+
+	printf("=====CANALES GSS=====\n");
+	for (GSS_ID id = 0; id < GSS_MAX_CHANNELS; id++)
+	{
+		if (gss_get_channel_stats(id, &stats) != ESP_OK)
+		{
+			continue;
+		}
+
+		printf("[%d] %s\n", id, gss_channel_name(id));
+		printf("  muestras: publicadas=%lu recibidas=%lu perdidas=%lu sustituidas=%lu pico=%u\n",
+				(unsigned long)stats.ring.published, (unsigned long)stats.ring.received,
+				(unsigned long)stats.ring.dropped, (unsigned long)stats.ring.superseded,
+				stats.backlog_peak);
+		printf("  alarmas: enviadas=%lu rechazadas=%lu pico=%u/%u\n",
+				(unsigned long)stats.alarms_sent, (unsigned long)stats.alarms_dropped,
+				stats.lane_peak, GSS_PRIORITY_LANE_LENGTH);
+		printf("  espera max=%lu us\n", (unsigned long)stats.dwell_max_us);
+		for (int b = 0; b < GSS_DWELL_HIST_BUCKETS; b++)
+		{
+			if (b < GSS_DWELL_HIST_BUCKETS - 1)
+			{
+				printf("  <%8lu us: %lu\n", GSS_DWELL_BUCKET_LIMIT_US(b),
+						(unsigned long)stats.dwell_hist[b]);
+			}
+			else
+			{
+				printf("  >=%7lu us: %lu\n", GSS_DWELL_BUCKET_LIMIT_US(b - 1),
+						(unsigned long)stats.dwell_hist[b]);
+			}
+		}
+	}
+	printf("=====================\n");
+
+    return 0;
+}
+
+static void register_Cmd_gss(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "gss",
+        .help = "Muestra la telemetria de los canales del GSS: envios, perdidas, picos de ocupacion e histograma de tiempos de espera",
+        .hint = NULL,
+        .func = &Cmd_gss,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static void print_pool_stats(const char *name, const slab_pool_stats_t *stats)
+{
+	printf("%-8s %6u %6u %6u %10lu %8lu\n", name, stats->capacity, stats->in_use,
+			stats->peak, (unsigned long)stats->allocs, (unsigned long)stats->failures);
+}
+
+static int Cmd_pools(int argc, char **argv)
+{
+	slab_pool_stats_t stats;
+	uint32_t audit_runs;
+	uint32_t audit_failures;
+
+	printf("=====POOLS DE MENSAJES=====\n");
+	printf("%-8s %6s %6s %6s %10s %8s\n", "pool", "total", "uso", "pico", "reservas", "fallos");
+	alarm_type_get_pool_stats(&stats);
+	print_pool_stats("alarms", &stats);
+	sensors_rollup_get_pool_stats(&stats);
+	print_pool_stats("rollups", &stats);
+
+	heap_audit_get_counters(&audit_runs, &audit_failures);
+	printf("auditoria heap: comprobaciones=%lu fallos=%lu\n",
+			(unsigned long)audit_runs, (unsigned long)audit_failures);
+	printf("===========================\n");
+
+    return 0;
+}
+
+static void register_Cmd_pools(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "pools",
+        .help = "Muestra la ocupacion de los pools estaticos de mensajes de alarmas y agregados",
+        .hint = NULL,
+        .func = &Cmd_pools,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static int Cmd_outbox(int argc, char **argv)
+{
+	mqtt_outbox_stats_t stats;
+
+	mqtt_outbox_get_stats(&stats);
+
+	printf("=====OUTBOX MQTT=====\n");
+	if (stats.capacity == 0)
+	{
+		printf("outbox no disponible\n");
+	}
+	else
+	{
+		printf("arranque=%u capacidad=%lu pendientes=%lu\n", stats.boot,
+				(unsigned long)stats.capacity, (unsigned long)stats.pending);
+		printf("guardados=%lu reenviados=%lu sobreescritos=%lu corruptos=%lu escrituras=%lu\n",
+				(unsigned long)stats.appended, (unsigned long)stats.replayed,
+				(unsigned long)stats.overwritten, (unsigned long)stats.corrupted,
+				(unsigned long)stats.flushes);
+	}
+	printf("=====================\n");
+
+    return 0;
+}
+
+static void register_Cmd_outbox(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "outbox",
+        .help = "Muestra el estado del outbox de MQTT en flash",
+        .hint = NULL,
+        .func = &Cmd_outbox,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static int Cmd_mqttconn(int argc, char **argv)
+{
+	mqtt_connection_stats_t stats;
+	mqtt_qos1_stats_t qos1;
+
+	mqtt_get_connection_stats(&stats);
+
+	printf("=====CONEXION MQTT=====\n");
+	printf("estado=%s backoff=%lu ms\n", mqtt_conn_state_to_string(stats.state),
+			(unsigned long)stats.backoff_ms);
+	printf("conexiones=%lu reconexiones=%lu reintentos=%lu\n", (unsigned long)stats.connects,
+			(unsigned long)stats.reconnects, (unsigned long)stats.attempts);
+	printf("tiempo de reconexion: ultimo=%lu ms max=%lu ms\n",
+			(unsigned long)stats.last_reconnect_ms, (unsigned long)stats.max_reconnect_ms);
+
+	mqtt_get_qos1_stats(&qos1);
+	printf("QoS 1: enviadas=%lu confirmadas=%lu retransmitidas=%lu caducadas=%lu descartadas=%lu\n",
+			(unsigned long)qos1.sent, (unsigned long)qos1.acked, (unsigned long)qos1.retransmitted,
+			(unsigned long)qos1.timeouts, (unsigned long)qos1.deleted);
+	printf("ventana: en vuelo=%u pico=%u/%u esperas=%lu\n", qos1.in_flight, qos1.window_peak,
+			MQTT_QOS1_WINDOW, (unsigned long)qos1.window_full);
+	printf("PUBACK max=%lu ms\n", (unsigned long)qos1.rtt_max_ms);
+	for (int b = 0; b < MQTT_ACK_HIST_BUCKETS; b++)
+	{
+		if (b < (MQTT_ACK_HIST_BUCKETS - 1))
+		{
+			printf("  <%5u ms: %lu\n", MQTT_ACK_BUCKET_LIMIT_MS(b), (unsigned long)qos1.rtt_hist[b]);
+		}
+		else
+		{
+			printf("  >=%4u ms: %lu\n", MQTT_ACK_BUCKET_LIMIT_MS(b - 1), (unsigned long)qos1.rtt_hist[b]);
+		}
+	}
+	printf("=======================\n");
+
+    return 0;
+}
+
+static void register_Cmd_mqttconn(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "mqttconn",
+        .help = "Muestra el estado de la conexion MQTT, sus reconexiones y la ventana QoS 1",
+        .hint = NULL,
+        .func = &Cmd_mqttconn,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static int Cmd_deadband(int argc, char **argv)
+{
+	mqtt_deadband_stats_t stats;
+
+	mqtt_deadband_get_stats(&stats);
+
+	printf("=====FILTRO POR CAMBIO=====\n");
+	printf("evaluadas=%lu publicadas=%lu suprimidas=%lu\n", (unsigned long)stats.evaluated,
+			(unsigned long)stats.published, (unsigned long)stats.suppressed);
+	printf("por cambio=%lu por heartbeat=%lu por alarma=%lu\n", (unsigned long)stats.by_change,
+			(unsigned long)stats.by_heartbeat, (unsigned long)stats.by_alarm);
+	if (stats.evaluated > 0)
+	{
+		uint32_t permille = (uint32_t)(((uint64_t)stats.suppressed * 1000u) / stats.evaluated);
+		printf("suprimidas=%lu.%lu%%\n", (unsigned long)(permille / 10), (unsigned long)(permille % 10));
+	}
+	printf("===========================\n");
+
+    return 0;
+}
+static void register_Cmd_deadband(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "deadband",
+        .help = "Muestra los contadores del filtro de publicacion por cambio",
+        .hint = NULL,
+        .func = &Cmd_deadband,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static int Cmd_jsonbench(int argc, char **argv)
+{
+	uint32_t iterations = 1000;
+	aqi_json_bench_t bench;
+
+	if (argc == 2)
+	{
+		iterations = strtoul(argv[1], NULL, 10);
+	}
+	if ((argc > 2) || (iterations == 0))
+	{
+		printf(" jsonbench [iteraciones]\r\n");
+		return 0;
+	}
+
+	esp_err_t ret = aqi_json_schema_selftest(iterations, &bench);
+
+	printf("=====SERIALIZADOR JSON=====\n");
+	printf("mensajes=%lu distintos=%lu -> %s\n", (unsigned long)bench.checked,
+			(unsigned long)bench.mismatches, (ret == ESP_OK) ? "OK" : "FALLO");
+	// tres mensajes por iteracion: medida, muestra de batch y alarma
+	printf("json_printf: %lld us total, %lld ns/mensaje\n", bench.printf_us,
+			(bench.printf_us * 1000) / (3 * (int64_t)iterations));
+	printf("especializado: %lld us total, %lld ns/mensaje\n", bench.schema_us,
+			(bench.schema_us * 1000) / (3 * (int64_t)iterations));
+	printf("===========================\n");
+
+    return 0;
+}
+static void register_Cmd_jsonbench(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "jsonbench",
+        .help = "Compara el serializador JSON especializado con json_printf",
+        .hint = NULL,
+        .func = &Cmd_jsonbench,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
+static int Cmd_inbound(int argc, char **argv)
+{
+	mqtt_inbound_stats_t stats;
+
+	mqtt_inbound_get_stats(&stats);
+
+	printf("=====MENSAJES RECIBIDOS=====\n");
+	printf("entregados=%lu errores handler=%lu sin handler=%lu\n", (unsigned long)stats.delivered,
+			(unsigned long)stats.handler_errors, (unsigned long)stats.unrouted);
+	printf("fragmentados=%lu demasiado grandes=%lu incompletos=%lu\n", (unsigned long)stats.fragmented,
+			(unsigned long)stats.too_big, (unsigned long)stats.broken);
+	printf("mayor=%lu bytes buffer=%d bytes\n", (unsigned long)stats.max_len, MQTT_INBOUND_BUFFER_SIZE);
+	printf("============================\n");
+
+    return 0;
+}
+static void register_Cmd_inbound(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "inbound",
+        .help = "Muestra los contadores de los mensajes MQTT recibidos",
+        .hint = NULL,
+        .func = &Cmd_inbound,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
 void init_MisComandos(void)
 {
 	register_Cmd_led();
@@ -307,4 +672,13 @@ void init_MisComandos(void)
 #endif
 
 	register_Cmd_read_config();
+	register_Cmd_sensors();
+	register_Cmd_alarms();
+	register_Cmd_gss();
+	register_Cmd_pools();
+	register_Cmd_outbox();
+	register_Cmd_mqttconn();
+	register_Cmd_deadband();
+	register_Cmd_jsonbench();
+	register_Cmd_inbound();
 }
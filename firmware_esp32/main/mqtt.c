@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <inttypes.h>
 
 
 //Include FreeRTOS headers
@@ -17,6 +18,9 @@
 #include "driver/gpio.h"
 #include "esp_check.h"
 #include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
 
 //Include own project  headers
 #include "gpio_leds.h"
@@ -30,6 +34,13 @@
 #include "sensors_type.h"
 #include "aqi_config_manager.h"
 #include "alarm_type.h"
+#include "aqi_alarm_manager.h"
+#include "aqi_wire_format.h"
+#include "mqtt_outbox.h"
+#include "mqtt_deadband.h"
+#include "sensors_rollup.h"
+#include "aqi_json_schema.h"
+#include "mqtt_inbound.h"
 
 //****************************************************************************
 //      VARIABLES GLOBALES STATIC
@@ -38,6 +49,79 @@
 static const char *TAG = "MQTT_CLIENT";
 static esp_mqtt_client_handle_t client=NULL;
 static TaskHandle_t senderTaskHandler=NULL;
+static GSS_ID mqtt_gss_channel = GSS_ID_INVALID;
+
+// maquina de estados de la conexion. Solo la modifica el sender, el handler
+// de eventos le avisa con notificaciones MQTT_NOTIFY_* (mqtt_sender_notify)
+static bool mqtt_connected = false;
+static mqtt_connection_stats_t conn_stats = { .state = MQTT_CONN_CONNECTING };
+static portMUX_TYPE conn_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t conn_state_since_us = 0;
+static int64_t disconnected_at_us = 0;	// 0 si no hay una desconexion en curso
+static int64_t reconnect_at_us = 0;
+static uint8_t backoff_exponent = 0;
+
+// muestras pendientes de publicar en modo batch
+typedef struct
+{
+	Sensors_data_t data;
+	int64_t timestamp_us;	// instante de publicacion en el GSS
+} mqtt_batch_sample_t;
+
+#define MQTT_BATCH_BUFFER_SIZE	(MQTT_BATCH_HEADER_JSON_SIZE + \
+								(AQI_MAX_MQTT_BATCH_SAMPLES * MQTT_BATCH_SAMPLE_JSON_SIZE))
+
+static mqtt_batch_sample_t batch_samples[AQI_MAX_MQTT_BATCH_SAMPLES];
+static uint8_t batch_count = 0;
+static char batch_buffer[MQTT_BATCH_BUFFER_SIZE];
+
+// variables de config que usa el sender, le llegan con GSS_CONFIG_CHANGED
+#define MQTT_SENDER_CONFIG_VARS	(AQI_CV_BIT(AQI_CV_MQTT_BATCH_SAMPLES) | AQI_CV_BIT(AQI_CV_MQTT_BATCH_SECONDS) \
+								| AQI_CV_BIT(AQI_CV_MQTT_DEADBAND_TEMP) | AQI_CV_BIT(AQI_CV_MQTT_DEADBAND_HUMIDITY) \
+								| AQI_CV_BIT(AQI_CV_MQTT_DEADBAND_VOC) | AQI_CV_BIT(AQI_CV_MQTT_DEADBAND_REL_PCT) \
+								| AQI_CV_BIT(AQI_CV_MQTT_HEARTBEAT_SECONDS) | AQI_CV_BIT(AQI_CV_SENSORS_ROLLUP_SECONDS))
+
+// formatos de payload publicados, segun CONFIG_AQI_MQTT_PAYLOAD_*
+#if CONFIG_AQI_MQTT_PAYLOAD_BINARY
+#define MQTT_PUBLISH_JSON		0
+#else
+#define MQTT_PUBLISH_JSON		1
+#endif
+
+#if CONFIG_AQI_MQTT_PAYLOAD_BINARY || CONFIG_AQI_MQTT_PAYLOAD_JSON_AND_BINARY
+#define MQTT_PUBLISH_BINARY		1
+static uint8_t batch_wire_buffer[AQI_WIRE_BATCH_SIZE(AQI_MAX_MQTT_BATCH_SAMPLES)];
+#else
+#define MQTT_PUBLISH_BINARY		0
+#endif
+
+// QoS de cada tipo de dato, segun CONFIG_AQI_MQTT_*_QOS1
+#if CONFIG_AQI_MQTT_ALARMS_QOS1
+#define MQTT_ALARMS_QOS			1
+#else
+#define MQTT_ALARMS_QOS			0
+#endif
+
+#if CONFIG_AQI_MQTT_MEASURES_QOS1
+#define MQTT_MEASURES_QOS		1
+#else
+#define MQTT_MEASURES_QOS		0
+#endif
+
+// publicaciones QoS 1 que genera un mismo mensaje del GSS
+#define MQTT_QOS1_PER_MESSAGE	(MQTT_PUBLISH_JSON + MQTT_PUBLISH_BINARY)
+
+// ventana de publicaciones QoS 1 esperando PUBACK, la comparten el sender
+// (que publica) y el handler de eventos (que recibe los PUBACK)
+typedef struct
+{
+	int msg_id;			// 0 si el hueco esta libre
+	int64_t sent_us;
+} mqtt_inflight_t;
+
+static mqtt_inflight_t inflight[MQTT_QOS1_WINDOW];
+static mqtt_qos1_stats_t qos1_stats;
+static portMUX_TYPE qos1_lock = portMUX_INITIALIZER_UNLOCKED;
 
 //****************************************************************************
 // Funciones.
@@ -45,6 +129,150 @@ static TaskHandle_t senderTaskHandler=NULL;
 
 static void mqtt_sender_task(void *pvParameters);
 
+/**
+ * Avisa al sender de un cambio de la conexion. Puede estar bloqueado en la
+ * notificacion de tarea o en el doorbell de su canal del GSS, asi que se
+ * despiertan los dos
+ */
+static void mqtt_sender_notify(uint32_t events)
+{
+	if (senderTaskHandler != NULL)
+	{
+		xTaskNotify(senderTaskHandler, events, eSetBits);
+		(void)gss_wake_channel(mqtt_gss_channel);
+	}
+}
+
+/**
+ * Libera el hueco de la ventana QoS 1 de msg_id. Con acked se anota la
+ * latencia del PUBACK, si no el cliente ha descartado el mensaje
+ */
+static void mqtt_qos1_release(int msg_id, bool acked)
+{
+	bool found = false;
+
+	if (msg_id <= 0)
+	{
+		return;
+	}
+
+	portENTER_CRITICAL(&qos1_lock);
+	for (int i = 0; i < MQTT_QOS1_WINDOW; i++)
+	{
+		if (inflight[i].msg_id != msg_id)
+		{
+			continue;
+		}
+
+		if (acked)
+		{
+			uint32_t rtt_ms = (uint32_t)((esp_timer_get_time() - inflight[i].sent_us) / 1000);
+			int bucket = 0;
+
+			while ((bucket < (MQTT_ACK_HIST_BUCKETS - 1)) && (rtt_ms >= MQTT_ACK_BUCKET_LIMIT_MS(bucket)))
+			{
+				bucket++;
+			}
+			qos1_stats.rtt_hist[bucket]++;
+			qos1_stats.acked++;
+			if (rtt_ms > qos1_stats.rtt_max_ms)
+			{
+				qos1_stats.rtt_max_ms = rtt_ms;
+			}
+			// mas tarde que el timeout del cliente, hubo al menos una retransmision
+			if (rtt_ms >= MQTT_QOS1_RETRANSMIT_MS)
+			{
+				qos1_stats.retransmitted++;
+			}
+		}
+		else
+		{
+			qos1_stats.deleted++;
+		}
+
+		inflight[i].msg_id = 0;
+		qos1_stats.in_flight--;
+		found = true;
+		break;
+	}
+	portEXIT_CRITICAL(&qos1_lock);
+
+	// el sender puede estar esperando hueco en la ventana
+	if (found && (senderTaskHandler != NULL))
+	{
+		xTaskNotify(senderTaskHandler, MQTT_NOTIFY_WINDOW, eSetBits);
+	}
+}
+
+
+/**
+ * Publica en TOPIC_CONFIG_ACK la revision de la config, el resultado del
+ * ultimo cambio recibido y las claves que ha cambiado. Va retenido: quien
+ * se suscribe recibe la revision actual
+ */
+static void mqtt_publish_config_ack(const char *status, const aqi_config_update_result_t *result)
+{
+	char ack_buffer[MQTT_CONFIG_ACK_BUFFER_SIZE];
+	struct json_out out = JSON_OUT_BUF(ack_buffer, MQTT_CONFIG_ACK_BUFFER_SIZE);
+	bool first = true;
+
+	int printed = json_printf(&out, "{version: %lu, status: %Q, changed: [",
+			(unsigned long)result->version, status);
+	for (int i = 0; i < AQI_NUM_CFG_VARS; i++)
+	{
+		if ((result->changed & AQI_CV_BIT(i)) != 0)
+		{
+			printed += json_printf(&out, first ? "%Q" : ",%Q", aqi_config_fields[i].json_key);
+			first = false;
+		}
+	}
+	printed += json_printf(&out, "]}");
+
+	if (printed >= MQTT_CONFIG_ACK_BUFFER_SIZE)
+	{
+		ESP_LOGE(TAG, "Respuesta de config no cabe en el buffer (%d)", printed);
+		return;
+	}
+
+	int msg_id = esp_mqtt_client_publish(client, TOPIC_CONFIG_ACK, ack_buffer, 0, 0, 1);
+	ESP_LOGI(TAG, "sent on TOPIC_CONFIG_ACK, msg_id=%d: %s", msg_id, ack_buffer);
+}
+
+/**
+ * Handler de TOPIC_CONFIG. Cada mensaje es un parche sobre la config, el
+ * resultado se publica en TOPIC_CONFIG_ACK
+ */
+static esp_err_t mqtt_on_config(const char *data, int data_len)
+{
+	aqi_config_update_result_t result;
+	esp_err_t err = aqi_process_received_config_data(data, data_len, &result);
+	const char *status;
+
+	switch (err)
+	{
+	case ESP_OK:
+		status = (result.changed != 0) ? "applied" : "unchanged";
+		break;
+	case ESP_ERR_INVALID_STATE:
+		ESP_LOGW(TAG, "Incoming CONFIG based on an old version, current is %lu",
+				(unsigned long)result.version);
+		status = "conflict";
+		break;
+	case ESP_ERR_INVALID_ARG:
+	case ESP_FAIL:
+		ESP_LOGE(TAG, "Incoming CONFIG JSON data invalid");
+		status = "invalid";
+		break;
+	default:
+		ESP_LOGE(TAG, "Flash config data error: %s", esp_err_to_name(err));
+		status = "error";
+		break;
+	}
+
+	mqtt_publish_config_ack(status, &result);
+
+	return err;
+}
 
 // callback that will handle MQTT events. Will be called by  the MQTT internal task.
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
@@ -52,7 +280,6 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t client = event->client;
     int msg_id;
-    esp_err_t err = ESP_FAIL;
 
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED:
@@ -65,14 +292,25 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             msg_id = esp_mqtt_client_subscribe(client, TOPIC_CONFIG, 0);
             ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
 
-            //xTaskCreate(mqtt_sender_task, "mqtt_sender", 4096, NULL, 5, &senderTaskHandler); //Crea la tarea MQTT sennder
-            xTaskCreatePinnedToCore(mqtt_sender_task, "mqtt_sender", 4096, NULL, 5, NULL, 0);
+            // revision actual de la config para quien vaya a cambiarla
+            {
+                aqi_config_update_result_t current = { 0 };
+                AQI_device_config_data_t config;
+
+                aqi_config_manager_get_snapshot(&config, &current.version);
+                mqtt_publish_config_ack("current", &current);
+            }
+
+            // el sender es unico y persistente, solo se le avisa
+            mqtt_sender_notify(MQTT_NOTIFY_CONNECTED);
 
             break;
         }
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
-            //Deber�amos destruir la tarea que env�a....
+            mqtt_inbound_reset();
+            // el sender decide cuando reintentar
+            mqtt_sender_notify(MQTT_NOTIFY_DISCONNECTED);
             break;
         case MQTT_EVENT_SUBSCRIBED:
             ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -82,31 +320,17 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             break;
         case MQTT_EVENT_PUBLISHED:
             ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            mqtt_qos1_release(event->msg_id, true);
+            break;
+        case MQTT_EVENT_DELETED:
+            ESP_LOGW(TAG, "MQTT_EVENT_DELETED, msg_id=%d", event->msg_id);
+            mqtt_qos1_release(event->msg_id, false);
             break;
         case MQTT_EVENT_DATA:
-        {
-        	//Para poder imprimir el nombre del topic lo tengo que copiar en una cadena correctamente terminada....
-        	char topic_name[event->topic_len+1]; //Esto va a la pila y es potencialmente peligroso si el nombre del topic es grande....
-        	strncpy(topic_name,event->topic,event->topic_len);
-        	topic_name[event->topic_len]=0; //a�ade caracter de terminacion al final.
-
-        	ESP_LOGI(TAG, "MQTT_EVENT_DATA: Topic %s",topic_name);
-
-        	// Handle data subscribed on topic config
-        	if (strncmp(TOPIC_CONFIG, topic_name, strlen(TOPIC_CONFIG)) == 0)
-        	{
-        		err = aqi_process_received_config_data(event->data, event->data_len);
-        		if (err == ESP_ERR_INVALID_ARG)
-        		{
-        			ESP_LOGE(TAG, "Incoming CONFIG JSON data invalid");
-        		}
-        		else if (err == ESP_FAIL)
-        		{
-        			ESP_LOGE(TAG, "Flash config data error");
-        		}
-        	}
-
-        }
+            // el topic solo llega en el primer fragmento, el router lo
+            // compara sin copiarlo y junta los fragmentos
+            mqtt_inbound_on_data(event->topic, event->topic_len, event->data, event->data_len,
+                    event->total_data_len, event->current_data_offset);
             break;
 
         case MQTT_EVENT_ERROR:
@@ -121,50 +345,844 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 }
 
 
+/**
+ * Publica en TOPIC_STATS un mensaje por cada canal del GSS con sus
+ * contadores e histograma de esperas
+ */
+static void mqtt_publish_gss_stats(void)
+{
+	static char stats_buffer[MQTT_STATS_BUFFER_SIZE];
+	gss_channel_stats_t stats;
+
+	for (GSS_ID id = 0; id < GSS_MAX_CHANNELS; id++)
+	{
+		if (gss_get_channel_stats(id, &stats) != ESP_OK)
+		{
+			continue;
+		}
+
+		struct json_out out = JSON_OUT_BUF(stats_buffer, MQTT_STATS_BUFFER_SIZE);
+		int printed = json_printf(&out, "{channel: %Q, published: %lu, received: %lu, dropped: %lu, "
+				"superseded: %lu, backlog_peak: %u, alarms_sent: %lu, alarms_dropped: %lu, "
+				"lane_peak: %u, dwell_max_us: %lu, dwell_base_us: %lu, dwell_hist: [",
+				gss_channel_name(id), (unsigned long)stats.ring.published,
+				(unsigned long)stats.ring.received, (unsigned long)stats.ring.dropped,
+				(unsigned long)stats.ring.superseded, stats.backlog_peak,
+				(unsigned long)stats.alarms_sent, (unsigned long)stats.alarms_dropped,
+				stats.lane_peak, (unsigned long)stats.dwell_max_us,
+				GSS_DWELL_BUCKET_LIMIT_US(0));
+		for (int b = 0; b < GSS_DWELL_HIST_BUCKETS; b++)
+		{
+			printed += json_printf(&out, (b == 0) ? "%lu" : ",%lu", (unsigned long)stats.dwell_hist[b]);
+		}
+		printed += json_printf(&out, "]}");
+
+		if (printed >= MQTT_STATS_BUFFER_SIZE)
+		{
+			ESP_LOGE(TAG, "Estadisticas del canal %s no caben en el buffer (%d)", gss_channel_name(id), printed);
+			continue;
+		}
+
+		int msg_id = esp_mqtt_client_publish(client, TOPIC_STATS, stats_buffer, 0, 0, 0);
+		ESP_LOGD(TAG, "sent on TOPIC_STATS, msg_id=%d: %s", msg_id, stats_buffer);
+	}
+}
+
+/**
+ * Publica en TOPIC_STATS los contadores del filtro por cambio
+ */
+static void mqtt_publish_deadband_stats(void)
+{
+	char stats_buffer[MQTT_STATS_BUFFER_SIZE];
+	mqtt_deadband_stats_t stats;
+
+	mqtt_deadband_get_stats(&stats);
+
+	struct json_out out = JSON_OUT_BUF(stats_buffer, MQTT_STATS_BUFFER_SIZE);
+	int printed = json_printf(&out, "{filter: %Q, evaluated: %lu, published: %lu, suppressed: %lu, "
+			"by_change: %lu, by_heartbeat: %lu, by_alarm: %lu}", "deadband",
+			(unsigned long)stats.evaluated, (unsigned long)stats.published,
+			(unsigned long)stats.suppressed, (unsigned long)stats.by_change,
+			(unsigned long)stats.by_heartbeat, (unsigned long)stats.by_alarm);
+
+	if (printed >= MQTT_STATS_BUFFER_SIZE)
+	{
+		ESP_LOGE(TAG, "Estadisticas del filtro por cambio no caben en el buffer (%d)", printed);
+		return;
+	}
+
+	int msg_id = esp_mqtt_client_publish(client, TOPIC_STATS, stats_buffer, 0, 0, 0);
+	ESP_LOGD(TAG, "sent on TOPIC_STATS, msg_id=%d: %s", msg_id, stats_buffer);
+}
+
+/**
+ * Anota una publicacion QoS 1 en la ventana
+ */
+static void mqtt_qos1_track(int msg_id)
+{
+	portENTER_CRITICAL(&qos1_lock);
+	qos1_stats.sent++;
+	for (int i = 0; i < MQTT_QOS1_WINDOW; i++)
+	{
+		if (inflight[i].msg_id == 0)
+		{
+			inflight[i].msg_id = msg_id;
+			inflight[i].sent_us = esp_timer_get_time();
+			qos1_stats.in_flight++;
+			if (qos1_stats.in_flight > qos1_stats.window_peak)
+			{
+				qos1_stats.window_peak = qos1_stats.in_flight;
+			}
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&qos1_lock);
+}
+
+/**
+ * Libera los huecos de la ventana sin PUBACK en MQTT_QOS1_ACK_TIMEOUT_MS.
+ * Devuelve los ticks hasta la siguiente caducidad, portMAX_DELAY si no hay
+ */
+static TickType_t mqtt_qos1_expire(void)
+{
+	int64_t now_us = esp_timer_get_time();
+	int64_t next_us = INT64_MAX;
+
+	portENTER_CRITICAL(&qos1_lock);
+	for (int i = 0; i < MQTT_QOS1_WINDOW; i++)
+	{
+		if (inflight[i].msg_id == 0)
+		{
+			continue;
+		}
+
+		int64_t expires_us = inflight[i].sent_us + ((int64_t)MQTT_QOS1_ACK_TIMEOUT_MS * 1000);
+		if (expires_us <= now_us)
+		{
+			inflight[i].msg_id = 0;
+			qos1_stats.in_flight--;
+			qos1_stats.timeouts++;
+		}
+		else if (expires_us < next_us)
+		{
+			next_us = expires_us;
+		}
+	}
+	portEXIT_CRITICAL(&qos1_lock);
+
+	return (next_us == INT64_MAX) ? portMAX_DELAY : (pdMS_TO_TICKS((next_us - now_us) / 1000) + 1);
+}
+
+/**
+ * true si no caben en la ventana las publicaciones QoS 1 de otro mensaje
+ */
+static bool mqtt_qos1_window_full(void)
+{
+	return (qos1_stats.in_flight + MQTT_QOS1_PER_MESSAGE) > MQTT_QOS1_WINDOW;
+}
+
+/**
+ * Publica en el cliente y, si es QoS 1, ocupa un hueco de la ventana.
+ * Devuelve el msg_id del cliente
+ */
+static int mqtt_publish(const char *topic, const char *data, int len, int qos)
+{
+	int msg_id = esp_mqtt_client_publish(client, topic, data, len, qos, 0);
+
+	if ((qos > 0) && (msg_id > 0))
+	{
+		mqtt_qos1_track(msg_id);
+	}
+
+	return msg_id;
+}
+
+#if MQTT_PUBLISH_BINARY
+/**
+ * Publica una medida en TOPIC_MEASURES_BIN. Devuelve el msg_id del cliente
+ */
+static int mqtt_publish_measure_binary(const Sensors_data_t *sensors_data)
+{
+	uint8_t wire[AQI_WIRE_MEASURE_SIZE];
+	size_t len = 0;
+	esp_err_t err = aqi_wire_encode_measure(sensors_data, wire, sizeof(wire), &len);
+
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Binary encoding for sensors data failed with code: %s", esp_err_to_name(err));
+		return -1;
+	}
+
+	int msg_id = mqtt_publish(TOPIC_MEASURES_BIN, (const char*)wire, len, MQTT_MEASURES_QOS);
+	ESP_LOGI(TAG, "sent successful on TOPIC_MEASURES_BIN, msg_id=%d, %u bytes", msg_id, (unsigned)len);
+
+	return msg_id;
+}
+
+/**
+ * Publica una alarma en TOPIC_ALARMS_BIN. Devuelve el msg_id del cliente
+ */
+static int mqtt_publish_alarm_binary(const Alarm_data_t *alarm_data)
+{
+	uint8_t wire[AQI_WIRE_ALARM_SIZE];
+	size_t len = 0;
+	esp_err_t err = aqi_wire_encode_alarm(alarm_data, wire, sizeof(wire), &len);
+
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Binary encoding for alarms data failed with code: %s", esp_err_to_name(err));
+		return -1;
+	}
+
+	int msg_id = mqtt_publish(TOPIC_ALARMS_BIN, (const char*)wire, len, MQTT_ALARMS_QOS);
+	ESP_LOGI(TAG, "sent successful on TOPIC_ALARMS_BIN, msg_id=%d, %u bytes", msg_id, (unsigned)len);
+
+	return msg_id;
+}
+
+/**
+ * Publica en TOPIC_MEASURES_BATCH_BIN las muestras acumuladas, sin vaciar el batch.
+ * Devuelve el msg_id del cliente
+ */
+static int mqtt_publish_batch_binary(int64_t sent_ms)
+{
+	size_t len = 0;
+	esp_err_t err = aqi_wire_encode_batch_header((uint32_t)sent_ms, batch_count, batch_wire_buffer,
+			sizeof(batch_wire_buffer), &len);
+
+	for (int i = 0; (i < batch_count) && (err == ESP_OK); i++)
+	{
+		err = aqi_wire_encode_batch_sample(i, (uint32_t)(batch_samples[i].timestamp_us / 1000),
+				&batch_samples[i].data, batch_wire_buffer, sizeof(batch_wire_buffer), &len);
+	}
+
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Binary encoding for batch failed with code: %s", esp_err_to_name(err));
+		return -1;
+	}
+
+	int msg_id = mqtt_publish(TOPIC_MEASURES_BATCH_BIN, (const char*)batch_wire_buffer, len, MQTT_MEASURES_QOS);
+	ESP_LOGI(TAG, "batch de %u muestras en TOPIC_MEASURES_BATCH_BIN, msg_id=%d, %u bytes",
+			batch_count, msg_id, (unsigned)len);
+
+	return msg_id;
+}
+#endif
+
+/**
+ * Guarda en el outbox las muestras del batch en curso
+ */
+static void mqtt_store_batch(void)
+{
+	for (int i = 0; i < batch_count; i++)
+	{
+		mqtt_outbox_append_measure(&batch_samples[i].data, batch_samples[i].timestamp_us);
+	}
+}
+
+/**
+ * Publica en TOPIC_MEASURES_BATCH (y/o su variante binaria) las muestras
+ * acumuladas y vacia el batch
+ */
+static void mqtt_flush_batch(const char *reason)
+{
+	if (batch_count == 0)
+	{
+		return;
+	}
+
+	int64_t sent_ms = esp_timer_get_time() / 1000;
+	int sent_msg_id = -1;
+
+	if (!mqtt_connected)
+	{
+		ESP_LOGI(TAG, "Sin conexion, batch de %u muestras (%s) al outbox", batch_count, reason);
+		mqtt_store_batch();
+		batch_count = 0;
+		return;
+	}
+
+#if MQTT_PUBLISH_BINARY
+	sent_msg_id = mqtt_publish_batch_binary(sent_ms);
+#endif
+
+#if MQTT_PUBLISH_JSON
+	// cada trozo se escribe detras del anterior, 0 si no cabe
+	size_t printed = aqi_json_write_batch_header(batch_buffer, MQTT_BATCH_BUFFER_SIZE, sent_ms);
+	size_t len = printed;
+
+	for (int i = 0; (i < batch_count) && (len > 0); i++)
+	{
+		len = aqi_json_write_batch_sample(&batch_buffer[printed], MQTT_BATCH_BUFFER_SIZE - printed,
+				(i == 0), batch_samples[i].timestamp_us / 1000, &batch_samples[i].data);
+		printed += len;
+	}
+	if (len > 0)
+	{
+		len = aqi_json_write_batch_end(&batch_buffer[printed], MQTT_BATCH_BUFFER_SIZE - printed);
+		printed += len;
+	}
+
+	if (len > 0)
+	{
+		int msg_id = mqtt_publish(TOPIC_MEASURES_BATCH, batch_buffer, (int)printed, MQTT_MEASURES_QOS);
+		ESP_LOGI(TAG, "batch de %u muestras (%s) en TOPIC_MEASURES_BATCH, msg_id=%d, %u bytes",
+				batch_count, reason, msg_id, (unsigned)printed);
+		if (sent_msg_id < 0)
+		{
+			sent_msg_id = msg_id;
+		}
+	}
+	else
+	{
+		ESP_LOGE(TAG, "Batch de %u muestras no cabe en el buffer (%d)", batch_count, MQTT_BATCH_BUFFER_SIZE);
+	}
+#endif
+
+	// rechazado por el cliente, las muestras se reenviaran desde el outbox
+	if (sent_msg_id < 0)
+	{
+		mqtt_store_batch();
+	}
+
+	batch_count = 0;
+}
+
+/**
+ * Publica una muestra que ha pasado el filtro por cambio: sola, en el batch
+ * en curso o al outbox si no hay conexion o el cliente la rechaza
+ */
+static void mqtt_send_sample(const Sensors_data_t *sensors_data, int64_t timestamp_us, uint8_t batch_samples_cfg)
+{
+	if (!mqtt_connected)
+	{
+		// sin conexion la muestra se guarda para reenviarla al reconectar,
+		// detras de las del batch en curso
+		mqtt_flush_batch("desconexion");
+		mqtt_outbox_append_measure(sensors_data, timestamp_us);
+	}
+	else if ((batch_samples_cfg <= 1) && (batch_count == 0))
+	{
+		// sin batching, una publicacion por muestra
+		int sent_msg_id = -1;
+#if MQTT_PUBLISH_BINARY
+		sent_msg_id = mqtt_publish_measure_binary(sensors_data);
+#endif
+#if MQTT_PUBLISH_JSON
+		char buffer[JSON_OUT_BUFFER_SIZE];
+		size_t len = aqi_json_write_measure(buffer, JSON_OUT_BUFFER_SIZE, sensors_data);
+
+		if (len > 0)
+		{
+			int msg_id = mqtt_publish(TOPIC_MEASURES, buffer, (int)len, MQTT_MEASURES_QOS);
+			ESP_LOGI(TAG, "sent successful on TOPIC_MEASURES, msg_id=%d: %s", msg_id, buffer);
+			if (sent_msg_id < 0)
+			{
+				sent_msg_id = msg_id;
+			}
+		}
+		else
+		{
+			ESP_LOGE(TAG, "JSON generation for sensors data failed");
+		}
+#endif
+		if (sent_msg_id < 0)
+		{
+			mqtt_outbox_append_measure(sensors_data, timestamp_us);
+		}
+	}
+	else
+	{
+		batch_samples[batch_count].data = *sensors_data;
+		batch_samples[batch_count].timestamp_us = timestamp_us;
+		batch_count++;
+
+		if ((batch_count >= batch_samples_cfg) || (batch_count >= AQI_MAX_MQTT_BATCH_SAMPLES))
+		{
+			mqtt_flush_batch("lleno");
+		}
+	}
+}
+
+/**
+ * Publica un rollup en TOPIC_MEASURES_ROLLUP. Siempre en JSON, sale uno por
+ * ventana y el tamano no compensa un formato binario
+ */
+static void mqtt_publish_rollup(const Sensors_rollup_t *rollup)
+{
+	static char rollup_buffer[MQTT_ROLLUP_BUFFER_SIZE];
+	struct json_out out = JSON_OUT_BUF(rollup_buffer, MQTT_ROLLUP_BUFFER_SIZE);
+	esp_err_t json_status;
+
+	if ((json_status = sensors_rollup_to_JSON(&out, MQTT_ROLLUP_BUFFER_SIZE, rollup)) == ESP_OK)
+	{
+		int msg_id = mqtt_publish(TOPIC_MEASURES_ROLLUP, rollup_buffer, 0, MQTT_MEASURES_QOS);
+		ESP_LOGI(TAG, "sent on TOPIC_MEASURES_ROLLUP, msg_id=%d: %s", msg_id, rollup_buffer);
+	}
+	else
+	{
+		ESP_LOGE(TAG, "JSON generation for rollup failed with code: %s", esp_err_to_name(json_status));
+	}
+}
+
+/**
+ * Umbrales del filtro por cambio, la config puede cambiar por TOPIC_CONFIG
+ * en cualquier momento
+ */
+static void mqtt_read_deadband_cfg(mqtt_deadband_cfg_t *cfg, const AQI_device_config_data_t *config)
+{
+	cfg->temperature = config->mqtt_deadband_temp;
+	cfg->humidity = config->mqtt_deadband_humidity;
+	cfg->voc_index = config->mqtt_deadband_voc;
+	cfg->rel_pct = config->mqtt_deadband_rel_pct;
+	cfg->heartbeat_s = config->mqtt_heartbeat_seconds;
+}
+
+/**
+ * Lee de la config lo que usa el sender: al arrancar y con cada
+ * GSS_CONFIG_CHANGED, no en cada muestra
+ */
+static void mqtt_sender_load_config(uint8_t *batch_samples, uint16_t *batch_seconds,
+									mqtt_deadband_cfg_t *deadband, uint16_t *rollup_seconds)
+{
+	AQI_device_config_data_t config;
+
+	aqi_config_manager_get_snapshot(&config, NULL);
+	*batch_samples = config.mqtt_batch_samples;
+	*batch_seconds = config.mqtt_batch_seconds;
+	mqtt_read_deadband_cfg(deadband, &config);
+	*rollup_seconds = config.sensors_rollup_seconds;
+}
+
+/**
+ * Ticks hasta que el batch en curso alcance su edad maxima, portMAX_DELAY
+ * si no hay batch o no tiene limite de tiempo
+ */
+static TickType_t mqtt_batch_ticks_to_deadline(uint16_t batch_seconds)
+{
+	if ((batch_count == 0) || (batch_seconds == 0))
+	{
+		return portMAX_DELAY;
+	}
+
+	int64_t remaining_us = (batch_samples[0].timestamp_us + ((int64_t)batch_seconds * 1000000))
+			- esp_timer_get_time();
+
+	return (remaining_us <= 0) ? 0 : (pdMS_TO_TICKS(remaining_us / 1000) + 1);
+}
+
+/**
+ * Publica un registro del outbox en TOPIC_MEASURES_REPLAY o TOPIC_ALARMS_REPLAY
+ * con su secuencia, arranque y tiempo de creacion. Devuelve el msg_id del cliente
+ */
+static int mqtt_publish_outbox_record(const mqtt_outbox_record_t *record)
+{
+	char replay_buffer[MQTT_REPLAY_BUFFER_SIZE];
+	struct json_out out = JSON_OUT_BUF(replay_buffer, MQTT_REPLAY_BUFFER_SIZE);
+	const char *topic = NULL;
+	int qos = 0;
+	esp_err_t err = ESP_FAIL;
+
+	// la edad solo tiene sentido si el registro es de este arranque
+	int64_t age_ms = -1;
+	if (record->boot == mqtt_outbox_boot())
+	{
+		age_ms = (uint32_t)((uint32_t)(esp_timer_get_time() / 1000) - record->t_ms);
+	}
+
+	int printed = json_printf(&out, "{seq: %lu, boot: %u, t_ms: %lu, age_ms: %" PRId64 ", data: ",
+			(unsigned long)record->seq, record->boot, (unsigned long)record->t_ms, age_ms);
+
+	if (record->type == MQTT_OUTBOX_RECORD_MEASURE)
+	{
+		Sensors_data_t measure = record->measure;
+
+		topic = TOPIC_MEASURES_REPLAY;
+		qos = MQTT_MEASURES_QOS;
+		err = sensors_type_to_JSON(&out, MQTT_REPLAY_BUFFER_SIZE - printed, &measure);
+	}
+	else if ((record->type == MQTT_OUTBOX_RECORD_ALARM) && (record->alarm.alarm_class < AC_MAX_CLASSES))
+	{
+		Alarm_data_t alarm = {
+				.disable = (record->alarm.disable != 0),
+				.alarm_class = (Alarm_class)record->alarm.alarm_class,
+				.info = alarm_class_info((Alarm_class)record->alarm.alarm_class),
+		};
+
+		topic = TOPIC_ALARMS_REPLAY;
+		qos = MQTT_ALARMS_QOS;
+		err = alarm_type_to_JSON(&out, MQTT_REPLAY_BUFFER_SIZE - printed, &alarm);
+	}
+
+	if (err != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Registro %lu del outbox no se puede generar", (unsigned long)record->seq);
+		// se descarta, reintentarlo no lo arreglaria
+		return 0;
+	}
+
+	json_printf(&out, "}");
+
+	int msg_id = mqtt_publish(topic, replay_buffer, 0, qos);
+	ESP_LOGD(TAG, "sent on %s, msg_id=%d: %s", topic, msg_id, replay_buffer);
+
+	return msg_id;
+}
+
+/**
+ * Reenvia como mucho MQTT_OUTBOX_REPLAY_BURST registros del outbox, en orden
+ */
+static void mqtt_replay_outbox(void)
+{
+	mqtt_outbox_record_t record;
+
+	for (int i = 0; (i < MQTT_OUTBOX_REPLAY_BURST) && mqtt_connected && !mqtt_qos1_window_full(); i++)
+	{
+		if (mqtt_outbox_peek(&record) != ESP_OK)
+		{
+			break;
+		}
+		if (mqtt_publish_outbox_record(&record) < 0)
+		{
+			// se reintenta en el siguiente turno
+			break;
+		}
+		mqtt_outbox_pop();
+	}
+}
+
+static void mqtt_conn_set_state(MQTT_CONN_STATE state)
+{
+	portENTER_CRITICAL(&conn_lock);
+	conn_stats.state = state;
+	portEXIT_CRITICAL(&conn_lock);
+
+	mqtt_connected = (state == MQTT_CONN_CONNECTED);
+	conn_state_since_us = esp_timer_get_time();
+}
+
+/**
+ * Espera hasta el siguiente intento: exponencial desde MQTT_BACKOFF_BASE_MS
+ * hasta MQTT_BACKOFF_MAX_MS, con la mitad aleatoria para que varios equipos
+ * no reconecten a la vez tras una caida del broker
+ */
+static uint32_t mqtt_backoff_next_ms(void)
+{
+	uint32_t delay_ms = MQTT_BACKOFF_BASE_MS;
+
+	for (uint8_t i = 0; (i < backoff_exponent) && (delay_ms < MQTT_BACKOFF_MAX_MS); i++)
+	{
+		delay_ms *= 2;
+	}
+	if (delay_ms >= MQTT_BACKOFF_MAX_MS)
+	{
+		delay_ms = MQTT_BACKOFF_MAX_MS;
+	}
+	else
+	{
+		backoff_exponent++;
+	}
+
+	return (delay_ms / 2) + (esp_random() % ((delay_ms / 2) + 1));
+}
+
+static void mqtt_conn_on_connected(void)
+{
+	int64_t now_us = esp_timer_get_time();
+
+	portENTER_CRITICAL(&conn_lock);
+	conn_stats.connects++;
+	if (disconnected_at_us != 0)
+	{
+		conn_stats.reconnects++;
+		conn_stats.last_reconnect_ms = (uint32_t)((now_us - disconnected_at_us) / 1000);
+		if (conn_stats.last_reconnect_ms > conn_stats.max_reconnect_ms)
+		{
+			conn_stats.max_reconnect_ms = conn_stats.last_reconnect_ms;
+		}
+	}
+	conn_stats.backoff_ms = 0;
+	portEXIT_CRITICAL(&conn_lock);
+
+	if (disconnected_at_us != 0)
+	{
+		ESP_LOGI(TAG, "Reconectado en %lu ms", (unsigned long)conn_stats.last_reconnect_ms);
+	}
+	disconnected_at_us = 0;
+	backoff_exponent = 0;
+	mqtt_conn_set_state(MQTT_CONN_CONNECTED);
+}
+
+static void mqtt_conn_on_disconnected(void)
+{
+	int64_t now_us = esp_timer_get_time();
+	uint32_t delay_ms = mqtt_backoff_next_ms();
+
+	if (conn_stats.state == MQTT_CONN_CONNECTED)
+	{
+		disconnected_at_us = now_us;
+	}
+	reconnect_at_us = now_us + ((int64_t)delay_ms * 1000);
+
+	portENTER_CRITICAL(&conn_lock);
+	conn_stats.backoff_ms = delay_ms;
+	portEXIT_CRITICAL(&conn_lock);
+
+	mqtt_conn_set_state(MQTT_CONN_BACKOFF);
+	ESP_LOGI(TAG, "Sin conexion, reintento en %lu ms", (unsigned long)delay_ms);
+}
+
+/**
+ * Aplica los avisos del handler de eventos y lanza el reintento cuando vence
+ * el backoff. Devuelve los ticks hasta el siguiente cambio previsto
+ */
+static TickType_t mqtt_conn_update(void)
+{
+	uint32_t events = 0;
+	int64_t remaining_us;
+
+	(void)xTaskNotifyWait(0, UINT32_MAX, &events, 0);
+
+	// sin reconexion automatica un CONNECTED solo puede seguir a un
+	// DISCONNECTED si el sender ha pedido reintentar, asi que si llegan
+	// los dos a la vez el orden es este
+	if (events & MQTT_NOTIFY_CONNECTED)
+	{
+		mqtt_conn_on_connected();
+	}
+	if (events & MQTT_NOTIFY_DISCONNECTED)
+	{
+		mqtt_conn_on_disconnected();
+	}
+
+	switch (conn_stats.state)
+	{
+	case MQTT_CONN_BACKOFF:
+		if (esp_timer_get_time() >= reconnect_at_us)
+		{
+			portENTER_CRITICAL(&conn_lock);
+			conn_stats.attempts++;
+			portEXIT_CRITICAL(&conn_lock);
+
+			mqtt_conn_set_state(MQTT_CONN_CONNECTING);
+			if (esp_mqtt_client_reconnect(client) != ESP_OK)
+			{
+				mqtt_conn_on_disconnected();
+			}
+		}
+		break;
+	case MQTT_CONN_CONNECTING:
+		// el cliente no ha dado respuesta, se vuelve a intentar
+		if ((esp_timer_get_time() - conn_state_since_us) >= ((int64_t)MQTT_CONNECT_TIMEOUT_MS * 1000))
+		{
+			ESP_LOGW(TAG, "Conexion sin respuesta en %d ms", MQTT_CONNECT_TIMEOUT_MS);
+			mqtt_conn_on_disconnected();
+		}
+		break;
+	default:
+		return portMAX_DELAY;
+	}
+
+	remaining_us = ((conn_stats.state == MQTT_CONN_BACKOFF) ? reconnect_at_us :
+			(conn_state_since_us + ((int64_t)MQTT_CONNECT_TIMEOUT_MS * 1000))) - esp_timer_get_time();
+
+	return (remaining_us <= 0) ? 0 : (pdMS_TO_TICKS(remaining_us / 1000) + 1);
+}
+
 static void mqtt_sender_task(void *pvParameters)
 {
 	char buffer[JSON_OUT_BUFFER_SIZE]; //"buffer" para guardar el mensaje. Me debo asegurar que quepa...
-	esp_err_t json_status = ESP_FAIL;
 	GSS_Message recv_msg;
+	TickType_t last_stats = xTaskGetTickCount();
+	uint8_t batch_samples_cfg = 1;
+	uint16_t batch_seconds_cfg = 0;
+	mqtt_deadband_cfg_t deadband_cfg = { 0 };
+	uint16_t rollup_seconds_cfg = 0;
+	MQTT_DEADBAND_RESULT deadband_result;
+	Sensors_data_t suppressed_sample;
+	int64_t suppressed_us;
+	int sent_msg_id;
+	const gss_sensors_record_t *record;
+	TickType_t last_replay = xTaskGetTickCount();
+
+	// el cliente arranca a la vez que el sender con el primer intento
+	mqtt_conn_set_state(MQTT_CONN_CONNECTING);
+
+	// el canal ya esta registrado, los cambios posteriores llegan por el GSS
+	mqtt_sender_load_config(&batch_samples_cfg, &batch_seconds_cfg, &deadband_cfg, &rollup_seconds_cfg);
 
 	while (1)
 	{
-		struct json_out out1 = JSON_OUT_BUF(buffer, JSON_OUT_BUFFER_SIZE);
+#if !MQTT_PUBLISH_JSON
+		(void)buffer;
+#endif
+		TickType_t until_conn = mqtt_conn_update();
+
+		// sin conexion ni outbox no se consume el canal, su politica de
+		// desbordamiento decide que muestras se pierden
+		if (!mqtt_connected && !mqtt_outbox_available())
+		{
+			(void)xTaskNotifyWait(0, 0, NULL, until_conn);
+			continue;
+		}
+
+		// ventana QoS 1 llena: no se consume hasta que llegue un PUBACK o
+		// caduque una publicacion, el canal del GSS hace de cola
+		TickType_t until_expire = mqtt_qos1_expire();
+		if (mqtt_connected && mqtt_qos1_window_full())
+		{
+			portENTER_CRITICAL(&qos1_lock);
+			qos1_stats.window_full++;
+			portEXIT_CRITICAL(&qos1_lock);
+
+			(void)xTaskNotifyWait(0, 0, NULL, (until_expire < until_conn) ? until_expire : until_conn);
+			continue;
+		}
+
+		TickType_t since_stats = xTaskGetTickCount() - last_stats;
+		TickType_t until_stats = (since_stats >= pdMS_TO_TICKS(MQTT_STATS_PERIOD_MS)) ?
+				0 : (pdMS_TO_TICKS(MQTT_STATS_PERIOD_MS) - since_stats);
+
+		if (until_stats == 0)
+		{
+			if (mqtt_connected)
+			{
+				mqtt_publish_gss_stats();
+				mqtt_publish_deadband_stats();
+			}
+			last_stats = xTaskGetTickCount();
+			until_stats = pdMS_TO_TICKS(MQTT_STATS_PERIOD_MS);
+		}
 
-		// wait for the reception of a signal that requires to publish a message
-		if (gss_wait_for_signal(GSS_ID_MQTT_SENDER, &recv_msg, portMAX_DELAY) == ESP_OK)
+		// el batch en curso ha alcanzado su edad maxima
+		TickType_t until_batch = mqtt_batch_ticks_to_deadline(batch_seconds_cfg);
+		if (until_batch == 0)
+		{
+			mqtt_flush_batch("tiempo");
+			until_batch = portMAX_DELAY;
+		}
+
+		// reenvio del outbox a ritmo limitado, el trafico en vivo va primero
+		TickType_t until_replay = portMAX_DELAY;
+		if (mqtt_connected && (mqtt_outbox_pending() > 0))
+		{
+			TickType_t since_replay = xTaskGetTickCount() - last_replay;
+
+			if (since_replay >= pdMS_TO_TICKS(MQTT_OUTBOX_REPLAY_PERIOD_MS))
+			{
+				mqtt_replay_outbox();
+				last_replay = xTaskGetTickCount();
+				since_replay = 0;
+			}
+			until_replay = pdMS_TO_TICKS(MQTT_OUTBOX_REPLAY_PERIOD_MS) - since_replay;
+		}
+
+		TickType_t wait_ticks = (until_batch < until_stats) ? until_batch : until_stats;
+		if (until_replay < wait_ticks)
+		{
+			wait_ticks = until_replay;
+		}
+		if (until_conn < wait_ticks)
+		{
+			wait_ticks = until_conn;
+		}
+
+		// wait for the reception of a signal that requires to publish a message,
+		// at most until the next statistics report, batch deadline, replay turn
+		// or connection retry
+		if (gss_wait_for_signal(mqtt_gss_channel, &recv_msg, wait_ticks) == ESP_OK)
 		{
 			switch (recv_msg.signal)
 			{
 			case GSS_SENSORS_DATA_READY:
-				if ((json_status = sensors_type_to_JSON(&out1, JSON_OUT_BUFFER_SIZE, (Sensors_data_ptr)recv_msg.data)) == ESP_OK)
-				{
-					int msg_id = esp_mqtt_client_publish(client, TOPIC_MEASURES, buffer, 0, 0, 0);
-					ESP_LOGI(TAG, "sent successful on TOPIC_MEASURES, msg_id=%d: %s", msg_id, buffer);
+				record = (const gss_sensors_record_t *)recv_msg.data;
 
-					ESP_LOGI(TAG, "Liberando memoria en %p", recv_msg.data);
-					gss_release_message(&recv_msg);
+				if ((rollup_seconds_cfg > 0) && mqtt_connected)
+				{
+					// en modo agregado la muestra solo sale dentro del rollup de su
+					// ventana. Sin conexion se sigue guardando en el outbox, los
+					// rollups no caben en sus registros
 				}
-				else
+				else if ((deadband_result = mqtt_deadband_evaluate(&deadband_cfg, &record->last,
+						record->published_us)) != MQTT_DEADBAND_SUPPRESS)
 				{
-					ESP_LOGE(TAG, "JSON generation for sensors data failed with code: %s", esp_err_to_name(json_status));
+					ESP_LOGD(TAG, "Muestra publicada (%s)", mqtt_deadband_result_to_string(deadband_result));
+					mqtt_send_sample(&record->last, record->published_us, batch_samples_cfg);
 				}
+				gss_release_message(&recv_msg);
 
 				break;
 			case GSS_ALARM_READY:
-				if ((json_status = alarm_type_to_JSON(&out1, JSON_OUT_BUFFER_SIZE, (Alarm_data_ptr)recv_msg.data)) == ESP_OK)
+				// las muestras que llevaron a la alarma salen antes que ella,
+				// tambien la ultima si el filtro por cambio la suprimio
+				if (mqtt_deadband_take_suppressed(&suppressed_sample, &suppressed_us))
+				{
+					mqtt_send_sample(&suppressed_sample, suppressed_us, batch_samples_cfg);
+				}
+				mqtt_flush_batch("alarma");
+				sent_msg_id = -1;
+
+				if (mqtt_connected)
 				{
-					int msg_id = esp_mqtt_client_publish(client, TOPIC_ALARMS, buffer, 0, 0, 0);
-					ESP_LOGI(TAG, "sent successful on TOPIC_ALARMS, msg_id=%d: %s", msg_id, buffer);
+#if MQTT_PUBLISH_BINARY
+					sent_msg_id = mqtt_publish_alarm_binary((Alarm_data_ptr)recv_msg.data);
+#endif
+#if MQTT_PUBLISH_JSON
+					size_t len = aqi_json_write_alarm(buffer, JSON_OUT_BUFFER_SIZE, (const Alarm_data_t *)recv_msg.data);
 
-					ESP_LOGI(TAG, "Liberando memoria en %p", recv_msg.data);
-					gss_release_message(&recv_msg);
+					if (len > 0)
+					{
+						int msg_id = mqtt_publish(TOPIC_ALARMS, buffer, (int)len, MQTT_ALARMS_QOS);
+						ESP_LOGI(TAG, "sent successful on TOPIC_ALARMS, msg_id=%d: %s", msg_id, buffer);
+						if (sent_msg_id < 0)
+						{
+							sent_msg_id = msg_id;
+						}
+					}
+					else
+					{
+						ESP_LOGE(TAG, "JSON generation for alarms data failed");
+					}
+#endif
+				}
+
+				// la latencia se mide con el primer formato que acepta el cliente
+				if (sent_msg_id >= 0)
+				{
+					aqi_alarm_manager_record_delivery(AQI_ALARM_SINK_MQTT, (Alarm_data_ptr)recv_msg.data);
 				}
 				else
 				{
-					ESP_LOGE(TAG, "JSON generation for alarms data failed with code: %s", esp_err_to_name(json_status));
+					// sin conexion o rechazada, la transicion se reenvia desde el outbox
+					mqtt_outbox_append_alarm((Alarm_data_ptr)recv_msg.data);
 				}
+				// devolver la referencia del canal a la alarma compartida
+				gss_release_message(&recv_msg);
 
+				break;
+			case GSS_ROLLUP_READY:
+				if (mqtt_connected)
+				{
+					mqtt_publish_rollup((const Sensors_rollup_t *)recv_msg.data);
+				}
+				else
+				{
+					ESP_LOGW(TAG, "Rollup descartado sin conexion, sus muestras van al outbox");
+				}
+				gss_release_message(&recv_msg);
+
+				break;
+			case GSS_CONFIG_CHANGED:
+				// solo llegan las variables de MQTT_SENDER_CONFIG_VARS
+				mqtt_sender_load_config(&batch_samples_cfg, &batch_seconds_cfg, &deadband_cfg,
+						&rollup_seconds_cfg);
+				gss_release_message(&recv_msg);
+
+				break;
+			default:
+				// senal a la que no se publica nada
+				gss_release_message(&recv_msg);
 				break;
 			}
 		}
@@ -175,11 +1193,47 @@ esp_err_t mqtt_app_start(const char* url)
 {
 	esp_err_t error;
 
+	// canal del GSS para el sender, se registra una sola vez
+	if (mqtt_gss_channel == GSS_ID_INVALID)
+	{
+		gss_channel_config_t channel_cfg = {
+				.name = MQTT_GSS_CHANNEL_NAME,
+				.depth = MQTT_GSS_CHANNEL_DEPTH,
+				.policy = GSS_OVERFLOW_DROP_OLDEST,
+				.signals = GSS_SIGNAL_BIT(GSS_SENSORS_DATA_READY) | GSS_SIGNAL_BIT(GSS_ALARM_READY)
+						| GSS_SIGNAL_BIT(GSS_ROLLUP_READY) | GSS_SIGNAL_BIT(GSS_CONFIG_CHANGED),
+				.config_vars = MQTT_SENDER_CONFIG_VARS,
+		};
+		ESP_RETURN_ON_ERROR(gss_register_channel(&channel_cfg, &mqtt_gss_channel),
+				TAG, "No se pudo registrar el canal del GSS");
+	}
+
+#if CONFIG_AQI_MQTT_OUTBOX
+	// sin outbox el sender sigue funcionando, solo se pierden los datos sin conexion
+	if (mqtt_outbox_init() != ESP_OK)
+	{
+		ESP_LOGE(TAG, "Outbox no disponible");
+	}
+#endif
+
 	if (client==NULL){
 
+		// topics con handler, antes de que el cliente reciba nada
+		if (mqtt_inbound_register(TOPIC_CONFIG, mqtt_on_config) == ESP_ERR_NO_MEM)
+		{
+			return ESP_ERR_NO_MEM;
+		}
+
 		esp_mqtt_client_config_t mqtt_cfg = {
 				.broker.address.uri = MQTT_BROKER_URL,
+				// los reintentos los gestiona el sender con backoff
+				.network.disable_auto_reconnect = true,
+				.session.message_retransmit_timeout = MQTT_QOS1_RETRANSMIT_MS,
 		};
+
+		// los mensajes QoS 1 quedan en el outbox del cliente hasta su PUBACK
+		mqtt_cfg.outbox.limit = heap_caps_get_free_size(MALLOC_CAP_DEFAULT) / MQTT_QOS1_OUTBOX_HEAP_DIVISOR;
+		ESP_LOGI(TAG, "Limite del outbox del cliente: %llu bytes", (unsigned long long)mqtt_cfg.outbox.limit);
 		if(url[0] != '\0'){
 			mqtt_cfg.broker.address.uri= url;
 		}
@@ -187,7 +1241,29 @@ esp_err_t mqtt_app_start(const char* url)
 		ESP_LOGI(TAG, "Inicializando cliente MQTT con URI: %s", mqtt_cfg.broker.address.uri);
 
 		client = esp_mqtt_client_init(&mqtt_cfg);
+		if (client == NULL)
+		{
+			ESP_LOGE(TAG, "No se pudo crear el cliente MQTT");
+			return ESP_ERR_NO_MEM;
+		}
 		esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, client);
+
+		// un unico sender durante toda la vida del cliente. Se crea con el
+		// cliente ya listo y antes de arrancarlo, para que no se pierda el
+		// primer CONNECTED
+		if (senderTaskHandler == NULL)
+		{
+			if (xTaskCreatePinnedToCore(mqtt_sender_task, "mqtt_sender", MQTT_SENDER_TASK_STACK_SIZE, NULL,
+					MQTT_SENDER_TASK_PRIORITY, &senderTaskHandler, 0) != pdPASS)
+			{
+				senderTaskHandler = NULL;
+				ESP_LOGE(TAG, "No se pudo crear la tarea del sender");
+				esp_mqtt_client_destroy(client);
+				client = NULL;
+				return ESP_ERR_NO_MEM;
+			}
+		}
+
 		error=esp_mqtt_client_start(client);
 		return error;
 	}
@@ -198,4 +1274,42 @@ esp_err_t mqtt_app_start(const char* url)
 	}
 }
 
+const char* mqtt_conn_state_to_string(MQTT_CONN_STATE state)
+{
+	switch (state)
+	{
+		case MQTT_CONN_CONNECTING:
+			return "CONNECTING";
+		case MQTT_CONN_CONNECTED:
+			return "CONNECTED";
+		case MQTT_CONN_BACKOFF:
+			return "BACKOFF";
+		default:
+			return "UNKNOWN";
+	}
+}
+
+void mqtt_get_connection_stats(mqtt_connection_stats_t *out)
+{
+	if (out == NULL)
+	{
+		return;
+	}
+
+	portENTER_CRITICAL(&conn_lock);
+	*out = conn_stats;
+	portEXIT_CRITICAL(&conn_lock);
+}
+
+void mqtt_get_qos1_stats(mqtt_qos1_stats_t *out)
+{
+	if (out == NULL)
+	{
+		return;
+	}
+
+	portENTER_CRITICAL(&qos1_lock);
+	*out = qos1_stats;
+	portEXIT_CRITICAL(&qos1_lock);
+}
 
@@ -1,6 +1,10 @@
 #ifndef __MQTT_H__
 #define __MQTT_H__
 
+#include <stdint.h>
+
+#include "esp_err.h"
+
 //*****************************************************************************
 //      DEFINICIONES
 //*****************************************************************************
@@ -13,14 +17,119 @@
 #define TOPIC_MEASURES	MQTT_TOPIC_SUBSCRIBE_BASE "/measures"
 #define TOPIC_CONFIG	MQTT_TOPIC_SUBSCRIBE_BASE "/config"
 #define TOPIC_ALARMS	MQTT_TOPIC_SUBSCRIBE_BASE "/alarms"
+#define TOPIC_STATS		MQTT_TOPIC_SUBSCRIBE_BASE "/stats"
+// varias muestras por mensaje cuando batch_n > 1 en la config
+#define TOPIC_MEASURES_BATCH	TOPIC_MEASURES "/batch"
+// payload binario (aqi_wire_format.h) segun CONFIG_AQI_MQTT_PAYLOAD_*
+#define TOPIC_MEASURES_BIN			TOPIC_MEASURES "/bin"
+#define TOPIC_ALARMS_BIN			TOPIC_ALARMS "/bin"
+#define TOPIC_MEASURES_BATCH_BIN	TOPIC_MEASURES_BATCH "/bin"
+// datos guardados en el outbox durante una desconexion
+#define TOPIC_MEASURES_REPLAY		TOPIC_MEASURES "/replay"
+#define TOPIC_ALARMS_REPLAY			TOPIC_ALARMS "/replay"
+// agregados por ventana cuando rollup_sec > 0 en la config
+#define TOPIC_MEASURES_ROLLUP		TOPIC_MEASURES "/rollup"
+// resultado de cada cambio recibido en TOPIC_CONFIG y revision de la config
+#define TOPIC_CONFIG_ACK			TOPIC_CONFIG "/ack"
 
 #define JSON_OUT_BUFFER_SIZE	150
 
+// Canal del GSS del que se alimenta el sender
+#define MQTT_GSS_CHANNEL_NAME	"mqtt"
+#define MQTT_GSS_CHANNEL_DEPTH	6
+
+// Periodo de publicacion de la telemetria de los canales del GSS
+#define MQTT_STATS_PERIOD_MS		60000
+#define MQTT_STATS_BUFFER_SIZE		400
+
+// JSON de TOPIC_CONFIG_ACK: revision, estado y claves cambiadas
+#define MQTT_CONFIG_ACK_BUFFER_SIZE	384
+
+// Tamano maximo del JSON de cabecera y de cada muestra de un batch
+#define MQTT_BATCH_HEADER_JSON_SIZE	48
+#define MQTT_BATCH_SAMPLE_JSON_SIZE	112
+
+// JSON de un rollup: cabecera y min/max/mean/stddev de los cuatro campos
+#define MQTT_ROLLUP_BUFFER_SIZE		448
+
+// Reenvio del outbox: MQTT_OUTBOX_REPLAY_BURST registros cada
+// MQTT_OUTBOX_REPLAY_PERIOD_MS, varias veces el ritmo de las medidas
+#define MQTT_OUTBOX_REPLAY_PERIOD_MS	250
+#define MQTT_OUTBOX_REPLAY_BURST		2
+#define MQTT_REPLAY_BUFFER_SIZE			256
+
+#define MQTT_SENDER_TASK_STACK_SIZE		4096
+#define MQTT_SENDER_TASK_PRIORITY		5
+
+// Reconexion: backoff exponencial con jitter entre estos limites, y tiempo
+// maximo esperando respuesta a un intento
+#define MQTT_BACKOFF_BASE_MS			1000
+#define MQTT_BACKOFF_MAX_MS				60000
+#define MQTT_CONNECT_TIMEOUT_MS			30000
+
+// Avisos del handler de eventos al sender (bits de notificacion)
+#define MQTT_NOTIFY_CONNECTED			(1u << 0)
+#define MQTT_NOTIFY_DISCONNECTED		(1u << 1)
+#define MQTT_NOTIFY_WINDOW				(1u << 2)	// hueco libre en la ventana QoS 1
+
+// Ventana de publicaciones QoS 1 sin PUBACK. El cliente retransmite cada
+// MQTT_QOS1_RETRANSMIT_MS y la publicacion se da por perdida tras
+// MQTT_QOS1_ACK_TIMEOUT_MS. Su outbox puede usar hasta 1/DIVISOR del heap
+// libre al arrancar
+#define MQTT_QOS1_WINDOW				CONFIG_AQI_MQTT_QOS1_WINDOW
+#define MQTT_QOS1_RETRANSMIT_MS			1000
+#define MQTT_QOS1_ACK_TIMEOUT_MS		30000
+#define MQTT_QOS1_OUTBOX_HEAP_DIVISOR	16
+
+// Histograma de latencias del PUBACK: el cubo b cuenta las menores de
+// MQTT_ACK_BUCKET_LIMIT_MS(b), el ultimo el resto
+#define MQTT_ACK_HIST_BUCKETS			10
+#define MQTT_ACK_HIST_BASE_MS			8
+#define MQTT_ACK_BUCKET_LIMIT_MS(b)		(MQTT_ACK_HIST_BASE_MS << (b))
+
+typedef enum
+{
+	MQTT_CONN_CONNECTING = 0,	// esperando respuesta del cliente a un intento
+	MQTT_CONN_CONNECTED,
+	MQTT_CONN_BACKOFF,			// desconectado, esperando para reintentar
+} MQTT_CONN_STATE;
+
+typedef struct
+{
+	MQTT_CONN_STATE state;
+	uint32_t connects;			// conexiones establecidas
+	uint32_t reconnects;		// conexiones tras una desconexion
+	uint32_t attempts;			// reintentos lanzados por el sender
+	uint32_t backoff_ms;		// espera del backoff en curso
+	uint32_t last_reconnect_ms;	// desde la ultima desconexion hasta reconectar
+	uint32_t max_reconnect_ms;
+} mqtt_connection_stats_t;
+
+typedef struct
+{
+	uint32_t sent;
+	uint32_t acked;
+	uint32_t retransmitted;		// PUBACK posterior a MQTT_QOS1_RETRANSMIT_MS
+	uint32_t timeouts;			// sin PUBACK en MQTT_QOS1_ACK_TIMEOUT_MS
+	uint32_t deleted;			// descartadas por el outbox del cliente
+	uint32_t window_full;		// esperas del sender por falta de hueco
+	uint8_t in_flight;
+	uint8_t window_peak;
+	uint32_t rtt_max_ms;
+	uint32_t rtt_hist[MQTT_ACK_HIST_BUCKETS];
+} mqtt_qos1_stats_t;
+
 //*****************************************************************************
 //      PROTOTIPOS DE FUNCIONES
 //*****************************************************************************
 
 esp_err_t mqtt_app_start(const char* url);
 
+void mqtt_get_connection_stats(mqtt_connection_stats_t *out);
+
+const char* mqtt_conn_state_to_string(MQTT_CONN_STATE state);
+
+void mqtt_get_qos1_stats(mqtt_qos1_stats_t *out);
+
 
 #endif //  __MQTT_H__
@@ -0,0 +1,188 @@
+/*
+ * mqtt_deadband.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "mqtt_deadband.h"
+
+// solo lo usa el sender MQTT, el cerrojo protege las estadisticas que lee
+// la consola
+static portMUX_TYPE deadband_lock = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_deadband_stats_t deadband_stats;
+
+static bool has_reference = false;
+static Sensors_data_t last_published;
+static int64_t last_published_us = 0;
+
+// ultima muestra suprimida, pendiente por si salta una alarma
+static bool has_suppressed = false;
+static Sensors_data_t last_suppressed;
+static int64_t last_suppressed_us = 0;
+
+/**
+ * true si el campo se ha movido al menos su banda absoluta o, si esta
+ * activada, la relativa respecto al ultimo valor publicado
+ */
+static bool mqtt_deadband_crossed(uint16_t value, uint16_t reference, uint16_t band, uint8_t rel_pct)
+{
+	uint32_t diff = (value > reference) ? (uint32_t)(value - reference) : (uint32_t)(reference - value);
+
+	if (diff == 0)
+	{
+		return false;
+	}
+	if ((band == 0) && (rel_pct == 0))
+	{
+		return true;
+	}
+	if ((band > 0) && (diff >= band))
+	{
+		return true;
+	}
+
+	return (rel_pct > 0) && ((diff * 100u) >= ((uint32_t)rel_pct * reference));
+}
+
+static void mqtt_deadband_set_reference(const Sensors_data_t *sample, int64_t timestamp_us)
+{
+	last_published = *sample;
+	last_published_us = timestamp_us;
+	has_reference = true;
+	has_suppressed = false;
+}
+
+static void mqtt_deadband_count(MQTT_DEADBAND_RESULT result)
+{
+	portENTER_CRITICAL(&deadband_lock);
+	switch (result)
+	{
+	case MQTT_DEADBAND_SUPPRESS:
+		deadband_stats.evaluated++;
+		deadband_stats.suppressed++;
+		break;
+	case MQTT_DEADBAND_ALARM:
+		// ya se conto como evaluada y suprimida, ahora sale publicada
+		deadband_stats.suppressed--;
+		deadband_stats.published++;
+		deadband_stats.by_alarm++;
+		break;
+	default:
+		deadband_stats.evaluated++;
+		deadband_stats.published++;
+		if (result == MQTT_DEADBAND_CHANGE)
+		{
+			deadband_stats.by_change++;
+		}
+		else if (result == MQTT_DEADBAND_HEARTBEAT)
+		{
+			deadband_stats.by_heartbeat++;
+		}
+		break;
+	}
+	portEXIT_CRITICAL(&deadband_lock);
+}
+
+MQTT_DEADBAND_RESULT mqtt_deadband_evaluate(const mqtt_deadband_cfg_t *cfg,
+								const Sensors_data_t *sample, int64_t timestamp_us)
+{
+	MQTT_DEADBAND_RESULT result;
+
+	if ((cfg == NULL) || (sample == NULL))
+	{
+		return MQTT_DEADBAND_DISABLED;
+	}
+
+	if (cfg->heartbeat_s == 0)
+	{
+		result = MQTT_DEADBAND_DISABLED;
+	}
+	else if (!has_reference)
+	{
+		result = MQTT_DEADBAND_FIRST;
+	}
+	else if (mqtt_deadband_crossed(sample->temperature_celsius, last_published.temperature_celsius,
+					cfg->temperature, cfg->rel_pct)
+			|| mqtt_deadband_crossed(sample->relative_humidity, last_published.relative_humidity,
+					cfg->humidity, cfg->rel_pct)
+			|| mqtt_deadband_crossed(sample->voc_index, last_published.voc_index,
+					cfg->voc_index, cfg->rel_pct))
+	{
+		result = MQTT_DEADBAND_CHANGE;
+	}
+	else if ((timestamp_us - last_published_us) >= ((int64_t)cfg->heartbeat_s * 1000000))
+	{
+		result = MQTT_DEADBAND_HEARTBEAT;
+	}
+	else
+	{
+		result = MQTT_DEADBAND_SUPPRESS;
+	}
+
+	if (result == MQTT_DEADBAND_SUPPRESS)
+	{
+		last_suppressed = *sample;
+		last_suppressed_us = timestamp_us;
+		has_suppressed = true;
+	}
+	else
+	{
+		mqtt_deadband_set_reference(sample, timestamp_us);
+	}
+	mqtt_deadband_count(result);
+
+	return result;
+}
+
+bool mqtt_deadband_take_suppressed(Sensors_data_t *out, int64_t *timestamp_us)
+{
+	if (!has_suppressed || (out == NULL) || (timestamp_us == NULL))
+	{
+		return false;
+	}
+
+	*out = last_suppressed;
+	*timestamp_us = last_suppressed_us;
+	mqtt_deadband_set_reference(&last_suppressed, last_suppressed_us);
+	mqtt_deadband_count(MQTT_DEADBAND_ALARM);
+
+	return true;
+}
+
+void mqtt_deadband_get_stats(mqtt_deadband_stats_t *out)
+{
+	if (out == NULL)
+	{
+		return;
+	}
+
+	portENTER_CRITICAL(&deadband_lock);
+	*out = deadband_stats;
+	portEXIT_CRITICAL(&deadband_lock);
+}
+
+const char *mqtt_deadband_result_to_string(MQTT_DEADBAND_RESULT result)
+{
+	switch (result)
+	{
+	case MQTT_DEADBAND_SUPPRESS:
+		return "suprimida";
+	case MQTT_DEADBAND_DISABLED:
+		return "sin filtro";
+	case MQTT_DEADBAND_FIRST:
+		return "primera";
+	case MQTT_DEADBAND_CHANGE:
+		return "cambio";
+	case MQTT_DEADBAND_HEARTBEAT:
+		return "heartbeat";
+	case MQTT_DEADBAND_ALARM:
+		return "alarma";
+	default:
+		return "desconocido";
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * mqtt_deadband.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Filtro de publicacion por cambio. Una muestra solo se publica si algun
+ *  campo se ha movido mas que su banda muerta respecto a la ultima
+ *  publicada, si ha pasado el heartbeat sin publicar nada o si salta una
+ *  alarma. Las bandas son absolutas por campo (temperatura, humedad e
+ *  indice VOC) y opcionalmente relativas, en % del ultimo valor publicado.
+ *  voc_raw no interviene, es demasiado ruidoso y su informacion ya esta en
+ *  el indice.
+ *
+ *  Con heartbeat 0 el filtro esta desactivado y se publican todas.
+ */
+
+#ifndef MAIN_MQTT_DEADBAND_H_
+#define MAIN_MQTT_DEADBAND_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors_type.h"
+
+typedef struct
+{
+	// banda absoluta de cada campo. Con 0 el campo solo usa la relativa, y
+	// si esta tambien es 0 se publica cualquier cambio
+	uint16_t temperature;
+	uint16_t humidity;
+	uint16_t voc_index;
+	uint8_t rel_pct;			// banda relativa comun (0: desactivada)
+	uint16_t heartbeat_s;		// maximo sin publicar (0: filtro desactivado)
+} mqtt_deadband_cfg_t;
+
+typedef enum
+{
+	MQTT_DEADBAND_SUPPRESS = 0,
+	MQTT_DEADBAND_DISABLED,		// filtro desactivado, se publica todo
+	MQTT_DEADBAND_FIRST,		// primera muestra desde el arranque
+	MQTT_DEADBAND_CHANGE,
+	MQTT_DEADBAND_HEARTBEAT,
+	MQTT_DEADBAND_ALARM,
+} MQTT_DEADBAND_RESULT;
+
+typedef struct
+{
+	uint32_t evaluated;
+	uint32_t published;
+	uint32_t suppressed;
+	uint32_t by_change;
+	uint32_t by_heartbeat;
+	uint32_t by_alarm;
+} mqtt_deadband_stats_t;
+
+/**
+ * @brief Decide si una muestra se publica y, si es asi, la toma como
+ * 		  referencia para las siguientes
+ *
+ * @param timestamp_us	instante de la muestra (esp_timer_get_time)
+ *
+ * @return MQTT_DEADBAND_SUPPRESS si no hay que publicarla o el motivo por
+ * 		   el que se publica
+ */
+MQTT_DEADBAND_RESULT mqtt_deadband_evaluate(const mqtt_deadband_cfg_t *cfg,
+								const Sensors_data_t *sample, int64_t timestamp_us);
+
+/**
+ * @brief Al saltar una alarma, recupera la ultima muestra si se suprimio
+ * 		  para publicarla antes que la alarma
+ *
+ * @return true si 'out' tiene una muestra a publicar
+ */
+bool mqtt_deadband_take_suppressed(Sensors_data_t *out, int64_t *timestamp_us);
+
+void mqtt_deadband_get_stats(mqtt_deadband_stats_t *out);
+
+const char *mqtt_deadband_result_to_string(MQTT_DEADBAND_RESULT result);
+
+#endif /* MAIN_MQTT_DEADBAND_H_ */
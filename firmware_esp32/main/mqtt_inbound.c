@@ -0,0 +1,220 @@
+/*
+ * mqtt_inbound.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "mqtt_inbound.h"
+
+static const char *TAG = "MQTT_INBOUND";
+
+typedef struct
+{
+	const char *topic;
+	int topic_len;
+	mqtt_inbound_handler_t handler;
+} mqtt_inbound_route_t;
+
+typedef enum
+{
+	INBOUND_IDLE = 0,
+	INBOUND_ASSEMBLING,		// juntando los fragmentos en el buffer
+	INBOUND_SKIPPING,		// descartando los fragmentos de un mensaje
+} INBOUND_STATE;
+
+static mqtt_inbound_route_t routes[MQTT_INBOUND_MAX_ROUTES];
+static int route_count = 0;
+
+// mensaje en curso, solo lo usa la tarea del cliente MQTT
+static INBOUND_STATE state = INBOUND_IDLE;
+static const mqtt_inbound_route_t *pending_route = NULL;
+static int pending_total = 0;
+static int pending_received = 0;
+static char reassembly_buffer[MQTT_INBOUND_BUFFER_SIZE + 1];
+
+// el cerrojo protege las estadisticas que lee la consola
+static portMUX_TYPE inbound_lock = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_inbound_stats_t inbound_stats;
+
+#define INBOUND_STATS_INC(field)	do { \
+		portENTER_CRITICAL(&inbound_lock); \
+		inbound_stats.field++; \
+		portEXIT_CRITICAL(&inbound_lock); \
+	} while (0)
+
+static const mqtt_inbound_route_t* mqtt_inbound_find_route(const char *topic, int topic_len)
+{
+	for (int i = 0; i < route_count; i++)
+	{
+		if ((routes[i].topic_len == topic_len) && (memcmp(routes[i].topic, topic, topic_len) == 0))
+		{
+			return &routes[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void mqtt_inbound_deliver(const mqtt_inbound_route_t *route, const char *data, int data_len)
+{
+	esp_err_t err = route->handler(data, data_len);
+
+	portENTER_CRITICAL(&inbound_lock);
+	inbound_stats.delivered++;
+	if (err != ESP_OK)
+	{
+		inbound_stats.handler_errors++;
+	}
+	if ((uint32_t)data_len > inbound_stats.max_len)
+	{
+		inbound_stats.max_len = (uint32_t)data_len;
+	}
+	portEXIT_CRITICAL(&inbound_lock);
+}
+
+esp_err_t mqtt_inbound_register(const char *topic, mqtt_inbound_handler_t handler)
+{
+	if ((topic == NULL) || (topic[0] == '\0') || (handler == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if (mqtt_inbound_find_route(topic, strlen(topic)) != NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	if (route_count >= MQTT_INBOUND_MAX_ROUTES)
+	{
+		ESP_LOGE(TAG, "Tabla de topics llena, no se registra %s", topic);
+		return ESP_ERR_NO_MEM;
+	}
+
+	routes[route_count].topic = topic;
+	routes[route_count].topic_len = strlen(topic);
+	routes[route_count].handler = handler;
+	route_count++;
+
+	return ESP_OK;
+}
+
+void mqtt_inbound_on_data(const char *topic, int topic_len, const char *data, int data_len,
+						int total_len, int offset)
+{
+	const mqtt_inbound_route_t *route;
+
+	if ((data_len < 0) || (offset < 0) || (total_len < (offset + data_len)))
+	{
+		return;
+	}
+
+	// continuacion de un mensaje
+	if (offset > 0)
+	{
+		if ((state == INBOUND_IDLE) || (offset != pending_received) || (total_len != pending_total))
+		{
+			if (state != INBOUND_SKIPPING)
+			{
+				ESP_LOGW(TAG, "Fragmento inesperado en %d de %d bytes", offset, total_len);
+				INBOUND_STATS_INC(broken);
+			}
+			state = INBOUND_IDLE;
+			return;
+		}
+
+		if (state == INBOUND_ASSEMBLING)
+		{
+			memcpy(&reassembly_buffer[offset], data, data_len);
+		}
+		pending_received += data_len;
+
+		if (pending_received == pending_total)
+		{
+			if (state == INBOUND_ASSEMBLING)
+			{
+				reassembly_buffer[pending_total] = '\0';
+				mqtt_inbound_deliver(pending_route, reassembly_buffer, pending_total);
+			}
+			state = INBOUND_IDLE;
+		}
+		return;
+	}
+
+	// primer fragmento, el anterior mensaje no se completo
+	if (state == INBOUND_ASSEMBLING)
+	{
+		ESP_LOGW(TAG, "Mensaje incompleto (%d de %d bytes), se descarta", pending_received, pending_total);
+		INBOUND_STATS_INC(broken);
+	}
+	state = INBOUND_IDLE;
+
+	ESP_LOGI(TAG, "Topic %.*s, %d bytes", topic_len, (topic != NULL) ? topic : "", total_len);
+
+	route = (topic != NULL) ? mqtt_inbound_find_route(topic, topic_len) : NULL;
+
+	// mensaje completo en un evento: se entrega sin copiarlo
+	if (data_len == total_len)
+	{
+		if (route != NULL)
+		{
+			mqtt_inbound_deliver(route, data, data_len);
+		}
+		else
+		{
+			INBOUND_STATS_INC(unrouted);
+		}
+		return;
+	}
+
+	pending_route = route;
+	pending_total = total_len;
+	pending_received = data_len;
+	state = INBOUND_SKIPPING;
+
+	if (route == NULL)
+	{
+		INBOUND_STATS_INC(unrouted);
+		return;
+	}
+
+	INBOUND_STATS_INC(fragmented);
+	if (total_len > MQTT_INBOUND_BUFFER_SIZE)
+	{
+		ESP_LOGE(TAG, "Mensaje de %d bytes mayor que el buffer (%d), se descarta",
+				total_len, MQTT_INBOUND_BUFFER_SIZE);
+		INBOUND_STATS_INC(too_big);
+		return;
+	}
+
+	memcpy(reassembly_buffer, data, data_len);
+	state = INBOUND_ASSEMBLING;
+}
+
+void mqtt_inbound_reset(void)
+{
+	if (state == INBOUND_ASSEMBLING)
+	{
+		INBOUND_STATS_INC(broken);
+	}
+	state = INBOUND_IDLE;
+}
+
+void mqtt_inbound_get_stats(mqtt_inbound_stats_t *out)
+{
+	if (out == NULL)
+	{
+		return;
+	}
+
+	portENTER_CRITICAL(&inbound_lock);
+	*out = inbound_stats;
+	portEXIT_CRITICAL(&inbound_lock);
+}
@@ -0,0 +1,75 @@
+/*
+ * mqtt_inbound.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Mensajes recibidos por MQTT. Cada topic suscrito tiene un handler
+ *  registrado en una tabla; el topic del evento se compara por longitud y
+ *  memcmp, sin copiarlo ni terminarlo en '\0'.
+ *
+ *  El cliente parte en varios MQTT_EVENT_DATA los mensajes mayores que su
+ *  buffer: solo el primero lleva el topic y cada uno indica su offset y la
+ *  longitud total. Los fragmentos se juntan en un buffer estatico de
+ *  CONFIG_AQI_MQTT_INBOUND_BUFFER_SIZE y el handler recibe el mensaje
+ *  completo. Un mensaje que llega entero se entrega sin copiarlo.
+ *
+ *  Todo se ejecuta en la tarea del cliente MQTT, los handlers se registran
+ *  antes de arrancarlo.
+ */
+
+#ifndef MAIN_MQTT_INBOUND_H_
+#define MAIN_MQTT_INBOUND_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define MQTT_INBOUND_MAX_ROUTES			8
+#define MQTT_INBOUND_BUFFER_SIZE		CONFIG_AQI_MQTT_INBOUND_BUFFER_SIZE
+
+/**
+ * Handler de un topic. data no esta terminado en '\0' y solo es valido
+ * durante la llamada
+ */
+typedef esp_err_t (*mqtt_inbound_handler_t)(const char *data, int data_len);
+
+typedef struct
+{
+	uint32_t delivered;			// mensajes entregados a un handler
+	uint32_t fragmented;		// mensajes recibidos en varios eventos
+	uint32_t unrouted;			// topics sin handler
+	uint32_t too_big;			// fragmentados y mayores que el buffer
+	uint32_t broken;			// fragmentos fuera de orden o mensajes incompletos
+	uint32_t handler_errors;	// el handler no devolvio ESP_OK
+	uint32_t max_len;			// mayor mensaje entregado
+} mqtt_inbound_stats_t;
+
+/**
+ * @brief Registra el handler de un topic. El texto del topic debe ser
+ * 		  constante, no se copia
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_STATE si el topic ya
+ * 		   tiene handler o ESP_ERR_NO_MEM si la tabla esta llena
+ */
+esp_err_t mqtt_inbound_register(const char *topic, mqtt_inbound_handler_t handler);
+
+/**
+ * @brief Procesa un MQTT_EVENT_DATA
+ *
+ * @param topic, topic_len	topic del evento, solo en el primer fragmento
+ * @param data, data_len	datos de este fragmento
+ * @param total_len			longitud total del mensaje
+ * @param offset			posicion de este fragmento en el mensaje
+ */
+void mqtt_inbound_on_data(const char *topic, int topic_len, const char *data, int data_len,
+						int total_len, int offset);
+
+/**
+ * @brief Descarta el mensaje a medio recibir, p.ej. al desconectarse
+ */
+void mqtt_inbound_reset(void);
+
+void mqtt_inbound_get_stats(mqtt_inbound_stats_t *out);
+
+#endif /* MAIN_MQTT_INBOUND_H_ */
@@ -0,0 +1,530 @@
+/*
+ * mqtt_outbox.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include "mqtt_outbox.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+//Include FreeRTOS headers
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_crc.h"
+#include "esp_timer.h"
+
+static const char *TAG = "MQTT_OUTBOX";
+
+#define MQTT_OUTBOX_MAGIC			0x584F4251	// "QBOX"
+#define MQTT_OUTBOX_VERSION			1
+
+#define MQTT_OUTBOX_CAPACITY		CONFIG_AQI_MQTT_OUTBOX_RECORDS
+
+// registros leidos de una vez al recorrer el log en el arranque
+#define MQTT_OUTBOX_SCAN_CHUNK		32
+#define MQTT_OUTBOX_ZERO_CHUNK		512
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t boot;
+	uint32_t replay_seq;	// siguiente secuencia a reenviar
+	uint32_t capacity;
+	uint32_t crc;
+} mqtt_outbox_header_t;
+
+static FILE *outbox_file = NULL;
+static SemaphoreHandle_t outbox_lock = NULL;
+static mqtt_outbox_header_t header;
+
+static uint32_t next_seq = 0;		// siguiente secuencia a asignar
+static uint32_t flushed_seq = 0;	// las secuencias anteriores ya estan en flash
+static uint32_t tail_seq = 0;		// registro pendiente mas antiguo
+static uint32_t popped_since_header = 0;
+
+// registros [flushed_seq, next_seq) todavia en RAM
+static mqtt_outbox_record_t staging[MQTT_OUTBOX_STAGING_RECORDS];
+
+static mqtt_outbox_stats_t outbox_stats;
+
+static uint32_t mqtt_outbox_record_crc(const mqtt_outbox_record_t *record)
+{
+	return esp_crc32_le(0, (const uint8_t*)record, offsetof(mqtt_outbox_record_t, crc));
+}
+
+static uint32_t mqtt_outbox_header_crc(const mqtt_outbox_header_t *hdr)
+{
+	return esp_crc32_le(0, (const uint8_t*)hdr, offsetof(mqtt_outbox_header_t, crc));
+}
+
+static bool mqtt_outbox_record_valid(const mqtt_outbox_record_t *record)
+{
+	// un slot nunca escrito esta a cero y no tiene tipo
+	return ((record->type == MQTT_OUTBOX_RECORD_MEASURE) || (record->type == MQTT_OUTBOX_RECORD_ALARM))
+			&& (record->crc == mqtt_outbox_record_crc(record));
+}
+
+static long mqtt_outbox_slot_offset(uint32_t seq)
+{
+	return (long)sizeof(mqtt_outbox_header_t) + ((long)(seq % MQTT_OUTBOX_CAPACITY) * (long)sizeof(mqtt_outbox_record_t));
+}
+
+static esp_err_t mqtt_outbox_write_at(long offset, const void *data, size_t size)
+{
+	if ((fseek(outbox_file, offset, SEEK_SET) != 0) || (fwrite(data, size, 1, outbox_file) != 1))
+	{
+		return ESP_FAIL;
+	}
+
+	return ESP_OK;
+}
+
+static esp_err_t mqtt_outbox_read_at(long offset, void *data, size_t size)
+{
+	if ((fseek(outbox_file, offset, SEEK_SET) != 0) || (fread(data, size, 1, outbox_file) != 1))
+	{
+		return ESP_FAIL;
+	}
+
+	return ESP_OK;
+}
+
+/**
+ * Lleva a flash lo escrito en el fichero
+ */
+static esp_err_t mqtt_outbox_sync(void)
+{
+	if ((fflush(outbox_file) != 0) || (fsync(fileno(outbox_file)) != 0))
+	{
+		return ESP_FAIL;
+	}
+
+	return ESP_OK;
+}
+
+static esp_err_t mqtt_outbox_write_header(void)
+{
+	header.replay_seq = tail_seq;
+	header.crc = mqtt_outbox_header_crc(&header);
+
+	if ((mqtt_outbox_write_at(0, &header, sizeof(header)) != ESP_OK) || (mqtt_outbox_sync() != ESP_OK))
+	{
+		ESP_LOGE(TAG, "Error escribiendo la cabecera");
+		return ESP_FAIL;
+	}
+
+	popped_since_header = 0;
+
+	return ESP_OK;
+}
+
+/**
+ * Crea el fichero con todos los slots a cero
+ */
+static esp_err_t mqtt_outbox_create_file(void)
+{
+	uint8_t zeros[MQTT_OUTBOX_ZERO_CHUNK];
+	size_t remaining = MQTT_OUTBOX_CAPACITY * sizeof(mqtt_outbox_record_t);
+
+	outbox_file = fopen(MQTT_OUTBOX_PATH, "w+b");
+	if (outbox_file == NULL)
+	{
+		ESP_LOGE(TAG, "No se puede crear %s", MQTT_OUTBOX_PATH);
+		return ESP_FAIL;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = MQTT_OUTBOX_MAGIC;
+	header.version = MQTT_OUTBOX_VERSION;
+	header.capacity = MQTT_OUTBOX_CAPACITY;
+	header.crc = mqtt_outbox_header_crc(&header);
+
+	memset(zeros, 0, sizeof(zeros));
+	if (mqtt_outbox_write_at(0, &header, sizeof(header)) != ESP_OK)
+	{
+		return ESP_FAIL;
+	}
+	while (remaining > 0)
+	{
+		size_t chunk = (remaining < sizeof(zeros)) ? remaining : sizeof(zeros);
+
+		if (fwrite(zeros, chunk, 1, outbox_file) != 1)
+		{
+			return ESP_FAIL;
+		}
+		remaining -= chunk;
+	}
+
+	ESP_LOGI(TAG, "Creado %s con %u registros", MQTT_OUTBOX_PATH, MQTT_OUTBOX_CAPACITY);
+
+	return mqtt_outbox_sync();
+}
+
+/**
+ * Abre el fichero existente si su cabecera es valida para esta version
+ */
+static bool mqtt_outbox_open_file(void)
+{
+	outbox_file = fopen(MQTT_OUTBOX_PATH, "r+b");
+	if (outbox_file == NULL)
+	{
+		return false;
+	}
+
+	if ((mqtt_outbox_read_at(0, &header, sizeof(header)) == ESP_OK)
+			&& (header.magic == MQTT_OUTBOX_MAGIC) && (header.version == MQTT_OUTBOX_VERSION)
+			&& (header.capacity == MQTT_OUTBOX_CAPACITY) && (header.crc == mqtt_outbox_header_crc(&header)))
+	{
+		return true;
+	}
+
+	ESP_LOGW(TAG, "Cabecera de %s no valida, se descarta el contenido", MQTT_OUTBOX_PATH);
+	fclose(outbox_file);
+	outbox_file = NULL;
+
+	return false;
+}
+
+/**
+ * Recorre todos los slots para encontrar el final del log
+ */
+static esp_err_t mqtt_outbox_scan(void)
+{
+	mqtt_outbox_record_t chunk[MQTT_OUTBOX_SCAN_CHUNK];
+	bool found = false;
+	uint32_t max_seq = 0;
+
+	if (fseek(outbox_file, sizeof(mqtt_outbox_header_t), SEEK_SET) != 0)
+	{
+		return ESP_FAIL;
+	}
+
+	for (uint32_t slot = 0; slot < MQTT_OUTBOX_CAPACITY; slot += MQTT_OUTBOX_SCAN_CHUNK)
+	{
+		uint32_t count = MQTT_OUTBOX_CAPACITY - slot;
+
+		if (count > MQTT_OUTBOX_SCAN_CHUNK)
+		{
+			count = MQTT_OUTBOX_SCAN_CHUNK;
+		}
+		if (fread(chunk, sizeof(mqtt_outbox_record_t), count, outbox_file) != count)
+		{
+			return ESP_FAIL;
+		}
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (mqtt_outbox_record_valid(&chunk[i]) && (!found || (int32_t)(chunk[i].seq - max_seq) > 0))
+			{
+				max_seq = chunk[i].seq;
+				found = true;
+			}
+		}
+	}
+
+	tail_seq = header.replay_seq;
+	next_seq = (found && ((int32_t)(max_seq + 1 - tail_seq) > 0)) ? (max_seq + 1) : tail_seq;
+	if ((next_seq - tail_seq) > MQTT_OUTBOX_CAPACITY)
+	{
+		tail_seq = next_seq - MQTT_OUTBOX_CAPACITY;
+	}
+	flushed_seq = next_seq;
+
+	return ESP_OK;
+}
+
+esp_err_t mqtt_outbox_init(void)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (outbox_lock == NULL)
+	{
+		outbox_lock = xSemaphoreCreateMutex();
+		if (outbox_lock == NULL)
+		{
+			return ESP_ERR_NO_MEM;
+		}
+	}
+
+	xSemaphoreTake(outbox_lock, portMAX_DELAY);
+	if (outbox_file == NULL)
+	{
+		if (!mqtt_outbox_open_file() && (mqtt_outbox_create_file() != ESP_OK))
+		{
+			ret = ESP_FAIL;
+		}
+		else if (mqtt_outbox_scan() != ESP_OK)
+		{
+			ESP_LOGE(TAG, "Error leyendo %s", MQTT_OUTBOX_PATH);
+			ret = ESP_FAIL;
+		}
+		else
+		{
+			header.boot++;
+			ret = mqtt_outbox_write_header();
+		}
+
+		if (ret != ESP_OK)
+		{
+			if (outbox_file != NULL)
+			{
+				fclose(outbox_file);
+				outbox_file = NULL;
+			}
+		}
+		else
+		{
+			outbox_stats.capacity = MQTT_OUTBOX_CAPACITY;
+			outbox_stats.boot = header.boot;
+			ESP_LOGI(TAG, "Arranque %u, %lu registros pendientes (secuencias %lu..%lu)", header.boot,
+					(unsigned long)(next_seq - tail_seq), (unsigned long)tail_seq, (unsigned long)next_seq);
+		}
+	}
+	xSemaphoreGive(outbox_lock);
+
+	return ret;
+}
+
+static esp_err_t mqtt_outbox_flush_locked(void)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (flushed_seq == next_seq)
+	{
+		return ESP_OK;
+	}
+
+	for (uint32_t seq = flushed_seq; (seq != next_seq) && (ret == ESP_OK); seq++)
+	{
+		ret = mqtt_outbox_write_at(mqtt_outbox_slot_offset(seq), &staging[seq - flushed_seq],
+				sizeof(mqtt_outbox_record_t));
+	}
+	if (ret == ESP_OK)
+	{
+		ret = mqtt_outbox_sync();
+	}
+
+	if (ret != ESP_OK)
+	{
+		// el bloque se pierde, al reenviar se saltan sus huecos
+		ESP_LOGE(TAG, "Error escribiendo %lu registros", (unsigned long)(next_seq - flushed_seq));
+	}
+	outbox_stats.flushes++;
+	flushed_seq = next_seq;
+
+	return ret;
+}
+
+static esp_err_t mqtt_outbox_append(mqtt_outbox_record_t *record, bool flush)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (outbox_lock == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	xSemaphoreTake(outbox_lock, portMAX_DELAY);
+	if (outbox_file == NULL)
+	{
+		ret = ESP_ERR_INVALID_STATE;
+	}
+	else
+	{
+		// log lleno, se pierde el registro mas antiguo
+		if ((next_seq - tail_seq) >= MQTT_OUTBOX_CAPACITY)
+		{
+			tail_seq++;
+			outbox_stats.overwritten++;
+		}
+
+		record->seq = next_seq;
+		record->boot = header.boot;
+		record->reserved = 0;
+		record->crc = mqtt_outbox_record_crc(record);
+
+		staging[next_seq - flushed_seq] = *record;
+		next_seq++;
+		outbox_stats.appended++;
+
+		if (flush || ((next_seq - flushed_seq) >= MQTT_OUTBOX_STAGING_RECORDS))
+		{
+			ret = mqtt_outbox_flush_locked();
+		}
+	}
+	xSemaphoreGive(outbox_lock);
+
+	return ret;
+}
+
+esp_err_t mqtt_outbox_append_measure(const Sensors_data_t *sensors_data, int64_t timestamp_us)
+{
+	mqtt_outbox_record_t record;
+
+	if (sensors_data == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	memset(&record, 0, sizeof(record));
+	record.type = MQTT_OUTBOX_RECORD_MEASURE;
+	record.t_ms = (uint32_t)(timestamp_us / 1000);
+	record.measure = *sensors_data;
+
+	return mqtt_outbox_append(&record, false);
+}
+
+esp_err_t mqtt_outbox_append_alarm(const Alarm_data_t *alarm_data)
+{
+	mqtt_outbox_record_t record;
+
+	if (alarm_data == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	memset(&record, 0, sizeof(record));
+	record.type = MQTT_OUTBOX_RECORD_ALARM;
+	record.t_ms = (uint32_t)(alarm_data->created_us / 1000);
+	record.alarm.alarm_class = (uint8_t)alarm_data->alarm_class;
+	record.alarm.disable = alarm_data->disable ? 1 : 0;
+
+	// las transiciones de alarma son pocas, no se arriesgan en RAM
+	return mqtt_outbox_append(&record, true);
+}
+
+esp_err_t mqtt_outbox_flush(void)
+{
+	esp_err_t ret;
+
+	if (outbox_lock == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	xSemaphoreTake(outbox_lock, portMAX_DELAY);
+	ret = (outbox_file != NULL) ? mqtt_outbox_flush_locked() : ESP_ERR_INVALID_STATE;
+	xSemaphoreGive(outbox_lock);
+
+	return ret;
+}
+
+esp_err_t mqtt_outbox_peek(mqtt_outbox_record_t *out)
+{
+	esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+	if (out == NULL)
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (outbox_lock == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	xSemaphoreTake(outbox_lock, portMAX_DELAY);
+	if (outbox_file == NULL)
+	{
+		ret = ESP_ERR_INVALID_STATE;
+	}
+	while ((outbox_file != NULL) && (tail_seq != next_seq))
+	{
+		if ((int32_t)(tail_seq - flushed_seq) >= 0)
+		{
+			*out = staging[tail_seq - flushed_seq];
+			ret = ESP_OK;
+			break;
+		}
+
+		if ((mqtt_outbox_read_at(mqtt_outbox_slot_offset(tail_seq), out, sizeof(*out)) == ESP_OK)
+				&& mqtt_outbox_record_valid(out) && (out->seq == tail_seq))
+		{
+			ret = ESP_OK;
+			break;
+		}
+
+		// slot corrupto o de una vuelta anterior
+		outbox_stats.corrupted++;
+		tail_seq++;
+	}
+	xSemaphoreGive(outbox_lock);
+
+	return ret;
+}
+
+esp_err_t mqtt_outbox_pop(void)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (outbox_lock == NULL)
+	{
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	xSemaphoreTake(outbox_lock, portMAX_DELAY);
+	if ((outbox_file == NULL) || (tail_seq == next_seq))
+	{
+		ret = ESP_ERR_INVALID_STATE;
+	}
+	else
+	{
+		tail_seq++;
+		popped_since_header++;
+		outbox_stats.replayed++;
+
+		if (tail_seq == next_seq)
+		{
+			// todo reenviado, lo que quede en RAM ya no hace falta escribirlo
+			flushed_seq = next_seq;
+			ret = mqtt_outbox_write_header();
+		}
+		else if (popped_since_header >= MQTT_OUTBOX_ACK_INTERVAL)
+		{
+			ret = mqtt_outbox_write_header();
+		}
+	}
+	xSemaphoreGive(outbox_lock);
+
+	return ret;
+}
+
+bool mqtt_outbox_available(void)
+{
+	return (outbox_file != NULL);
+}
+
+uint32_t mqtt_outbox_pending(void)
+{
+	// lectura sin lock, solo orientativa para el sender
+	return (outbox_file != NULL) ? (next_seq - tail_seq) : 0;
+}
+
+uint16_t mqtt_outbox_boot(void)
+{
+	return header.boot;
+}
+
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *out)
+{
+	if ((out == NULL) || (outbox_lock == NULL))
+	{
+		if (out != NULL)
+		{
+			memset(out, 0, sizeof(*out));
+		}
+		return;
+	}
+
+	xSemaphoreTake(outbox_lock, portMAX_DELAY);
+	*out = outbox_stats;
+	out->pending = (outbox_file != NULL) ? (next_seq - tail_seq) : 0;
+	xSemaphoreGive(outbox_lock);
+}
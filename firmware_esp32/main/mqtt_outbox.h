@@ -0,0 +1,138 @@
+/*
+ * mqtt_outbox.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Cola persistente de medidas y transiciones de alarma que no se han
+ *  podido publicar. Es un log circular de registros de tamano fijo en un
+ *  fichero de la particion storage (FATFS sobre wear levelling):
+ *
+ *  [cabecera][slot 0][slot 1]...[slot N-1]
+ *
+ *  El registro de secuencia s va al slot s % N, cada registro lleva su
+ *  secuencia, el arranque en el que se creo y un CRC32, asi que al montar
+ *  se recupera el final del log recorriendo los slots. La cabecera solo
+ *  guarda el contador de arranques y la siguiente secuencia a reenviar.
+ *
+ *  Para no gastar un sector de flash por muestra los registros se acumulan
+ *  en RAM y se escriben en bloques de MQTT_OUTBOX_STAGING_RECORDS, o al
+ *  momento si son alarmas. Un corte de alimentacion puede perder como
+ *  mucho ese bloque. Si el log se llena se sobreescriben los mas antiguos.
+ */
+
+#ifndef MAIN_MQTT_OUTBOX_H_
+#define MAIN_MQTT_OUTBOX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sensors_type.h"
+#include "alarm_type.h"
+
+// fichero en la particion storage, montada en /data por proyecto_main.c
+#define MQTT_OUTBOX_PATH				"/data/outbox.bin"
+
+#define MQTT_OUTBOX_STAGING_RECORDS		16
+// cada cuantos registros reenviados se actualiza la cabecera
+#define MQTT_OUTBOX_ACK_INTERVAL		32
+
+typedef enum
+{
+	MQTT_OUTBOX_RECORD_MEASURE = 1,
+	MQTT_OUTBOX_RECORD_ALARM = 2,
+} MQTT_OUTBOX_RECORD;
+
+typedef struct
+{
+	uint32_t seq;
+	uint32_t t_ms;			// esp_timer en ms, del arranque 'boot'
+	uint16_t boot;
+	uint8_t type;			// MQTT_OUTBOX_RECORD
+	uint8_t reserved;
+	union
+	{
+		Sensors_data_t measure;
+		struct
+		{
+			uint8_t alarm_class;
+			uint8_t disable;
+		} alarm;
+	};
+	uint32_t crc;
+} mqtt_outbox_record_t;
+
+typedef struct
+{
+	uint32_t capacity;
+	uint32_t pending;		// registros por reenviar, en flash o en RAM
+	uint32_t appended;
+	uint32_t replayed;
+	uint32_t overwritten;	// perdidos por llenarse el log
+	uint32_t corrupted;		// descartados por CRC o secuencia
+	uint32_t flushes;		// escrituras de bloques a flash
+	uint16_t boot;
+} mqtt_outbox_stats_t;
+
+/**
+ * @brief Abre o crea el fichero del outbox y recupera su estado. Requiere
+ * 		  la particion storage montada
+ *
+ * @return ESP_OK, ESP_ERR_NO_MEM o ESP_FAIL si no se puede usar el fichero
+ */
+esp_err_t mqtt_outbox_init(void);
+
+/**
+ * @brief Anade una medida al outbox
+ *
+ * @param timestamp_us	instante de la medida (esp_timer_get_time)
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE si el outbox no esta disponible o
+ * 		   ESP_FAIL si falla la escritura a flash
+ */
+esp_err_t mqtt_outbox_append_measure(const Sensors_data_t *sensors_data, int64_t timestamp_us);
+
+/**
+ * @brief Anade una transicion de alarma al outbox, se escribe a flash
+ * 		  inmediatamente
+ */
+esp_err_t mqtt_outbox_append_alarm(const Alarm_data_t *alarm_data);
+
+/**
+ * @brief Escribe a flash los registros acumulados en RAM
+ */
+esp_err_t mqtt_outbox_flush(void);
+
+/**
+ * @brief Copia en 'out' el registro pendiente mas antiguo sin quitarlo
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND si no hay pendientes o
+ * 		   ESP_ERR_INVALID_STATE si el outbox no esta disponible
+ */
+esp_err_t mqtt_outbox_peek(mqtt_outbox_record_t *out);
+
+/**
+ * @brief Da por reenviado el registro devuelto por mqtt_outbox_peek
+ */
+esp_err_t mqtt_outbox_pop(void);
+
+/**
+ * @brief true si el outbox se ha abierto y acepta registros
+ */
+bool mqtt_outbox_available(void);
+
+/**
+ * @brief Numero de registros pendientes de reenviar
+ */
+uint32_t mqtt_outbox_pending(void);
+
+/**
+ * @brief Arranque actual, para comparar con el de los registros
+ */
+uint16_t mqtt_outbox_boot(void);
+
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *out);
+
+#endif /* MAIN_MQTT_OUTBOX_H_ */
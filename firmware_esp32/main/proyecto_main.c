@@ -50,6 +50,7 @@
 #include "global_system_signaler.h"
 #include "aqi_config_manager.h"
 #include "aqi_ui_manager.h"
+#include "heap_audit.h"
 
 
 //TAG para los mensajes de consola
@@ -60,7 +61,7 @@ static const char *TAG = "AQI_CMD";
  * The easiest way to do this is to use FATFS filesystem on top of
  * wear_levelling library.
  */
-#if CONFIG_STORE_HISTORY
+#if CONFIG_STORE_HISTORY || CONFIG_AQI_MQTT_OUTBOX
 
 #define MOUNT_PATH "/data"
 #define HISTORY_PATH MOUNT_PATH "/history.txt"
@@ -78,7 +79,7 @@ static void initialize_filesystem(void)
         return;
     }
 }
-#endif // CONFIG_STORE_HISTORY
+#endif // CONFIG_STORE_HISTORY || CONFIG_AQI_MQTT_OUTBOX
 
 //Inicializa el interprete de comandos/consola serie
 static void initialize_console(void)
@@ -156,8 +157,11 @@ void app_main(void)
 	GL_initGPIO(); //Inicializa los pines de salida
 
 
-#if CONFIG_STORE_HISTORY
+#if CONFIG_STORE_HISTORY || CONFIG_AQI_MQTT_OUTBOX
+    // la particion storage guarda el historial de comandos y el outbox de MQTT
     initialize_filesystem();
+#endif
+#if CONFIG_STORE_HISTORY
     ESP_LOGI(TAG, "Command history enabled");
 #else
     ESP_LOGI(TAG, "Command history disabled");
@@ -235,6 +239,12 @@ void app_main(void)
     ret = gss_initialize();
     ESP_ERROR_CHECK(ret);
 
+#if CONFIG_AQI_HEAP_AUDIT
+    // Comprobacion de integridad del heap fuera del camino de los mensajes
+    ret = heap_audit_start(CONFIG_AQI_HEAP_AUDIT_PERIOD_MS);
+    ESP_ERROR_CHECK(ret);
+#endif
+
     // Inicializar servicio de sensores
     ret = sensors_service_init(1000, I2C_NUM_0, GPIO_NUM_26, GPIO_NUM_27);
     ESP_ERROR_CHECK(ret);
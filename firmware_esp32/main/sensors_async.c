@@ -0,0 +1,238 @@
+/*
+ * sensors_async.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include "sensors_async.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+
+static const char * TAG = "SENSORS_ASYNC";
+
+// bits de sensores con lectura en curso, tambien son los bits de la
+// notificacion que envia cada deadline a la tarea de muestreo
+#define SENSORS_ASYNC_SGP40		(1u << 0)
+#define SENSORS_ASYNC_SHT40		(1u << 1)
+#define SENSORS_ASYNC_ALL		(SENSORS_ASYNC_SGP40 | SENSORS_ASYNC_SHT40)
+
+static esp_timer_handle_t sgp40_deadline_timer = NULL;
+static esp_timer_handle_t sht40_deadline_timer = NULL;
+
+// solo los usa la tarea de muestreo
+static sensors_async_frame_t async_frame;
+static uint32_t pending_mask = 0;
+// tarea a la que avisan los deadlines, se fija antes de armar los timers
+static TaskHandle_t waiting_task = NULL;
+
+
+/**
+ * Callback de los dos deadlines (arg: bit del sensor). Se ejecuta en la
+ * tarea de esp_timer (ESP_TIMER_TASK), compartida con el resto de timers
+ * del sistema, asi que no toca el bus: solo avisa a la tarea de muestreo,
+ * que es quien lee el frame
+ */
+static void sensors_async_deadline_cb(void *arg)
+{
+	TaskHandle_t task = waiting_task;
+
+	if (task != NULL)
+	{
+		xTaskNotify(task, (uint32_t)(uintptr_t)arg, eSetBits);
+	}
+}
+
+static void sensors_async_fetch_sgp40(void)
+{
+	async_frame.sgp40_fetch_start_us = esp_timer_get_time();
+	async_frame.sgp40_result = sgp40_i2c_fetch_raw_measure(&async_frame.voc_raw);
+	async_frame.sgp40_ready_us = esp_timer_get_time();
+}
+
+static void sensors_async_fetch_sht40(void)
+{
+	async_frame.sht40_fetch_start_us = esp_timer_get_time();
+	async_frame.sht40_result = sht40_i2c_fetch_measure(&async_frame.temperature_raw,
+			&async_frame.humidity_raw);
+	async_frame.sht40_ready_us = esp_timer_get_time();
+}
+
+/**
+ * Programa el timer para que dispare en deadline_us
+ */
+static esp_err_t sensors_async_arm(esp_timer_handle_t timer, int64_t deadline_us)
+{
+	int64_t remaining_us = deadline_us - esp_timer_get_time();
+
+	if (remaining_us < 0)
+	{
+		remaining_us = 0;
+	}
+
+	return (esp_timer_start_once(timer, (uint64_t)remaining_us));
+}
+
+esp_err_t sensors_async_init(void)
+{
+	esp_timer_create_args_t timer_args = {
+		.callback = &sensors_async_deadline_cb,
+		.arg = (void *)(uintptr_t)SENSORS_ASYNC_SGP40,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "sgp40_deadline",
+		.skip_unhandled_events = false,
+	};
+
+	if (sgp40_deadline_timer == NULL)
+	{
+		ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &sgp40_deadline_timer),
+				TAG, "No se pudo crear el timer del SGP40");
+	}
+
+	if (sht40_deadline_timer == NULL)
+	{
+		timer_args.arg = (void *)(uintptr_t)SENSORS_ASYNC_SHT40;
+		timer_args.name = "sht40_deadline";
+		ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &sht40_deadline_timer),
+				TAG, "No se pudo crear el timer del SHT40");
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t sensors_async_start(SGP40_COMPENSATION compensation, sgp40_compensation_t *comp_data,
+							SHT40_PRECISION precision)
+{
+	esp_err_t ret_sgp;
+	esp_err_t ret_sht;
+
+	if (pending_mask != 0)
+	{
+		ESP_LOGW(TAG, "Ciclo anterior sin terminar, no se lanza otro");
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	// descartar avisos rezagados de deadlines de ciclos anteriores
+	(void)xTaskNotifyWait(0, SENSORS_ASYNC_ALL, NULL, 0);
+
+	memset(&async_frame, 0, sizeof(async_frame));
+	async_frame.start_us = esp_timer_get_time();
+
+	ret_sgp = sgp40_i2c_trigger_raw_measure(compensation, comp_data);
+	async_frame.sgp40_triggered_us = esp_timer_get_time();
+	async_frame.sgp40_result = ret_sgp;
+
+	ret_sht = sht40_i2c_trigger_measure(precision);
+	async_frame.sht40_triggered_us = esp_timer_get_time();
+	async_frame.sht40_result = ret_sht;
+
+	waiting_task = xTaskGetCurrentTaskHandle();
+
+	if (ret_sgp == ESP_OK)
+	{
+		if (sensors_async_arm(sgp40_deadline_timer, async_frame.sgp40_triggered_us
+				+ (SGP40_TIME_UNTIL_MEASURE_AVAILABLE_MS * 1000)) == ESP_OK)
+		{
+			pending_mask |= SENSORS_ASYNC_SGP40;
+		}
+		else
+		{
+			async_frame.sgp40_result = ESP_FAIL;
+		}
+	}
+
+	if (ret_sht == ESP_OK)
+	{
+		if (sensors_async_arm(sht40_deadline_timer, async_frame.sht40_triggered_us
+				+ (sht40_get_measure_time_ms(precision) * 1000)) == ESP_OK)
+		{
+			pending_mask |= SENSORS_ASYNC_SHT40;
+		}
+		else
+		{
+			async_frame.sht40_result = ESP_FAIL;
+		}
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t sensors_async_wait(sensors_async_frame_t *frame, TickType_t timeout)
+{
+	esp_err_t ret = ESP_OK;
+	TickType_t start = xTaskGetTickCount();
+	TickType_t elapsed;
+	uint32_t fired = 0;
+
+	// cada deadline despierta a la tarea, que lee ese sensor y sigue
+	// esperando al otro. Las lecturas I2C se hacen aqui, fuera de esp_timer
+	while (pending_mask != 0)
+	{
+		elapsed = xTaskGetTickCount() - start;
+		if ((elapsed >= timeout)
+				|| (xTaskNotifyWait(0, SENSORS_ASYNC_ALL, &fired, timeout - elapsed) != pdTRUE))
+		{
+			ret = ESP_ERR_TIMEOUT;
+			break;
+		}
+
+		fired &= pending_mask;
+		// el SHT40 termina antes, se lee primero si los dos han vencido
+		if ((fired & SENSORS_ASYNC_SHT40) != 0)
+		{
+			sensors_async_fetch_sht40();
+		}
+		if ((fired & SENSORS_ASYNC_SGP40) != 0)
+		{
+			sensors_async_fetch_sgp40();
+		}
+		pending_mask &= ~fired;
+	}
+
+	if (ret == ESP_ERR_TIMEOUT)
+	{
+		// un timer ya disparado solo deja un aviso rezagado, que se
+		// descarta en el siguiente sensors_async_start
+		(void)esp_timer_stop(sgp40_deadline_timer);
+		(void)esp_timer_stop(sht40_deadline_timer);
+
+		if ((pending_mask & SENSORS_ASYNC_SGP40) != 0)
+		{
+			async_frame.sgp40_result = ESP_ERR_TIMEOUT;
+		}
+		if ((pending_mask & SENSORS_ASYNC_SHT40) != 0)
+		{
+			async_frame.sht40_result = ESP_ERR_TIMEOUT;
+		}
+
+		ESP_LOGW(TAG, "Timeout esperando el frame de sensores");
+	}
+
+	pending_mask = 0;
+	waiting_task = NULL;
+	if (frame != NULL)
+	{
+		*frame = async_frame;
+	}
+
+	return ret;
+}
+
+TickType_t sensors_async_default_timeout(SHT40_PRECISION precision)
+{
+	uint32_t longest_ms = sht40_get_measure_time_ms(precision);
+
+	if (SGP40_TIME_UNTIL_MEASURE_AVAILABLE_MS > longest_ms)
+	{
+		longest_ms = SGP40_TIME_UNTIL_MEASURE_AVAILABLE_MS;
+	}
+
+	// al menos dos ticks para que el redondeo no acorte la espera
+	TickType_t ticks = pdMS_TO_TICKS(longest_ms + SENSORS_ASYNC_TIMEOUT_MARGIN_MS);
+
+	return ((ticks < 2) ? 2 : ticks);
+}
@@ -0,0 +1,91 @@
+/*
+ * sensors_async.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Motor de lectura asincrona de los sensores SHT40 y SGP40.
+ *
+ *  Las conversiones se lanzan desde la tarea de muestreo y el instante en
+ *  que el dato esta disponible se programa con un esp_timer de un disparo,
+ *  con resolucion de microsegundos e independiente de CONFIG_FREERTOS_HZ.
+ *  El callback del timer solo avisa a la tarea (notificacion de tarea con
+ *  el bit del sensor): la tarea de esp_timer la comparten todos los timers
+ *  del sistema y no debe esperar por el bus. La lectura del frame y la
+ *  comprobacion de CRC las hace la tarea de muestreo en cuanto despierta,
+ *  y el bus I2C solo se usa desde ella.
+ */
+
+#ifndef MAIN_SENSORS_ASYNC_H_
+#define MAIN_SENSORS_ASYNC_H_
+
+#include "sgp40driver.h"
+#include "sht40driver.h"
+
+#include "esp_err.h"
+
+//Include FreeRTOS headers
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// margen sobre la conversion mas larga antes de dar un ciclo por perdido
+#define SENSORS_ASYNC_TIMEOUT_MARGIN_MS		20u
+
+/**
+ * Resultado de un ciclo de lectura asincrona. Las marcas de tiempo estan
+ * en la base de esp_timer_get_time() y valen 0 si la fase no se realizo
+ */
+typedef struct
+{
+	int64_t start_us;				// llamada a sensors_async_start
+	// SGP40
+	esp_err_t sgp40_result;
+	uint16_t voc_raw;
+	int64_t sgp40_triggered_us;		// fin de la escritura del comando de medida
+	int64_t sgp40_fetch_start_us;	// inicio de la lectura, al despertar tras el deadline
+	int64_t sgp40_ready_us;			// frame leido y CRC comprobado
+	// SHT40
+	esp_err_t sht40_result;
+	uint16_t temperature_raw;
+	uint16_t humidity_raw;
+	int64_t sht40_triggered_us;
+	int64_t sht40_fetch_start_us;
+	int64_t sht40_ready_us;
+} sensors_async_frame_t;
+
+/**
+ * @brief Crea los timers del motor. Se llama una vez desde
+ * 		  sensors_service_init, con los drivers ya inicializados
+ */
+esp_err_t sensors_async_init(void);
+
+/**
+ * @brief Lanza las conversiones de SGP40 y SHT40 y programa sus deadlines.
+ * 		  La tarea que llama es la que se notificara al completar el ciclo.
+ *
+ * @return ESP_OK si el ciclo esta en marcha (aunque alguna solicitud I2C
+ * 		   haya fallado, su error se entrega en el frame),
+ * 		   ESP_ERR_INVALID_STATE si el ciclo anterior aun no ha terminado
+ */
+esp_err_t sensors_async_start(SGP40_COMPENSATION compensation, sgp40_compensation_t *comp_data,
+							SHT40_PRECISION precision);
+
+/**
+ * @brief Bloquea la tarea hasta que el frame completo este disponible. Lee
+ * 		  cada sensor en cuanto vence su deadline. La tarea debe ser la que
+ * 		  llamo a sensors_async_start
+ *
+ * @param[out] frame	resultado del ciclo
+ * @param timeout		ticks maximos de espera
+ *
+ * @return ESP_OK o ESP_ERR_TIMEOUT si algun sensor no entrego su
+ * 		   resultado a tiempo (su resultado en el frame sera ESP_ERR_TIMEOUT)
+ */
+esp_err_t sensors_async_wait(sensors_async_frame_t *frame, TickType_t timeout);
+
+/**
+ * @brief Espera por defecto para sensors_async_wait
+ */
+TickType_t sensors_async_default_timeout(SHT40_PRECISION precision);
+
+#endif /* MAIN_SENSORS_ASYNC_H_ */
@@ -0,0 +1,201 @@
+/*
+ * sensors_rollup.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include "sensors_rollup.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "SENSORS_ROLLUP";
+
+SLAB_POOL_DEFINE(rollup_pool, Sensors_rollup_t, SENSORS_ROLLUP_POOL_SIZE);
+
+static const char* field_names[SENSORS_FIELD_MAX] = {
+	[SENSORS_FIELD_HUMIDITY] = "humidity_rh",
+	[SENSORS_FIELD_TEMPERATURE] = "temp_celsius",
+	[SENSORS_FIELD_VOC_RAW] = "voc_raw",
+	[SENSORS_FIELD_VOC_INDEX] = "voc_index",
+};
+
+static uint16_t sensors_field_value(const Sensors_data_t *sample, SENSORS_FIELD field)
+{
+	switch (field)
+	{
+	case SENSORS_FIELD_HUMIDITY:
+		return sample->relative_humidity;
+	case SENSORS_FIELD_TEMPERATURE:
+		return sample->temperature_celsius;
+	case SENSORS_FIELD_VOC_RAW:
+		return sample->voc_raw;
+	case SENSORS_FIELD_VOC_INDEX:
+		return sample->voc_index;
+	default:
+		return 0;
+	}
+}
+
+void sensors_rollup_acc_reset(sensors_rollup_acc_t *acc)
+{
+	if (acc != NULL)
+	{
+		memset(acc, 0, sizeof(*acc));
+	}
+}
+
+void sensors_rollup_acc_start(sensors_rollup_acc_t *acc, int64_t start_us)
+{
+	if (acc != NULL)
+	{
+		memset(acc, 0, sizeof(*acc));
+		acc->start_us = start_us;
+	}
+}
+
+void sensors_rollup_acc_add(sensors_rollup_acc_t *acc, const Sensors_data_t *sample,
+							int64_t timestamp_us)
+{
+	if ((acc == NULL) || (sample == NULL))
+	{
+		return;
+	}
+
+	// ventana sin abrir: empieza con esta muestra
+	if ((acc->count == 0) && (acc->start_us == 0))
+	{
+		acc->start_us = timestamp_us;
+	}
+	acc->count++;
+
+	for (int f = 0; f < SENSORS_FIELD_MAX; f++)
+	{
+		sensors_rollup_acc_field_t *st = &acc->field[f];
+		uint16_t value = sensors_field_value(sample, (SENSORS_FIELD)f);
+
+		if ((acc->count == 1) || (value < st->min))
+		{
+			st->min = value;
+		}
+		if ((acc->count == 1) || (value > st->max))
+		{
+			st->max = value;
+		}
+
+		// Welford: la media y M2 se actualizan sin guardar las muestras y
+		// sin restar sumas grandes, que en float perderian precision
+		float delta = (float)value - st->mean;
+		st->mean += delta / (float)acc->count;
+		st->m2 += delta * ((float)value - st->mean);
+	}
+}
+
+bool sensors_rollup_create(Sensors_rollup_ptr *out_rollup, const sensors_rollup_acc_t *acc,
+							int64_t end_us)
+{
+	if ((out_rollup == NULL) || (acc == NULL) || (acc->count == 0))
+	{
+		return false;
+	}
+
+	*out_rollup = (Sensors_rollup_ptr)slab_pool_alloc(&rollup_pool);
+
+	// pool agotado
+	if (*out_rollup == NULL)
+	{
+		return false;
+	}
+
+	(*out_rollup)->start_us = acc->start_us;
+	(*out_rollup)->end_us = end_us;
+	(*out_rollup)->count = acc->count;
+	for (int f = 0; f < SENSORS_FIELD_MAX; f++)
+	{
+		const sensors_rollup_acc_field_t *st = &acc->field[f];
+
+		(*out_rollup)->field[f].min = st->min;
+		(*out_rollup)->field[f].max = st->max;
+		(*out_rollup)->field[f].mean = st->mean;
+		// desviacion tipica de la ventana (poblacion), M2 puede quedar
+		// ligeramente negativo por redondeo
+		(*out_rollup)->field[f].stddev = (st->m2 > 0.0f) ? sqrtf(st->m2 / (float)acc->count) : 0.0f;
+	}
+	atomic_init(&(*out_rollup)->refcount, 1);
+
+	return true;
+}
+
+Sensors_rollup_ptr sensors_rollup_retain(Sensors_rollup_ptr rollup)
+{
+	if (rollup != NULL)
+	{
+		atomic_fetch_add_explicit(&rollup->refcount, 1, memory_order_relaxed);
+	}
+
+	return rollup;
+}
+
+void sensors_rollup_release(Sensors_rollup_ptr rollup)
+{
+	if (rollup == NULL)
+	{
+		return;
+	}
+
+	// el ultimo propietario lo devuelve al pool
+	if (atomic_fetch_sub_explicit(&rollup->refcount, 1, memory_order_acq_rel) == 1)
+	{
+		slab_pool_free(&rollup_pool, rollup);
+	}
+}
+
+void sensors_rollup_get_pool_stats(slab_pool_stats_t *out)
+{
+	slab_pool_get_stats(&rollup_pool, out);
+}
+
+const char* sensors_field_name(SENSORS_FIELD field)
+{
+	if ((field < 0) || (field >= SENSORS_FIELD_MAX))
+	{
+		return "";
+	}
+
+	return field_names[field];
+}
+
+esp_err_t sensors_rollup_to_JSON(struct json_out * json_buffer, int buffer_size,
+							const Sensors_rollup_t *rollup)
+{
+	int printed = 0;
+
+	if ((rollup == NULL) || (json_buffer == NULL))
+	{
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	printed = json_printf(json_buffer, "{start_ms: %lld, end_ms: %lld, count: %lu",
+			(long long)(rollup->start_us / 1000), (long long)(rollup->end_us / 1000),
+			(unsigned long)rollup->count);
+	for (int f = 0; f < SENSORS_FIELD_MAX; f++)
+	{
+		const sensors_rollup_field_t *st = &rollup->field[f];
+
+		printed += json_printf(json_buffer, ", %Q: {min: %u, max: %u, mean: %.2f, stddev: %.2f}",
+				field_names[f], st->min, st->max, (double)st->mean, (double)st->stddev);
+	}
+	printed += json_printf(json_buffer, "}");
+
+	if (printed >= buffer_size)
+	{
+		ESP_LOGE(TAG, "Se escriben mas bytes(%d) que el size del buffer(%d)",
+				printed, buffer_size);
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	return ESP_OK;
+}
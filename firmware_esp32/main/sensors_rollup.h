@@ -0,0 +1,148 @@
+/*
+ * sensors_rollup.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Agregado de las muestras de una ventana de tiempo: minimo, maximo,
+ *  media y desviacion tipica de cada campo. Se calcula de forma
+ *  incremental con el algoritmo de Welford, O(1) por muestra y sin guardar
+ *  las muestras de la ventana.
+ *
+ *  El acumulador es del sensors service. Al cerrar una ventana se crea un
+ *  Sensors_rollup_t inmutable del pool estatico que se comparte entre los
+ *  canales del GSS igual que las alarmas, con un contador de referencias.
+ */
+
+#ifndef MAIN_SENSORS_ROLLUP_H_
+#define MAIN_SENSORS_ROLLUP_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "frozen.h"
+#include "slab_pool.h"
+
+#include "sensors_type.h"
+
+/* Objects of the static pool of rollups. One window is closed every
+ * SENSORS_ROLLUP_MIN_SECONDS at most, so a few cover any consumer delay */
+#define SENSORS_ROLLUP_POOL_SIZE		4
+
+/* Limits of the window length set with the rollup_sec config key, 0 turns
+ * the aggregation off */
+#define SENSORS_ROLLUP_MIN_SECONDS		10
+#define SENSORS_ROLLUP_MAX_SECONDS		3600
+
+typedef enum
+{
+	SENSORS_FIELD_HUMIDITY,
+	SENSORS_FIELD_TEMPERATURE,
+	SENSORS_FIELD_VOC_RAW,
+	SENSORS_FIELD_VOC_INDEX,
+	SENSORS_FIELD_MAX
+} SENSORS_FIELD;
+
+/**
+ * Running statistics of one field (Welford)
+ */
+typedef struct
+{
+	uint16_t min;
+	uint16_t max;
+	float mean;
+	float m2;		// suma de cuadrados de las diferencias a la media
+} sensors_rollup_acc_field_t;
+
+typedef struct
+{
+	uint32_t count;
+	int64_t start_us;		// inicio de la ventana, 0 si aun no esta abierta
+	sensors_rollup_acc_field_t field[SENSORS_FIELD_MAX];
+} sensors_rollup_acc_t;
+
+typedef struct
+{
+	uint16_t min;
+	uint16_t max;
+	float mean;
+	float stddev;
+} sensors_rollup_field_t;
+
+/**
+ * Closed window. It is immutable once created, each consumer owns a
+ * reference that must be given back with sensors_rollup_release.
+ */
+typedef struct Sensors_rollup_t
+{
+	int64_t start_us;		// esp_timer_get_time() when the window was opened
+	int64_t end_us;			// esp_timer_get_time() of the end of the window
+	uint32_t count;
+	sensors_rollup_field_t field[SENSORS_FIELD_MAX];
+	atomic_uint_fast32_t refcount;
+} Sensors_rollup_t;
+
+typedef Sensors_rollup_t* Sensors_rollup_ptr;
+
+/**
+ * @brief Empties the accumulator, the next sample opens a new window
+ */
+void sensors_rollup_acc_reset(sensors_rollup_acc_t *acc);
+
+/**
+ * @brief Empties the accumulator and opens a new window at start_us, e.g.
+ * 		  the end of the previous one so windows do not drift
+ */
+void sensors_rollup_acc_start(sensors_rollup_acc_t *acc, int64_t start_us);
+
+/**
+ * @brief Adds a sample to the window. O(1), the sample is not stored
+ *
+ * @param timestamp_us	esp_timer_get_time() of the sample
+ */
+void sensors_rollup_acc_add(sensors_rollup_acc_t *acc, const Sensors_data_t *sample,
+							int64_t timestamp_us);
+
+/**
+ * @brief Takes a rollup from the static pool with the statistics of the
+ * 		  accumulator. The caller owns the only reference.
+ *
+ * @return false if the accumulator is empty or the pool is exhausted
+ */
+bool sensors_rollup_create(Sensors_rollup_ptr *out_rollup, const sensors_rollup_acc_t *acc,
+							int64_t end_us);
+
+/**
+ * @brief Takes a new reference to a rollup
+ */
+Sensors_rollup_ptr sensors_rollup_retain(Sensors_rollup_ptr rollup);
+
+/**
+ * @brief Gives back a reference, the last one returns the rollup to the pool
+ */
+void sensors_rollup_release(Sensors_rollup_ptr rollup);
+
+/**
+ * @brief Occupancy of the rollups pool
+ */
+void sensors_rollup_get_pool_stats(slab_pool_stats_t *out);
+
+/**
+ * @brief JSON key of a field, the same used by sensors_type_to_JSON
+ */
+const char* sensors_field_name(SENSORS_FIELD field);
+
+/**
+ * @brief Function to generate the JSON of a rollup:
+ * 		  { start_ms, end_ms, count, <field>: { min, max, mean, stddev }, ... }
+ * 		  Times are ms since boot.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if input data or buffer are null or
+ * 		   ESP_ERR_INVALID_SIZE if the JSON does not fit in buffer_size
+ */
+esp_err_t sensors_rollup_to_JSON(struct json_out * json_buffer, int buffer_size,
+							const Sensors_rollup_t *rollup);
+
+#endif /* MAIN_SENSORS_ROLLUP_H_ */
@@ -7,10 +7,14 @@
 
 #include "sensors_service.h"
 #include "sensors_type.h"
+#include "sensors_async.h"
 #include "aqi_alarm_manager.h"
+#include "aqi_config_manager.h"
+#include "sensors_rollup.h"
 
 #include "esp_log.h"
 #include "esp_check.h"
+#include "esp_timer.h"
 
 static const char * TAG = "SENSORS_SERVICE";
 
@@ -18,6 +22,149 @@ static TaskHandle_t sensors_service_task_handler = NULL;
 static i2c_port_t current_i2c_master_port;
 static GasIndexAlgorithmParams voc_algorithm_params;
 
+// Desglose de latencias por fase del ciclo de muestreo
+static sensors_service_latency_t sensors_latency;
+static portMUX_TYPE sensors_latency_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Etapa de agregacion, solo la usa la tarea de muestreo
+static sensors_rollup_acc_t rollup_acc;
+static uint16_t rollup_window_seconds = 0;
+
+// solo recibe GSS_CONFIG_CHANGED de rollup_sec
+static GSS_ID sensors_gss_channel = GSS_ID_INVALID;
+
+
+static void sensors_latency_record(const int64_t phase_us[SENSORS_PHASE_MAX])
+{
+	portENTER_CRITICAL(&sensors_latency_lock);
+	for (int p = 0; p < SENSORS_PHASE_MAX; p++)
+	{
+		uint32_t us = (phase_us[p] > 0) ? (uint32_t)phase_us[p] : 0;
+
+		sensors_latency.phase[p].last_us = us;
+		sensors_latency.phase[p].sum_us += us;
+		if (us > sensors_latency.phase[p].max_us)
+		{
+			sensors_latency.phase[p].max_us = us;
+		}
+	}
+	sensors_latency.cycles++;
+	portEXIT_CRITICAL(&sensors_latency_lock);
+}
+
+
+/**
+ * Desglose por fases a partir de las marcas de tiempo del motor asincrono.
+ * Las fases de un sensor cuya solicitud fallo quedan a 0
+ */
+static void sensors_frame_to_phases(const sensors_async_frame_t *frame, int64_t t_awake,
+									int64_t phase_us[SENSORS_PHASE_MAX])
+{
+	int64_t t_prev = frame->sht40_triggered_us;
+
+	phase_us[SENSORS_PHASE_SGP40_TRIGGER] = frame->sgp40_triggered_us - frame->start_us;
+	phase_us[SENSORS_PHASE_SHT40_TRIGGER] = frame->sht40_triggered_us - frame->sgp40_triggered_us;
+
+	if (frame->sht40_ready_us != 0)
+	{
+		phase_us[SENSORS_PHASE_SHT40_WAIT] = frame->sht40_fetch_start_us - frame->sht40_triggered_us;
+		phase_us[SENSORS_PHASE_SHT40_FETCH] = frame->sht40_ready_us - frame->sht40_fetch_start_us;
+		t_prev = frame->sht40_ready_us;
+	}
+
+	if (frame->sgp40_ready_us != 0)
+	{
+		// lo que resta de la conversion del SGP40 tras recoger el SHT40
+		phase_us[SENSORS_PHASE_SGP40_WAIT] = frame->sgp40_fetch_start_us - t_prev;
+		phase_us[SENSORS_PHASE_SGP40_FETCH] = frame->sgp40_ready_us - frame->sgp40_fetch_start_us;
+		t_prev = frame->sgp40_ready_us;
+	}
+
+	// desde que el frame esta completo hasta que la tarea vuelve a ejecutarse
+	phase_us[SENSORS_PHASE_WAKEUP] = t_awake - t_prev;
+	phase_us[SENSORS_PHASE_TOTAL] = t_awake - frame->start_us;
+}
+
+/**
+ * Lee la duracion de la ventana de agregacion de la config: al arrancar y
+ * con cada GSS_CONFIG_CHANGED, no en cada muestra
+ */
+static void sensors_rollup_load_config(void)
+{
+	uint16_t window_seconds = 0;
+
+	aqi_config_manager_get(AQI_CV_SENSORS_ROLLUP_SECONDS, &window_seconds, sizeof(window_seconds));
+	if (window_seconds != rollup_window_seconds)
+	{
+		// la ventana en curso no es comparable con las nuevas, se descarta
+		sensors_rollup_acc_reset(&rollup_acc);
+		rollup_window_seconds = window_seconds;
+	}
+}
+
+/**
+ * Atiende sin esperar los cambios de config pendientes en el canal
+ */
+static void sensors_poll_config_changes(void)
+{
+	GSS_Message msg;
+
+	if (sensors_gss_channel == GSS_ID_INVALID)
+	{
+		return;
+	}
+
+	while (gss_wait_for_signal(sensors_gss_channel, &msg, 0) == ESP_OK)
+	{
+		if (msg.signal == GSS_CONFIG_CHANGED)
+		{
+			sensors_rollup_load_config();
+		}
+		gss_release_message(&msg);
+	}
+}
+
+/**
+ * Anade la muestra a la ventana de agregacion. Una muestra que llega en el
+ * limite de la ventana o despues la cierra antes de entrar: el rollup se
+ * publica por el GSS y la siguiente ventana empieza en ese limite (o en el
+ * de la ventana que contiene la muestra si ha habido un hueco), asi cada
+ * ventana dura exactamente rollup_sec y no derivan. 0 desactiva la agregacion
+ */
+static void sensors_rollup_stage(const Sensors_data_t *sample, int64_t timestamp_us)
+{
+	int64_t window_us = (int64_t)rollup_window_seconds * 1000000;
+
+	if (rollup_window_seconds == 0)
+	{
+		return;
+	}
+
+	if ((rollup_acc.count > 0) && ((timestamp_us - rollup_acc.start_us) >= window_us))
+	{
+		Sensors_rollup_ptr rollup = NULL;
+		int64_t end_us = rollup_acc.start_us + window_us;
+		int64_t next_start_us = rollup_acc.start_us
+				+ (((timestamp_us - rollup_acc.start_us) / window_us) * window_us);
+
+		if (sensors_rollup_create(&rollup, &rollup_acc, end_us))
+		{
+			if (gss_broadcast_rollup_data(rollup, NULL) != ESP_OK)
+			{
+				ESP_LOGE(TAG, "No se pudo entregar el rollup de %lu muestras",
+						(unsigned long)rollup->count);
+			}
+			sensors_rollup_release(rollup);
+		}
+		else
+		{
+			ESP_LOGE(TAG, "Pool de rollups agotado, se pierde la ventana");
+		}
+		sensors_rollup_acc_start(&rollup_acc, next_start_us);
+	}
+
+	sensors_rollup_acc_add(&rollup_acc, sample, timestamp_us);
+}
 
 /**
  * Task for sensors reading each interval
@@ -44,9 +191,52 @@ static void sensors_sampling_task( void * pvParameters )
 	uint8_t sgp40_errors_counter = 0;
 	bool feed_voc_algorithm = true;
 
+	sensors_rollup_load_config();
+
 	while (1)
 	{
-		esp_err_t retSHT = sht40_i2c_get_measure_high_precision(&last_temperature_raw, &last_humidity_raw);
+		int64_t phase_us[SENSORS_PHASE_MAX] = { 0 };
+		sensors_async_frame_t frame;
+		esp_err_t retSGP = ESP_FAIL;
+		esp_err_t retSHT = ESP_FAIL;
+
+		// Lanzar ambas conversiones (la del SGP40 con la compensacion obtenida
+		// del SHT40 en el ciclo anterior). El deadline de cada sensor solo
+		// avisa a esta tarea, que dentro de sensors_async_wait lee y comprueba
+		// el CRC de cada uno en cuanto vence, hasta completar el frame
+		if (sensors_async_start(selected_compensation, &last_sgp40_compensation,
+				SHT40_PRECISION_HIGH) == ESP_OK)
+		{
+			sensors_async_wait(&frame, sensors_async_default_timeout(SHT40_PRECISION_HIGH));
+			int64_t t_awake = esp_timer_get_time();
+
+			retSGP = frame.sgp40_result;
+			retSHT = frame.sht40_result;
+			if (retSGP == ESP_OK)
+			{
+				last_VOC_raw = frame.voc_raw;
+			}
+			if (retSHT == ESP_OK)
+			{
+				last_temperature_raw = frame.temperature_raw;
+				last_humidity_raw = frame.humidity_raw;
+			}
+
+			sensors_frame_to_phases(&frame, t_awake, phase_us);
+			sensors_latency_record(phase_us);
+		}
+		else
+		{
+			retSGP = ESP_ERR_INVALID_STATE;
+			retSHT = ESP_ERR_INVALID_STATE;
+		}
+
+		ESP_LOGI(TAG, "Latencias ciclo (us): sgp_trig=%lld sht_trig=%lld sht_wait=%lld "
+				"sht_fetch=%lld sgp_wait=%lld sgp_fetch=%lld wakeup=%lld total=%lld",
+				phase_us[SENSORS_PHASE_SGP40_TRIGGER], phase_us[SENSORS_PHASE_SHT40_TRIGGER],
+				phase_us[SENSORS_PHASE_SHT40_WAIT], phase_us[SENSORS_PHASE_SHT40_FETCH],
+				phase_us[SENSORS_PHASE_SGP40_WAIT], phase_us[SENSORS_PHASE_SGP40_FETCH],
+				phase_us[SENSORS_PHASE_WAKEUP], phase_us[SENSORS_PHASE_TOTAL]);
 
 		if (retSHT != ESP_OK)
 		{
@@ -97,15 +287,13 @@ static void sensors_sampling_task( void * pvParameters )
 			// activar compensacion para el sgp40
 			selected_compensation = SGP40_COMP_ON;
 
-			// actualizar datos de compensacion para el sgp40
+			// actualizar datos de compensacion para el sgp40,
+			// se aplicaran en la conversion del siguiente ciclo
 			sgp40_compensation_t_init(&last_sgp40_compensation,
 						last_temperature_celsius,
 						last_humidity_rh);
 		}
 
-		esp_err_t retSGP = sgp40_i2c_get_raw_measure(&last_VOC_raw,
-								selected_compensation, &last_sgp40_compensation);
-
 		if (retSGP != ESP_OK)
 		{
 			// casos de error de lectura del SGP40
@@ -151,10 +339,7 @@ static void sensors_sampling_task( void * pvParameters )
 
 		if (feed_voc_algorithm)
 		{
-			bool mqtt_data_created = false;
-			bool gui_data_created = false;
-			Sensors_data_ptr mqtt_data = NULL;
-			Sensors_data_ptr gui_data = NULL;
+			Sensors_data_t sample;
 
 			GasIndexAlgorithm_process(&voc_algorithm_params, ((int32_t)last_VOC_raw), &last_VOC_index);
 
@@ -162,54 +347,24 @@ static void sensors_sampling_task( void * pvParameters )
 					"temp=%u, humedad=%u, voc_raw(uint16_t)=%u, voc_raw(int32_t)=%d , voc_index=%d",
 					last_temperature_celsius, last_humidity_rh, last_VOC_raw, ((int)last_VOC_raw), ((int)last_VOC_index));
 
-			// montar objeto para mandar por mqtt si se ha podido crear
-			mqtt_data_created = sensors_type_create(&mqtt_data, last_VOC_raw, last_VOC_index,
-					last_temperature_celsius, last_humidity_rh);
-			ESP_LOGI(TAG, "Direccion de memoria de mqtt_data: %p", mqtt_data);
-			if (mqtt_data_created)
-			{
-				// envio por mqtt
-				if (gss_send_sensors_data(mqtt_data, GSS_ID_MQTT_SENDER) != ESP_OK)
-				{
-					ESP_LOGE(TAG, "Cola envio sensor data a mqtt llena, se descartara.");
-				}
-				else
-				{
-					ESP_LOGI(TAG, "Datos sensores enviado a cola mqtt.");
-				}
+			sample.voc_raw = last_VOC_raw;
+			sample.voc_index = (uint16_t)last_VOC_index;
+			sample.temperature_celsius = last_temperature_celsius;
+			sample.relative_humidity = last_humidity_rh;
 
-				gui_data_created = sensors_type_create(&gui_data, last_VOC_raw, last_VOC_index,
-									last_temperature_celsius, last_humidity_rh);
-				ESP_LOGI(TAG, "Direccion de memoria de gui_data: %p", gui_data);
+			// Realizar evaluacion para la activacion/desactivacion de alarmas
+			// antes de publicar la muestra, asi las alarmas que provoque
+			// llegan a los canales junto con ella
+			aqi_alarm_manager_evaluate(&sample);
 
-				if (gui_data_created)
-				{
-					// Realizar evaluacion para la activacion/desactivacion de alarmas
-					// aqui, justo antes de enviar los datos de sensor a la gui para
-					// lograr ahorrar memoria y que la implementacion sea correcta
-					// ya que si queremos leer los mismo datos (gui_data) depues
-					// de mandarlo por el GSS no tenemos garantias de que se haya
-					// podido destruir antes de poder completar la evaluacion para las alarmas
-					aqi_alarm_manager_evaluate(gui_data);
-
-					if (gss_send_sensors_data(gui_data, GSS_ID_GUI) != ESP_OK)
-					{
-						ESP_LOGE(TAG, "Cola envio sensor data a LCD llena, se descartara.");
-					}
-					else
-					{
-						ESP_LOGI(TAG, "Datos sensores enviado a cola LCD.");
-					}
-				}
-				else
-				{
-					ESP_LOGE(TAG, "No se pudo reservar memoria para datos de sensores (gui)");
-				}
-			}
-			else
+			// una sola copia en el ring del GSS para todos los consumidores
+			if (gss_publish_sensors_data(&sample) != ESP_OK)
 			{
-				ESP_LOGE(TAG, "No se pudo reservar memoria para datos de sensores (mqtt)");
+				ESP_LOGE(TAG, "No se pudo publicar la muestra de sensores");
 			}
+
+			sensors_poll_config_changes();
+			sensors_rollup_stage(&sample, esp_timer_get_time());
 		}
 
 		// Dormimos la tarea hasta el siguiente ciclo de lectura
@@ -242,6 +397,24 @@ esp_err_t sensors_service_init(int sample_rate_ms, i2c_port_t i2c_master_port, g
 	// inicializa algoritmo de calculo del VOC index
 	GasIndexAlgorithm_init(&voc_algorithm_params, GasIndexAlgorithm_ALGORITHM_TYPE_VOC);
 
+	// timers del motor de lectura asincrona
+	ret = sensors_async_init();
+	ESP_RETURN_ON_ERROR(ret, TAG, "No se pudo iniciar la lectura asincrona de sensores");
+
+	// canal del GSS para los cambios de rollup_sec, se registra una sola vez
+	if (sensors_gss_channel == GSS_ID_INVALID)
+	{
+		gss_channel_config_t channel_cfg = {
+				.name = SENSORS_GSS_CHANNEL_NAME,
+				.depth = 1,
+				.policy = GSS_OVERFLOW_OVERWRITE_LATEST,
+				.signals = GSS_SIGNAL_BIT(GSS_CONFIG_CHANGED),
+				.config_vars = AQI_CV_BIT(AQI_CV_SENSORS_ROLLUP_SECONDS),
+		};
+		ret = gss_register_channel(&channel_cfg, &sensors_gss_channel);
+		ESP_RETURN_ON_ERROR(ret, TAG, "No se pudo registrar el canal del GSS");
+	}
+
 	// iniciar una tarea para la lectura de los sensores
 	if (sensors_service_task_handler == NULL)
 	{
@@ -279,3 +452,38 @@ esp_err_t sensors_service_stop()
 
 	return ret;
 }
+
+void sensors_service_get_latency(sensors_service_latency_t *out)
+{
+	if (out != NULL)
+	{
+		portENTER_CRITICAL(&sensors_latency_lock);
+		*out = sensors_latency;
+		portEXIT_CRITICAL(&sensors_latency_lock);
+	}
+}
+
+const char* sensors_service_phase_to_string(SENSORS_PHASE phase)
+{
+	switch (phase)
+	{
+		case SENSORS_PHASE_SGP40_TRIGGER:
+			return "sgp40_trigger";
+		case SENSORS_PHASE_SHT40_TRIGGER:
+			return "sht40_trigger";
+		case SENSORS_PHASE_SHT40_WAIT:
+			return "sht40_wait";
+		case SENSORS_PHASE_SHT40_FETCH:
+			return "sht40_fetch";
+		case SENSORS_PHASE_SGP40_WAIT:
+			return "sgp40_wait";
+		case SENSORS_PHASE_SGP40_FETCH:
+			return "sgp40_fetch";
+		case SENSORS_PHASE_WAKEUP:
+			return "wakeup";
+		case SENSORS_PHASE_TOTAL:
+			return "total";
+		default:
+			return "UNKNOWN_PHASE";
+	}
+}
@@ -25,6 +25,44 @@
 // when sensors readings fails
 #define SENSORS_SERVICE_MAX_RETRIES		3u
 
+// Canal del GSS por el que la tarea de muestreo recibe los cambios de config
+#define SENSORS_GSS_CHANNEL_NAME		"sensors"
+
+/**
+ * Fases de un ciclo de muestreo segmentado (pipelined). La conversion del
+ * SGP40 se lanza primero con la compensacion del ciclo anterior y la del
+ * SHT40 se solapa con ella, de modo que la latencia total del ciclo se
+ * aproxima a la conversion mas larga de las dos (SGP40) en lugar de su suma.
+ * Las esperas las marca el motor asincrono (sensors_async.h) con esp_timer
+ * e incluyen lo que tarda la tarea en despertar tras cada deadline, WAKEUP
+ * es lo que pasa desde la ultima lectura hasta que el frame se procesa.
+ */
+typedef enum
+{
+	SENSORS_PHASE_SGP40_TRIGGER,
+	SENSORS_PHASE_SHT40_TRIGGER,
+	SENSORS_PHASE_SHT40_WAIT,
+	SENSORS_PHASE_SHT40_FETCH,
+	SENSORS_PHASE_SGP40_WAIT,
+	SENSORS_PHASE_SGP40_FETCH,
+	SENSORS_PHASE_WAKEUP,
+	SENSORS_PHASE_TOTAL,
+	SENSORS_PHASE_MAX
+} SENSORS_PHASE;
+
+typedef struct
+{
+	uint32_t last_us;
+	uint32_t max_us;
+	uint64_t sum_us;
+} sensors_phase_latency_t;
+
+typedef struct
+{
+	uint32_t cycles;
+	sensors_phase_latency_t phase[SENSORS_PHASE_MAX];
+} sensors_service_latency_t;
+
 /**
  * @brief Initializes I2C controller, SGP40 and SHT40 drivers;
  * 		  and create the task of the sensors service
@@ -44,4 +82,17 @@ esp_err_t sensors_service_init(int sample_rate_ms, i2c_port_t i2c_master_port, g
  */
 esp_err_t sensors_service_stop();
 
+/**
+ * @brief Copia el desglose de latencias por fase de los ciclos de muestreo
+ * 		  realizados hasta el momento. Es thread-safe.
+ *
+ * @param[out] out estructura donde se copian las estadisticas
+ */
+void sensors_service_get_latency(sensors_service_latency_t *out);
+
+/**
+ * For debug only
+ */
+const char* sensors_service_phase_to_string(SENSORS_PHASE phase);
+
 #endif /* MAIN_SENSORS_SERVICE_H_ */
@@ -7,41 +7,6 @@
 
 #include "sensors_type.h"
 #include <stdlib.h>
-#include "esp_heap_caps.h"
-#include "esp_log.h"
-
-static const char *TAG = "SENSORS_TYPE";
-
-bool sensors_type_create(Sensors_data_ptr* out_sensor_data , uint16_t voc_raw,
-						uint16_t voc_index, uint16_t temperature_celsius,
-						uint16_t relative_humidity)
-{
-	if (out_sensor_data == NULL)
-	{
-		return false;
-	}
-
-	heap_caps_check_integrity_all(true);
-	ESP_LOGI(TAG, "Heap libre antes de malloc: %d", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
-
-	(*out_sensor_data) = (Sensors_data_ptr)malloc(sizeof(Sensors_data_t));
-
-	heap_caps_check_integrity_all(true);
-	ESP_LOGI(TAG, "Heap libre despues de malloc: %d", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
-
-	// fallo de malloc
-	if ((*out_sensor_data) == NULL)
-	{
-		return false;
-	}
-
-	(*out_sensor_data)->relative_humidity = relative_humidity;
-	(*out_sensor_data)->temperature_celsius = temperature_celsius;
-	(*out_sensor_data)->voc_index = voc_index;
-	(*out_sensor_data)->voc_raw = voc_raw;
-
-	return true;
-}
 
 esp_err_t sensors_type_to_JSON(struct json_out * json_buffer, uint32_t buffer_size, Sensors_data_ptr sensors_data)
 {
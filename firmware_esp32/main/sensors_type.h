@@ -22,29 +22,6 @@ typedef struct Sensors_data_t
 
 typedef Sensors_data_t* Sensors_data_ptr;
 
-/**
- * @brief Creates a new instance of a Sensors_data_t.
- * If sensor_data is NULL, creates a new structure in the heap
- * and intializes it with the data passed as arguments.
- *
- * @param[out] sensor_data pointer to a Sensosr_data_ptr which
- * 		  pointed structure must be created and initialized
- * @param[in] voc_raw
- * @param[in] voc_index
- * @param[in] temperature_celsius
- * @param[in] relative_humidity
- *
- * @return Returns ESP_OK if a new structure has been allocated.
- * 		   Returns ESP_FAIL if the new structure can not be allocated in the heap
- * 		   and the creations fails.
- *
- * @warning If the contents of out_sensor_data is not null (It is currently pointing to
- * 			a previously allocated structure) you may lose the pointer to some allocated memory
- */
-bool sensors_type_create(Sensors_data_ptr* out_sensor_data , uint16_t voc_raw,
-						uint16_t voc_index, uint16_t temperature_celsius,
-						uint16_t relative_humidity);
-
 /**
  * @brief Function to generate JSON string with the data from sensors
  * 		  The JSON has the format:
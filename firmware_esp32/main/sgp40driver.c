@@ -15,13 +15,12 @@
 
 static const char *TAG = "SGP40";
 
-static i2c_port_t sgp40_i2c_port;
+static i2c_master_device_t sgp40_device;
 
 esp_err_t sgp40_i2c_master_init(i2c_port_t i2c_master_port)
 {
-	sgp40_i2c_port = i2c_master_port;
-
-	return ESP_OK;
+	return (i2c_master_device_init(&sgp40_device, i2c_master_port, SGP40_ADDRESS,
+			SGP40_WAIT_TIME_MS / portTICK_PERIOD_MS));
 }
 
 void sgp40_compensation_t_init(sgp40_compensation_t *obj, const uint16_t temperature_celsius,
@@ -43,14 +42,18 @@ void sgp40_compensation_t_init(sgp40_compensation_t *obj, const uint16_t tempera
 	obj->temperature_CRC = sensirion_i2c_generate_crc(temp_arr, RAW_MEASURE_SIZE);
 }
 
-esp_err_t sgp40_i2c_get_raw_measure(uint16_t *raw_measure,
-								    SGP40_COMPENSATION compensation,
-									sgp40_compensation_t *comp_data)
+esp_err_t sgp40_i2c_trigger_raw_measure(SGP40_COMPENSATION compensation,
+										sgp40_compensation_t *comp_data)
 {
-	uint8_t humidity[HUMIDITY_BUFFER_SIZE];
-	uint8_t temperature[TEMPERATURE_BUFFER_SIZE];
+	// comando (2 bytes) + humedad y CRC + temperatura y CRC
+	uint8_t frame[2 + HUMIDITY_BUFFER_SIZE + TEMPERATURE_BUFFER_SIZE];
+	uint8_t *humidity = &frame[2];
+	uint8_t *temperature = &frame[2 + HUMIDITY_BUFFER_SIZE];
 	esp_err_t transactionResult = ESP_OK;
-	i2c_cmd_handle_t cmdRawMeasure;
+
+	// byte 0 and 1 of raw measurement command
+	frame[0] = SGP40_CMD_MEASURE_RAW_0;
+	frame[1] = SGP40_CMD_MEASURE_RAW_1;
 
 	if ((compensation == SGP40_COMP_ON) && (comp_data != NULL))
 	{
@@ -73,25 +76,49 @@ esp_err_t sgp40_i2c_get_raw_measure(uint16_t *raw_measure,
 		temperature[2] = (uint8_t)SGP40_DEFAULT_TEMPERATURE_CRC;
 	}
 
-	cmdRawMeasure = i2c_cmd_link_create();
-
-	// start condition
-	i2c_master_start(cmdRawMeasure);
-
-	// send address and write op with ACK
-	i2c_master_write_byte(cmdRawMeasure, (SGP40_ADDRESS << 1) | I2C_MASTER_WRITE,
-			I2C_ACK);
-	// send byte 0 and 1 of raw measurement command
-	i2c_master_write_byte(cmdRawMeasure, SGP40_CMD_MEASURE_RAW_0, I2C_ACK);
-	i2c_master_write_byte(cmdRawMeasure, SGP40_CMD_MEASURE_RAW_1, I2C_ACK);
-	// send humidity+CRC word
-	i2c_master_write(cmdRawMeasure, humidity, HUMIDITY_BUFFER_SIZE, I2C_ACK);
-	// send temperature+CRC word
-	i2c_master_write(cmdRawMeasure, temperature, TEMPERATURE_BUFFER_SIZE, I2C_ACK);
-	i2c_master_stop(cmdRawMeasure);
-	transactionResult = i2c_master_cmd_begin(sgp40_i2c_port, cmdRawMeasure,
-			SGP40_WAIT_TIME_MS / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmdRawMeasure);
+	transactionResult = i2c_master_device_write(&sgp40_device, frame, sizeof(frame));
+
+	ESP_RETURN_ON_ERROR(transactionResult, TAG, "Solicitud de medicion a SGP40 fallida");
+
+	return (transactionResult);
+}
+
+esp_err_t sgp40_i2c_fetch_raw_measure(uint16_t *raw_measure)
+{
+	esp_err_t transactionResult = ESP_OK;
+	// palabra de medida + CRC
+	uint8_t measureBuffer[RAW_MEASURE_SIZE + 1];
+	uint8_t readMeasureCRC = 0;
+
+	// retrieve the measure
+	transactionResult = i2c_master_device_read(&sgp40_device, measureBuffer,
+			sizeof(measureBuffer));
+	readMeasureCRC = measureBuffer[RAW_MEASURE_SIZE];
+
+	if (transactionResult == ESP_OK)
+	{
+		if ((sensirion_i2c_check_crc(measureBuffer, RAW_MEASURE_SIZE, readMeasureCRC) == NO_ERROR))
+		{
+			*raw_measure = (measureBuffer[0] << 8) | measureBuffer[1];
+		}
+		else
+		{
+			transactionResult = ESP_ERR_INVALID_CRC;
+		}
+	}
+	else
+	{
+		ESP_RETURN_ON_ERROR(transactionResult, TAG, "Lectura de datos de SGP40 fallida");
+	}
+
+	return (transactionResult);
+}
+
+esp_err_t sgp40_i2c_get_raw_measure(uint16_t *raw_measure,
+								    SGP40_COMPENSATION compensation,
+									sgp40_compensation_t *comp_data)
+{
+	esp_err_t transactionResult = sgp40_i2c_trigger_raw_measure(compensation, comp_data);
 
 	// wait the maximum time needed by sgp40 to provide the raw measure
 	TickType_t xLastWakeTime = xTaskGetTickCount();
@@ -116,41 +143,7 @@ esp_err_t sgp40_i2c_get_raw_measure(uint16_t *raw_measure,
 
 	if (transactionResult == ESP_OK)
 	{
-		// retrieve the measure
-		cmdRawMeasure = i2c_cmd_link_create();
-		i2c_master_start(cmdRawMeasure);
-		// send address and read operation
-		i2c_master_write_byte(cmdRawMeasure, (SGP40_ADDRESS << 1) | I2C_MASTER_READ,
-					I2C_ACK);
-		uint8_t measureBuffer[RAW_MEASURE_SIZE];
-		i2c_master_read(cmdRawMeasure, measureBuffer, RAW_MEASURE_SIZE,
-				I2C_MASTER_ACK);
-		uint8_t readMeasureCRC = 0;
-		i2c_master_read_byte(cmdRawMeasure, &readMeasureCRC, I2C_MASTER_LAST_NACK);
-		i2c_master_stop(cmdRawMeasure);
-		transactionResult = i2c_master_cmd_begin(sgp40_i2c_port, cmdRawMeasure,
-				SGP40_WAIT_TIME_MS / portTICK_PERIOD_MS);
-		i2c_cmd_link_delete(cmdRawMeasure);
-
-		if (transactionResult == ESP_OK)
-		{
-			if ((sensirion_i2c_check_crc(measureBuffer, RAW_MEASURE_SIZE, readMeasureCRC) == NO_ERROR))
-			{
-				*raw_measure = (measureBuffer[0] << 8) | measureBuffer[1];
-			}
-			else
-			{
-				transactionResult = ESP_ERR_INVALID_CRC;
-			}
-		}
-		else
-		{
-			ESP_RETURN_ON_ERROR(transactionResult, TAG, "Lectura de datos de SGP40 fallida");
-		}
-	}
-	else
-	{
-		ESP_RETURN_ON_ERROR(transactionResult, TAG, "Solicitud de medicion a SGP40 fallida");
+		transactionResult = sgp40_i2c_fetch_raw_measure(raw_measure);
 	}
 
 	/* Solo para test*/
@@ -84,6 +84,19 @@ extern esp_err_t sgp40_i2c_master_init(i2c_port_t i2c_master_port);
 extern esp_err_t sgp40_i2c_get_raw_measure(uint16_t *raw_measure,
 										   SGP40_COMPENSATION compensation,
 										   sgp40_compensation_t *comp_data);
+
+/**
+ * @brief API en dos fases (trigger / fetch) de la medicion raw.
+ *
+ * 		  sgp40_i2c_trigger_raw_measure envia el comando de medicion con los
+ * 		  datos de compensacion y vuelve sin esperar. El llamador debe esperar al
+ * 		  menos SGP40_TIME_UNTIL_MEASURE_AVAILABLE_MS antes de llamar a
+ * 		  sgp40_i2c_fetch_raw_measure, que lee la medida y comprueba su CRC.
+ * 		  Permite solapar la conversion del SGP40 con la del SHT40.
+ */
+extern esp_err_t sgp40_i2c_trigger_raw_measure(SGP40_COMPENSATION compensation,
+										   	   sgp40_compensation_t *comp_data);
+extern esp_err_t sgp40_i2c_fetch_raw_measure(uint16_t *raw_measure);
 extern esp_err_t sgp40_i2c_soft_reset(void);
 extern esp_err_t sgp40_i2c_measure_test(uint16_t *test_result);
 
@@ -15,36 +15,102 @@
 
 static const char *TAG = "SHT40";
 
-static i2c_port_t sht40_i2c_port;
+// buffers de comandos estaticos: direccion del sensor y general call
+static i2c_master_device_t sht40_device;
+static i2c_master_device_t sht40_general_call_device;
 
 esp_err_t sht40_i2c_master_init(i2c_port_t i2c_master_port)
 {
-	sht40_i2c_port = i2c_master_port;
+	ESP_RETURN_ON_ERROR(i2c_master_device_init(&sht40_device, i2c_master_port, SHT40_ADDRESS,
+			SHT40_I2CBUS_WAIT_TIME_MS / portTICK_PERIOD_MS), TAG, "Init SHT40 fallido");
 
-	return ESP_OK;
+	return (i2c_master_device_init(&sht40_general_call_device, i2c_master_port,
+			SHT40_GENERAL_CALL_ADDRESS, SHT40_I2CBUS_WAIT_TIME_MS / portTICK_PERIOD_MS));
 }
 
-static esp_err_t sht40_i2c_read_frame(uint8_t sht40_cmd_id, uint16_t *data_word1, uint16_t *data_word2,
-										TickType_t time_to_read)
+static uint8_t sht40_precision_to_cmd(SHT40_PRECISION precision)
+{
+	switch (precision)
+	{
+	case SHT40_PRECISION_MEDIUM:
+		return SHT40_CMD_TEMP_HUMIDITY_MEDIUM_PRECISION;
+	case SHT40_PRECISION_LOW:
+		return SHT40_CMD_TEMP_HUMIDITY_LOW_PRECISION;
+	case SHT40_PRECISION_HIGH:
+	default:
+		return SHT40_CMD_TEMP_HUMIDITY_HIGH_PRECISION;
+	}
+}
+
+uint32_t sht40_get_measure_time_ms(SHT40_PRECISION precision)
+{
+	switch (precision)
+	{
+	case SHT40_PRECISION_MEDIUM:
+		return SHT40_MEASURE_TIME_MED_MS;
+	case SHT40_PRECISION_LOW:
+		// se mantiene el margen del tiempo de alta precision
+		return SHT40_MEASURE_TIME_HIGH_MS;
+	case SHT40_PRECISION_HIGH:
+	default:
+		return SHT40_MEASURE_TIME_HIGH_MS;
+	}
+}
+
+/**
+ * Envia un comando de un byte al dispositivo indicado (direccion del SHT40
+ * o direccion de general call)
+ */
+static esp_err_t sht40_i2c_send_cmd(i2c_master_device_t *device, uint8_t sht40_cmd_id)
+{
+	return (i2c_master_device_write(device, &sht40_cmd_id, 1));
+}
+
+/**
+ * Lee el frame de 6 bytes con el resultado de la ultima conversion
+ * y comprueba el CRC de ambas palabras
+ */
+static esp_err_t sht40_i2c_read_words(uint16_t *data_word1, uint16_t *data_word2)
 {
-	i2c_cmd_handle_t i2c_cmd_handle;
 	esp_err_t transaction_result = ESP_FAIL;
 	uint8_t frame_buffer[SHT40_FRAME_LENGTH_BYTES];
 
-	i2c_cmd_handle = i2c_cmd_link_create();
-	// start condition
-	i2c_master_start(i2c_cmd_handle);
+	// retrieve the measure
+	transaction_result = i2c_master_device_read(&sht40_device, frame_buffer,
+			SHT40_FRAME_LENGTH_BYTES);
 
-	// send address and write operation with ACK
-	i2c_master_write_byte(i2c_cmd_handle, (SHT40_ADDRESS << 1) | I2C_MASTER_WRITE,
-			I2C_ACK);
-	// send byte of command
-	i2c_master_write_byte(i2c_cmd_handle, sht40_cmd_id, I2C_ACK);
-	i2c_master_stop(i2c_cmd_handle);
+	if (transaction_result == ESP_OK)
+	{
+		uint8_t crc_first_frame = frame_buffer[2];
+		uint8_t crc_second_frame = frame_buffer[5];
 
-	transaction_result = i2c_master_cmd_begin(sht40_i2c_port, i2c_cmd_handle,
-			SHT40_I2CBUS_WAIT_TIME_MS / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(i2c_cmd_handle);
+		if ((sensirion_i2c_check_crc(frame_buffer, SHT40_WORD_LENGTH_BYTES, crc_first_frame) != NO_ERROR)
+				|| (sensirion_i2c_check_crc(&frame_buffer[3], SHT40_WORD_LENGTH_BYTES, crc_second_frame) != NO_ERROR))
+		{
+			transaction_result = ESP_ERR_INVALID_CRC;
+		}
+
+		// devolver datos leidos del sensor solo si ambos son validos,
+		// si alguno se transmitio con errores se devolvera error y
+		// no se devuelven las lecturas
+		if (transaction_result != ESP_ERR_INVALID_CRC)
+		{
+			*data_word1 = (frame_buffer[0] << 8) | frame_buffer[1];
+			*data_word2 = (frame_buffer[3] << 8) | frame_buffer[4];
+		}
+	}
+	else
+	{
+		ESP_RETURN_ON_ERROR(transaction_result, TAG, "Lectura de datos de SHT40 fallida: %s", esp_err_to_name(transaction_result));
+	}
+
+	return transaction_result;
+}
+
+static esp_err_t sht40_i2c_read_frame(uint8_t sht40_cmd_id, uint16_t *data_word1, uint16_t *data_word2,
+										TickType_t time_to_read)
+{
+	esp_err_t transaction_result = sht40_i2c_send_cmd(&sht40_device, sht40_cmd_id);
 
 	// wait the maximum time needed by sht40 to provide the result data frame
 	TickType_t xLastWakeTime = xTaskGetTickCount();
@@ -68,44 +134,7 @@ static esp_err_t sht40_i2c_read_frame(uint8_t sht40_cmd_id, uint16_t *data_word1
 
 	if (transaction_result == ESP_OK)
 	{
-		// retrieve the measure
-		i2c_cmd_handle = i2c_cmd_link_create();
-		i2c_master_start(i2c_cmd_handle);
-		// send address and read operation
-		i2c_master_write_byte(i2c_cmd_handle, (SHT40_ADDRESS << 1) | I2C_MASTER_READ,
-				I2C_ACK);
-		i2c_master_read(i2c_cmd_handle, frame_buffer, SHT40_FRAME_LENGTH_BYTES,
-				I2C_MASTER_LAST_NACK);
-		i2c_master_stop(i2c_cmd_handle);
-
-		transaction_result = i2c_master_cmd_begin(sht40_i2c_port, i2c_cmd_handle,
-					SHT40_I2CBUS_WAIT_TIME_MS / portTICK_PERIOD_MS);
-			i2c_cmd_link_delete(i2c_cmd_handle);
-
-		if (transaction_result == ESP_OK)
-		{
-			uint8_t crc_first_frame = frame_buffer[2];
-			uint8_t crc_second_frame = frame_buffer[5];
-
-			if ((sensirion_i2c_check_crc(frame_buffer, SHT40_WORD_LENGTH_BYTES, crc_first_frame) != NO_ERROR)
-					|| (sensirion_i2c_check_crc(&frame_buffer[3], SHT40_WORD_LENGTH_BYTES, crc_second_frame) != NO_ERROR))
-			{
-				transaction_result = ESP_ERR_INVALID_CRC;
-			}
-
-			// devolver datos leidos del sensor solo si ambos son validos,
-			// si alguno se transmitio con errores se devolvera error y
-			// no se devuelven las lecturas
-			if (transaction_result != ESP_ERR_INVALID_CRC)
-			{
-				*data_word1 = (frame_buffer[0] << 8) | frame_buffer[1];
-				*data_word2 = (frame_buffer[3] << 8) | frame_buffer[4];
-			}
-		}
-		else
-		{
-			ESP_RETURN_ON_ERROR(transaction_result, TAG, "Lectura de datos de SHT40 fallida: %s", esp_err_to_name(transaction_result));
-		}
+		transaction_result = sht40_i2c_read_words(data_word1, data_word2);
 	}
 	else
 	{
@@ -118,6 +147,22 @@ static esp_err_t sht40_i2c_read_frame(uint8_t sht40_cmd_id, uint16_t *data_word1
 	return (transaction_result);
 }
 
+esp_err_t sht40_i2c_trigger_measure(SHT40_PRECISION precision)
+{
+	esp_err_t transaction_result = sht40_i2c_send_cmd(&sht40_device,
+			sht40_precision_to_cmd(precision));
+
+	ESP_RETURN_ON_ERROR(transaction_result, TAG, "solicitud I2C a SHT40 fallida: %s",
+			esp_err_to_name(transaction_result));
+
+	return transaction_result;
+}
+
+esp_err_t sht40_i2c_fetch_measure(uint16_t *temp, uint16_t *humidity)
+{
+	return (sht40_i2c_read_words(temp, humidity));
+}
+
 esp_err_t sht40_i2c_get_measure_high_precision(uint16_t *temp, uint16_t *humidity)
 {
 	return (sht40_i2c_read_frame(SHT40_CMD_TEMP_HUMIDITY_HIGH_PRECISION,
@@ -148,31 +193,14 @@ esp_err_t sht40_i2c_get_measure_low_precision(uint16_t *temp, uint16_t *humidity
 
 static esp_err_t sht40_i2c_reset_cmd(uint8_t sht40_cmd_reset)
 {
-	i2c_cmd_handle_t cmd_reset;
-	esp_err_t transaction_result = ESP_FAIL;
-	uint8_t device_address = SHT40_ADDRESS;
+	i2c_master_device_t *device = &sht40_device;
 
 	if (sht40_cmd_reset == SHT40_CMD_GENERAL_CALL_RESET)
 	{
-		device_address = SHT40_GENERAL_CALL_ADDRESS;
+		device = &sht40_general_call_device;
 	}
 
-	cmd_reset = i2c_cmd_link_create();
-	// start condition
-	i2c_master_start(cmd_reset);
-
-	// send address and write op with ACK
-	i2c_master_write_byte(cmd_reset, (device_address << 1) | I2C_MASTER_WRITE,
-			I2C_ACK);
-	// send byte of command high precision measure
-	i2c_master_write_byte(cmd_reset, sht40_cmd_reset, I2C_ACK);
-	i2c_master_stop(cmd_reset);
-
-	transaction_result = i2c_master_cmd_begin(sht40_i2c_port, cmd_reset,
-			SHT40_I2CBUS_WAIT_TIME_MS / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd_reset);
-
-	return transaction_result;
+	return (sht40_i2c_send_cmd(device, sht40_cmd_reset));
 }
 
 esp_err_t sht40_i2c_soft_reset(void)
@@ -45,12 +45,34 @@
 
 
 //*****************************************************************************
-//      SGP40 API
+//      SHT40 API
 //*****************************************************************************
 
 #define sht40_quotient(signal_ticks) ( (((float)signal_ticks)) / SHT40_FORMULA_DENOMINATOR )
 
+typedef enum
+{
+	SHT40_PRECISION_HIGH,
+	SHT40_PRECISION_MEDIUM,
+	SHT40_PRECISION_LOW
+} SHT40_PRECISION;
+
 extern esp_err_t sht40_i2c_master_init(i2c_port_t i2c_master_port);
+
+/**
+ * @brief API en dos fases (trigger / fetch) para poder solapar la conversion
+ * 		  del SHT40 con la de otros dispositivos del bus.
+ *
+ * 		  sht40_i2c_trigger_measure solo envia el comando de medicion y vuelve
+ * 		  inmediatamente. El llamador debe esperar al menos
+ * 		  sht40_get_measure_time_ms(precision) antes de llamar a
+ * 		  sht40_i2c_fetch_measure, que lee el frame y comprueba los CRC.
+ * 		  Si se lee antes de tiempo el SHT40 responde con NACK.
+ */
+extern esp_err_t sht40_i2c_trigger_measure(SHT40_PRECISION precision);
+extern esp_err_t sht40_i2c_fetch_measure(uint16_t *temp, uint16_t *humidity);
+extern uint32_t sht40_get_measure_time_ms(SHT40_PRECISION precision);
+
 extern esp_err_t sht40_i2c_get_measure_high_precision(uint16_t *temp, uint16_t *humidity);
 extern esp_err_t sht40_i2c_get_measure_medium_precision(uint16_t *temp, uint16_t *humidity);
 extern esp_err_t sht40_i2c_get_measure_low_precision(uint16_t *temp, uint16_t *humidity);
@@ -0,0 +1,137 @@
+/*
+ * slab_pool.c
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ */
+
+#include "slab_pool.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char * TAG = "SLAB_POOL";
+
+#if CONFIG_AQI_SLAB_POOL_DEBUG
+// relleno de los slots libres, un uso tras liberar lee este patron
+#define SLAB_POOL_POISON	0xA5
+#endif
+
+/**
+ * Indice del slot al que apunta obj, o -1 si no pertenece al pool
+ */
+static int slab_pool_index(const slab_pool_t *pool, const void *obj)
+{
+	const uint8_t *p = (const uint8_t*)obj;
+
+	if ((p < pool->storage) || (p >= pool->storage + (pool->slot_size * pool->capacity)))
+	{
+		return -1;
+	}
+	if (((size_t)(p - pool->storage) % pool->slot_size) != 0)
+	{
+		return -1;
+	}
+
+	return (int)((size_t)(p - pool->storage) / pool->slot_size);
+}
+
+void* slab_pool_alloc(slab_pool_t *pool)
+{
+	uint8_t *obj = NULL;
+
+	assert(pool != NULL);
+
+	portENTER_CRITICAL(&pool->lock);
+	if (pool->free_list != NULL)
+	{
+		obj = (uint8_t*)pool->free_list;
+		pool->free_list = pool->free_list->next;
+	}
+	else if (pool->next_unused < pool->capacity)
+	{
+		// los slots se entregan en orden la primera vez, no hace falta
+		// construir la lista libre al arrancar
+		obj = pool->storage + (pool->slot_size * pool->next_unused);
+		pool->next_unused++;
+	}
+
+	if (obj != NULL)
+	{
+		pool->in_use++;
+		pool->allocs++;
+		if (pool->in_use > pool->peak)
+		{
+			pool->peak = pool->in_use;
+		}
+#if CONFIG_AQI_SLAB_POOL_DEBUG
+		pool->owned[slab_pool_index(pool, obj)] = 1;
+#endif
+	}
+	else
+	{
+		pool->failures++;
+	}
+	portEXIT_CRITICAL(&pool->lock);
+
+	if (obj == NULL)
+	{
+		ESP_LOGW(TAG, "Pool %s agotado (%u objetos)", pool->name, pool->capacity);
+	}
+
+	return obj;
+}
+
+esp_err_t slab_pool_free(slab_pool_t *pool, void *obj)
+{
+	int index;
+
+	assert(pool != NULL);
+
+	if (obj == NULL)
+	{
+		return ESP_OK;
+	}
+
+	index = slab_pool_index(pool, obj);
+	if (index < 0)
+	{
+		ESP_LOGE(TAG, "Pool %s: %p no es un objeto del pool", pool->name, obj);
+		assert(false);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	portENTER_CRITICAL(&pool->lock);
+#if CONFIG_AQI_SLAB_POOL_DEBUG
+	if (pool->owned[index] == 0)
+	{
+		portEXIT_CRITICAL(&pool->lock);
+		ESP_LOGE(TAG, "Pool %s: doble liberacion del slot %d (%p)", pool->name, index, obj);
+		assert(false);
+		return ESP_ERR_INVALID_STATE;
+	}
+	pool->owned[index] = 0;
+	memset(obj, SLAB_POOL_POISON, pool->slot_size);
+#endif
+	((slab_pool_node_t*)obj)->next = pool->free_list;
+	pool->free_list = (slab_pool_node_t*)obj;
+	pool->in_use--;
+	portEXIT_CRITICAL(&pool->lock);
+
+	return ESP_OK;
+}
+
+void slab_pool_get_stats(slab_pool_t *pool, slab_pool_stats_t *out)
+{
+	assert((pool != NULL) && (out != NULL));
+
+	portENTER_CRITICAL(&pool->lock);
+	out->capacity = pool->capacity;
+	out->in_use = pool->in_use;
+	out->peak = pool->peak;
+	out->allocs = pool->allocs;
+	out->failures = pool->failures;
+	portEXIT_CRITICAL(&pool->lock);
+}
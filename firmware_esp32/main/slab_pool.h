@@ -0,0 +1,110 @@
+/*
+ * slab_pool.h
+ *
+ *  Created on: 17 oct 2026
+ *      Author: NRR
+ *
+ *  Pool estatico de objetos de tamano fijo. Reservar y liberar son O(1)
+ *  (lista libre intrusiva) y no tocan el heap general, que comparten LVGL
+ *  y el cliente MQTT.
+ *
+ *  Con CONFIG_AQI_SLAB_POOL_DEBUG cada slot lleva una marca de propiedad
+ *  para detectar dobles liberaciones, y los slots liberados se rellenan
+ *  con un patron para que un uso tras liberar sea visible.
+ */
+
+#ifndef MAIN_SLAB_POOL_H_
+#define MAIN_SLAB_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+//Include FreeRTOS headers
+#include "freertos/FreeRTOS.h"
+
+typedef struct slab_pool_node
+{
+	struct slab_pool_node *next;
+} slab_pool_node_t;
+
+typedef struct
+{
+	const char *name;
+	uint8_t *storage;
+	size_t slot_size;
+	uint16_t capacity;
+	uint16_t next_unused;		// slots a partir de aqui no se han entregado nunca
+	slab_pool_node_t *free_list;
+	uint16_t in_use;
+	uint16_t peak;
+	uint32_t allocs;
+	uint32_t failures;			// reservas con el pool agotado
+#if CONFIG_AQI_SLAB_POOL_DEBUG
+	uint8_t *owned;				// 1 si el slot esta entregado
+#endif
+	portMUX_TYPE lock;
+} slab_pool_t;
+
+/**
+ * Ocupacion de un pool
+ */
+typedef struct
+{
+	uint16_t capacity;
+	uint16_t in_use;
+	uint16_t peak;
+	uint32_t allocs;
+	uint32_t failures;
+} slab_pool_stats_t;
+
+#if CONFIG_AQI_SLAB_POOL_DEBUG
+#define SLAB_POOL_OWNED_MAP(pool, count)	static uint8_t pool##_owned[(count)];
+#define SLAB_POOL_OWNED_INIT(pool)			.owned = pool##_owned,
+#else
+#define SLAB_POOL_OWNED_MAP(pool, count)
+#define SLAB_POOL_OWNED_INIT(pool)
+#endif
+
+/**
+ * Define un pool estatico 'pool' de 'count' objetos de tipo 'type'. La
+ * union garantiza el tamano y la alineacion del slot tanto para el objeto
+ * como para el nodo de la lista libre
+ */
+#define SLAB_POOL_DEFINE(pool, type, count) \
+	static union { type obj; slab_pool_node_t node; } pool##_slots[(count)]; \
+	SLAB_POOL_OWNED_MAP(pool, count) \
+	static slab_pool_t pool = { \
+		.name = #pool, \
+		.storage = (uint8_t*)pool##_slots, \
+		.slot_size = sizeof(pool##_slots[0]), \
+		.capacity = (count), \
+		SLAB_POOL_OWNED_INIT(pool) \
+		.lock = portMUX_INITIALIZER_UNLOCKED, \
+	}
+
+/**
+ * @brief Reserva un objeto del pool. Es thread-safe.
+ *
+ * @return puntero al objeto (sin inicializar) o NULL si el pool esta agotado
+ */
+void* slab_pool_alloc(slab_pool_t *pool);
+
+/**
+ * @brief Devuelve un objeto al pool. Es thread-safe.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG si el puntero no es un slot del pool,
+ * 		   ESP_ERR_INVALID_STATE si el slot ya estaba libre (solo se detecta
+ * 		   con CONFIG_AQI_SLAB_POOL_DEBUG)
+ */
+esp_err_t slab_pool_free(slab_pool_t *pool, void *obj);
+
+/**
+ * @brief Copia la ocupacion del pool
+ */
+void slab_pool_get_stats(slab_pool_t *pool, slab_pool_stats_t *out);
+
+#endif /* MAIN_SLAB_POOL_H_ */
@@ -0,0 +1,115 @@
+import struct
+import sys
+
+import paho.mqtt.client as mqtt
+
+# Decodificador de referencia del formato binario de firmware_esp32/main/aqi_wire_format.h
+# Devuelve los mismos campos que los JSON de los topics measures/alarms/measures/batch
+
+# Configuración del broker MQTT
+broker_address = "192.168.1.17"
+broker_port = 1883
+topic_base = "/tfm/nrr/airquality"
+
+AQI_WIRE_VERSION = 1
+
+SCHEMA_MEASURE = 1
+SCHEMA_ALARM = 2
+SCHEMA_BATCH = 3
+
+ALARM_FLAG_DISABLE = 0x01
+
+# Todo little endian y sin padding
+HEADER = struct.Struct("<BB")
+MEASURE = struct.Struct("<HHHH")
+ALARM = struct.Struct("<BB")
+BATCH_HEADER = struct.Struct("<IB")
+BATCH_SAMPLE = struct.Struct("<IHHHH")
+
+# El texto de las alarmas no viaja en binario, se deduce de la clase
+alarm_messages = {
+    0: "La temperatura es demasiado elevada. Recomendamos activar la climatizacion.",
+    1: "La temperatura es demasiado baja. Recomendamos activar la climatizacion.",
+    2: "La humedad es demasiado elevada. Recomendamos deshumidificar el ambiente.",
+    3: "La humedad es demasiado baja. Recomendamos humidificar el ambiente.",
+    4: "La calidad del aire es mala. Recomendamos ventilar o purificar el aire."
+}
+
+
+def measure_to_dict(values):
+    humidity, temp, voc_raw, voc_index = values
+    return {
+        "humidity_rh": humidity,
+        "temp_celsius": temp,
+        "voc_raw": voc_raw,
+        "voc_index": voc_index
+    }
+
+
+# Decodifica un payload binario. Lanza ValueError si no es valido
+def decode(payload):
+    if len(payload) < HEADER.size:
+        raise ValueError("payload demasiado corto")
+
+    version, schema = HEADER.unpack_from(payload, 0)
+    if version != AQI_WIRE_VERSION:
+        raise ValueError(f"version {version} no soportada")
+
+    body = payload[HEADER.size:]
+
+    if schema == SCHEMA_MEASURE:
+        if len(body) != MEASURE.size:
+            raise ValueError("medida con longitud incorrecta")
+        return measure_to_dict(MEASURE.unpack(body))
+
+    if schema == SCHEMA_ALARM:
+        if len(body) != ALARM.size:
+            raise ValueError("alarma con longitud incorrecta")
+        alarm_class, flags = ALARM.unpack(body)
+        return {
+            "disable": bool(flags & ALARM_FLAG_DISABLE),
+            "alarm_class": alarm_class,
+            "info": alarm_messages.get(alarm_class, "")
+        }
+
+    if schema == SCHEMA_BATCH:
+        if len(body) < BATCH_HEADER.size:
+            raise ValueError("batch sin cabecera")
+        sent_ms, count = BATCH_HEADER.unpack_from(body, 0)
+        if len(body) != BATCH_HEADER.size + count * BATCH_SAMPLE.size:
+            raise ValueError("batch con longitud incorrecta")
+        samples = []
+        for i in range(count):
+            t_ms, *values = BATCH_SAMPLE.unpack_from(body, BATCH_HEADER.size + i * BATCH_SAMPLE.size)
+            sample = {"t_ms": t_ms}
+            sample.update(measure_to_dict(values))
+            samples.append(sample)
+        return {"sent_ms": sent_ms, "samples": samples}
+
+    raise ValueError(f"schema {schema} desconocido")
+
+
+def on_message(client, userdata, msg):
+    try:
+        print(f"{msg.topic} ({len(msg.payload)} bytes): {decode(msg.payload)}")
+    except ValueError as e:
+        print(f"{msg.topic}: payload invalido: {e}")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 1:
+        topic_base = sys.argv[1]
+
+    client = mqtt.Client()
+    client.on_message = on_message
+    client.connect(broker_address, broker_port, 60)
+    client.subscribe(topic_base + "/measures/bin")
+    client.subscribe(topic_base + "/alarms/bin")
+    client.subscribe(topic_base + "/measures/batch/bin")
+
+    try:
+        client.loop_forever()
+    except KeyboardInterrupt:
+        print("Interrumpido por el usuario")
+
+    client.disconnect()
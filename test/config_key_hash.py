@@ -0,0 +1,70 @@
+import itertools
+import re
+import sys
+
+# Busca los multiplicadores del hash perfecto de las claves del JSON de
+# configuracion (lista AQI_DEVICE_CONFIG_VARS en
+# firmware_esp32/main/aqi_device_config_type.h):
+#   h = (len + a*key[len-1] + b*key[len/2] + key[0]) & (size-1)
+# Sin argumentos comprueba los valores actuales e imprime el slot de cada
+# clave. Con --search prueba otros multiplicadores y tamanos de tabla.
+
+config_source = "firmware_esp32/main/aqi_device_config_type.h"
+
+current = {"a": 5, "b": 11, "size": 32}
+
+
+def read_keys(path):
+    with open(path, encoding="utf-8") as f:
+        source = f.read()
+    # X(id, campo, tipo, clave NVS, clave JSON, ...)
+    return re.findall(r'^\s*X\(\w+,\s*\w+,\s*\w+,\s*"\w+",\s*"([a-z_]+)"', source, re.M)
+
+
+def key_hash(key, a, b, size):
+    k = key.encode()
+    n = len(k)
+    return (n + a * k[n - 1] + b * k[n // 2] + k[0]) & (size - 1)
+
+
+def slots(keys, a, b, size):
+    result = {}
+    for key in keys:
+        h = key_hash(key, a, b, size)
+        if h in result:
+            return None
+        result[h] = key
+    return result
+
+
+def search(keys):
+    size = 16
+    while size < len(keys):
+        size *= 2
+    while size <= 256:
+        for a, b in itertools.product(range(1, 32), repeat=2):
+            table = slots(keys, a, b, size)
+            if table is not None:
+                return a, b, size, table
+        size *= 2
+    return None
+
+
+if __name__ == "__main__":
+    keys = read_keys(sys.argv[2] if len(sys.argv) > 2 else config_source)
+    if len(sys.argv) > 1 and sys.argv[1] == "--search":
+        found = search(keys)
+        if found is None:
+            print("No hay hash perfecto con estos multiplicadores")
+            sys.exit(1)
+        a, b, size, table = found
+    else:
+        a, b, size = current["a"], current["b"], current["size"]
+        table = slots(keys, a, b, size)
+        if table is None:
+            print(f"Colision con a={a} b={b} size={size}, ejecutar con --search")
+            sys.exit(1)
+
+    print(f"a={a} b={b} size={size} ({len(keys)} claves)")
+    for h in sorted(table):
+        print(f"\t[{h}] = {table[h]}")